@@ -1,10 +1,25 @@
 #include "Application.h"
+#include "CommandStreamRecorder.h"
+#include "FrameCommandAllocator.h"
+#include "JobSystem.h"
+#include "ParallelCommandRecorder.h"
+#include "os/Common.h"
 #include "utils/Logger.h"
+#include <sstream>
 
 namespace Core {
 Application::Application() :
   m_Window(new Os::Window()),
-  m_VulkanRenderer(new Core::VulkanRenderer(true, MAX_FRAMES_IN_FLIGHT))
+  m_VulkanRenderer(new Core::VulkanRenderer(true, DEFAULT_FRAMES_IN_FLIGHT)),
+  m_JobSystem(new Core::JobSystem(JobSystem::GetDefaultWorkerCount())),
+  m_IsMinimized(false),
+  m_IsWaitingForResize(false),
+  m_WindowResizeCount(0),
+  m_IsHeadless(false),
+  m_HeadlessFrameCount(0),
+  m_PresentedFrameCount(0),
+  m_ParallelCommandRecorder(nullptr),
+  m_NextFrameDeadline(std::chrono::steady_clock::now())
 {}
 
 Application::~Application()
@@ -13,6 +28,8 @@ Application::~Application()
 bool Application::Start()
 {
   m_Window->SetOnWindowClose([this](Os::Window* window) { OnWindowClose(window); });
+  m_Window->SetOnWindowResize(
+    [this](Os::Window* window, uint32_t width, uint32_t height) { OnWindowResize(window, width, height); });
 
 #ifdef VK_USE_PLATFORM_WIN32_KHR
   m_IsRunning = true;
@@ -20,9 +37,9 @@ bool Application::Start()
   HANDLE renderThread = CreateThread(NULL, 0, RenderThreadStart, reinterpret_cast<void*>(this), 0, NULL);
   HANDLE transferThread = CreateThread(NULL, 0, TransferThreadStart, reinterpret_cast<void*>(this), 0, NULL);
 
-  while (m_IsRunning) {
-    m_Window->PollEvents();
-    _mm_pause();
+  // The main thread only pumps window messages, it sleeps until one arrives or Stop() wakes it up
+  while (m_IsRunning && !m_IsHeadless) {
+    m_Window->WaitEvents();
   }
 
   WaitForSingleObject(renderThread, INFINITE);
@@ -39,19 +56,75 @@ bool Application::Initialize(wchar_t const title[], uint32_t width, uint32_t hei
   return true;
 }
 
+bool Application::InitializeHeadless(uint32_t width, uint32_t height, uint64_t frameCount)
+{
+  m_IsHeadless = true;
+  m_HeadlessFrameCount = frameCount;
+  if (!m_VulkanRenderer->InitializeHeadless(vk::Extent2D(width, height))) { return false; }
+
+  return true;
+}
+
 void Application::AddToTransferQueue(std::shared_ptr<Core::CopyToLocalJob> const& job)
 {
-  std::lock_guard<std::mutex> lock(m_TransferQueueCriticalSection);
-  m_TransferQueue.push_back(job);
+  // Recorded when queued rather than when copied, so the upload keeps its place relative to the frames in a capture
+  if (CommandStreamRecorder* recorder = m_VulkanRenderer->GetCommandStreamRecorder()) {
+    switch (job->GetJobType()) {
+    case Core::CopyFlags::ToLocalBuffer:
+      recorder->RecordUploadBuffer(*std::static_pointer_cast<Core::CopyToLocalBufferJob>(job));
+      break;
+    case Core::CopyFlags::ToLocalImage:
+      recorder->RecordUploadImage(*std::static_pointer_cast<Core::CopyToLocalImageJob>(job));
+      break;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_TransferQueueCriticalSection);
+    m_TransferQueue.push_back(job);
+  }
+  m_TransferQueueWakeUp.notify_one();
+}
+
+void Application::Stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_RenderThreadCriticalSection);
+    m_IsRunning = false;
+  }
+  m_RenderThreadWakeUp.notify_all();
+  m_Window->Wake();
 }
 
 
 void Application::RenderThreadStart()
 {
   InitializeRendererCore();
+  auto renderStartTime = std::chrono::steady_clock::now();
   while (m_IsRunning) {
+    {
+      // Nothing can be presented to a minimized window or without a swapchain, park until the window gets restored or
+      // resized, or the application stops
+      std::unique_lock<std::mutex> lock(m_RenderThreadCriticalSection);
+      m_RenderThreadWakeUp.wait(lock, [this] { return !m_IsRunning || (!m_IsMinimized && !m_IsWaitingForResize); });
+    }
+    if (!m_IsRunning) { break; }
+
     // Draw here if you can
-    if (m_VulkanRenderer->CanRender()) { RenderCore(); }
+    if (m_VulkanRenderer->CanRender()) {
+      RenderCore();
+    } else {
+      RecreateSwapchain();
+    }
+    if (m_IsHeadless && m_PresentedFrameCount >= m_HeadlessFrameCount) { Stop(); }
+  }
+
+  if (m_IsHeadless) {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - renderStartTime;
+    std::ostringstream throughputMessage;
+    throughputMessage << "Headless run: " << m_PresentedFrameCount << " frames in " << elapsed.count() << " s ("
+                      << m_PresentedFrameCount / elapsed.count() << " fps)";
+    Utils::Logger::Get().LogInfo(throughputMessage.str(), "Renderer");
   }
 
   DestroyRendererCore();
@@ -71,66 +144,64 @@ void Application::TransferThreadStart()
     STAGING_MEMORY_SIZE,
     { vk::BufferUsageFlagBits::eTransferSrc },
     { vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent });
+  m_VulkanRenderer->SetDebugName(stagingBuffer, "Staging buffer");
 
-  void* stagingBufferPtr = m_VulkanRenderer->GetDevice().mapMemory(stagingBuffer.m_Memory, 0, stagingBuffer.m_Size, {});
-
-  uintptr_t currentPtr = reinterpret_cast<uintptr_t>(stagingBufferPtr);
+  uintptr_t currentPtr = reinterpret_cast<uintptr_t>(stagingBuffer.m_Allocation.m_MappedPtr);
   vk::DeviceSize bytesInUse = vk::DeviceSize(0);
 
   std::shared_ptr<Core::CopyToLocalJob> currentJob;
-  while (m_TransferRunning || m_TransferQueue.size() > 0) {
-    if (m_TransferQueue.size() > 0) {
-      currentJob = nullptr;
-      {
-        std::lock_guard<std::mutex> lock(m_TransferQueueCriticalSection);
-        currentJob = m_TransferQueue.back();
-        m_TransferQueue.pop_back();
-      }
+  while (true) {
+    {
+      // Sleeps until a job is queued, the remaining jobs are still processed once the transfers are stopped
+      std::unique_lock<std::mutex> lock(m_TransferQueueCriticalSection);
+      m_TransferQueueWakeUp.wait(lock, [this] { return !m_TransferRunning || m_TransferQueue.size() > 0; });
+      if (m_TransferQueue.size() == 0) { break; }
+      currentJob = m_TransferQueue.back();
+      m_TransferQueue.pop_back();
+    }
 
-      if (currentJob) {
-        m_VulkanRenderer->GetDevice().resetCommandPool(transferCommandPool, {});
-        m_VulkanRenderer->GetDevice().resetCommandPool(graphicsCommandPool, {});
-        memcpy(reinterpret_cast<void*>(currentPtr + bytesInUse), currentJob->GetDataPtr(), currentJob->GetSize());
-
-        vk::DeviceSize offsetRoundedDown = bytesInUse - (bytesInUse & (nonCoherentAtomSize - 1));
-        vk::DeviceSize sizeRoundedUp = ((currentJob->GetSize() + nonCoherentAtomSize - 1) & (~nonCoherentAtomSize + 1));
-        if (bytesInUse > offsetRoundedDown) { sizeRoundedUp += nonCoherentAtomSize; }
-
-        auto mappedMemoryRange = vk::MappedMemoryRange(stagingBuffer.m_Memory, // vk::DeviceMemory memory_ = {},
-                                                       offsetRoundedDown,      // vk::DeviceSize offset_ = {},
-                                                       sizeRoundedUp           // vk::DeviceSize size_ = {}
-        );
-
-        m_VulkanRenderer->GetDevice().flushMappedMemoryRanges(mappedMemoryRange);
-
-        switch (currentJob->GetJobType()) {
-        case Core::CopyFlags::ToLocalBuffer: {
-          m_VulkanRenderer->CopyToLocalBuffer(std::static_pointer_cast<Core::CopyToLocalBufferJob>(currentJob),
-                                              graphicsCommandBuffer,
-                                              transferCommandBuffer,
-                                              stagingBuffer.m_Handle,
-                                              bytesInUse);
-        } break;
-        case Core::CopyFlags::ToLocalImage: {
-          m_VulkanRenderer->CopyToLocalImage(std::static_pointer_cast<Core::CopyToLocalImageJob>(currentJob),
-                                             graphicsCommandBuffer,
-                                             transferCommandBuffer,
-                                             stagingBuffer.m_Handle,
-                                             bytesInUse);
-        } break;
-        default: {
-          throw std::runtime_error("Unreachable code reached. Thats a feat!");
-        } break;
-        }
-
-        bytesInUse += currentJob->GetSize();
+    if (currentJob) {
+      m_VulkanRenderer->GetDevice().resetCommandPool(transferCommandPool, {});
+      m_VulkanRenderer->GetDevice().resetCommandPool(graphicsCommandPool, {});
+      memcpy(reinterpret_cast<void*>(currentPtr + bytesInUse), currentJob->GetDataPtr(), currentJob->GetSize());
+
+      // The staging buffer lives inside a larger memory block, flush ranges are relative to the block
+      vk::DeviceSize memoryOffset = stagingBuffer.m_Allocation.m_Offset + bytesInUse;
+      vk::DeviceSize offsetRoundedDown = memoryOffset - (memoryOffset & (nonCoherentAtomSize - 1));
+      vk::DeviceSize sizeRoundedUp = ((currentJob->GetSize() + nonCoherentAtomSize - 1) & (~nonCoherentAtomSize + 1));
+      if (memoryOffset > offsetRoundedDown) { sizeRoundedUp += nonCoherentAtomSize; }
+
+      auto mappedMemoryRange = vk::MappedMemoryRange(stagingBuffer.m_Memory, // vk::DeviceMemory memory_ = {},
+                                                     offsetRoundedDown,      // vk::DeviceSize offset_ = {},
+                                                     sizeRoundedUp           // vk::DeviceSize size_ = {}
+      );
+
+      m_VulkanRenderer->GetDevice().flushMappedMemoryRanges(mappedMemoryRange);
+
+      switch (currentJob->GetJobType()) {
+      case Core::CopyFlags::ToLocalBuffer: {
+        m_VulkanRenderer->CopyToLocalBuffer(std::static_pointer_cast<Core::CopyToLocalBufferJob>(currentJob),
+                                            graphicsCommandBuffer,
+                                            transferCommandBuffer,
+                                            stagingBuffer.m_Handle,
+                                            bytesInUse);
+      } break;
+      case Core::CopyFlags::ToLocalImage: {
+        m_VulkanRenderer->CopyToLocalImage(std::static_pointer_cast<Core::CopyToLocalImageJob>(currentJob),
+                                           graphicsCommandBuffer,
+                                           transferCommandBuffer,
+                                           stagingBuffer.m_Handle,
+                                           bytesInUse);
+      } break;
+      default: {
+        throw std::runtime_error("Unreachable code reached. Thats a feat!");
+      } break;
       }
-    } else {
-      _mm_pause();
+
+      bytesInUse += currentJob->GetSize();
     }
   }
 
-  m_VulkanRenderer->GetDevice().unmapMemory(stagingBuffer.m_Memory);
   m_VulkanRenderer->FreeBuffer(stagingBuffer);
   m_VulkanRenderer->GetDevice().destroyCommandPool(graphicsCommandPool);
   m_VulkanRenderer->GetDevice().destroyCommandPool(transferCommandPool);
@@ -138,15 +209,15 @@ void Application::TransferThreadStart()
 
 void Application::InitializeRendererCore()
 {
-  m_MainCommandPools = std::vector<vk::CommandPool>(MAX_FRAMES_IN_FLIGHT);
-  for (uint32_t idx = 0; idx != MAX_FRAMES_IN_FLIGHT; ++idx) {
-    m_MainCommandPools[idx] = m_VulkanRenderer->CreateGraphicsCommandPool();
+  // Enough for the largest frames in flight setting, so frame pacing can change at runtime
+  m_ComputeCommandPools = std::vector<vk::CommandPool>(VulkanRenderer::MAX_FRAMES_IN_FLIGHT);
+  m_ComputeCommandBuffers = std::vector<vk::CommandBuffer>(VulkanRenderer::MAX_FRAMES_IN_FLIGHT);
+  for (uint32_t idx = 0; idx != VulkanRenderer::MAX_FRAMES_IN_FLIGHT; ++idx) {
+    m_ComputeCommandPools[idx] = m_VulkanRenderer->CreateComputeCommandPool();
+    m_ComputeCommandBuffers[idx] = m_VulkanRenderer->AllocateCommandBuffer(m_ComputeCommandPools[idx]);
   }
 
-  m_MainCommandBuffers = std::vector<vk::CommandBuffer>(MAX_FRAMES_IN_FLIGHT);
-  for (uint32_t idx = 0; idx != MAX_FRAMES_IN_FLIGHT; ++idx) {
-    m_MainCommandBuffers[idx] = m_VulkanRenderer->AllocateCommandBuffer(m_MainCommandPools[idx]);
-  }
+  m_ParallelCommandRecorder = std::make_unique<ParallelCommandRecorder>(m_VulkanRenderer.get(), m_JobSystem.get());
 
   m_VulkanRenderer->InitializeFrameResources();
 
@@ -155,6 +226,9 @@ void Application::InitializeRendererCore()
 
 void Application::RenderCore()
 {
+  m_VulkanRenderer->ApplyFramePacing();
+  LimitFrameRate();
+
   auto [acquireResult, frameResources] = m_VulkanRenderer->AcquireNextFrameResources();
   switch (acquireResult) {
   case vk::Result::eSuccess:
@@ -163,30 +237,61 @@ void Application::RenderCore()
   case vk::Result::eErrorOutOfDateKHR: {
     Utils::Logger::Get().LogDebugEx(
       "Swapchain image out of date during acquiring, recreating swapchain", "Renderer", __FILE__, __func__, __LINE__);
-    m_VulkanRenderer->RecreateSwapchain();
+    RecreateSwapchain();
     return;
   } break;
   default:
     throw std::runtime_error("Render error! " + vk::to_string(acquireResult));
   }
 
-  vk::CommandPool currentCommandPool = m_MainCommandPools[frameResources.m_FrameIdx];
-  vk::CommandBuffer commandBuffer = m_MainCommandBuffers[frameResources.m_FrameIdx];
+  auto elapsedInMs = [](std::chrono::steady_clock::time_point& phaseStart) {
+    auto phaseEnd = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double, std::milli>(phaseEnd - phaseStart).count();
+    phaseStart = phaseEnd;
+    return elapsed;
+  };
+  CpuFrameTimings cpuTimings = frameResources.m_CpuTimings;
+  auto phaseStart = std::chrono::steady_clock::now();
 
-  m_VulkanRenderer->GetDevice().resetCommandPool(currentCommandPool, {});
   PreRender(frameResources);
+  cpuTimings.m_PreRenderInMs = elapsedInMs(phaseStart);
+
+  // The graphics submission of this frame waits on the compute one, so the frame's fence covers both of them and the
+  // compute command pool is free again once the fence has been waited on
+  vk::CommandBuffer computeCommandBuffer = m_ComputeCommandBuffers[frameResources.m_FrameIdx];
+  m_VulkanRenderer->GetDevice().resetCommandPool(m_ComputeCommandPools[frameResources.m_FrameIdx], {});
+  computeCommandBuffer.begin(vk::CommandBufferBeginInfo({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit }, nullptr));
+  vk::PipelineStageFlags computeWaitStageMask = RenderCompute(frameResources, computeCommandBuffer);
+  computeCommandBuffer.end();
+  if (computeWaitStageMask) {
+    auto computeSubmitInfo =
+      vk::SubmitInfo(0,                                       // uint32_t waitSemaphoreCount_ = {},
+                     nullptr,                                 // const vk::Semaphore* pWaitSemaphores_ = {},
+                     nullptr,                                 // const vk::PipelineStageFlags* pWaitDstStageMask_ = {},
+                     1,                                       // uint32_t commandBufferCount_ = {},
+                     &computeCommandBuffer,                   // const vk::CommandBuffer* pCommandBuffers_ = {},
+                     1,                                       // uint32_t signalSemaphoreCount_ = {},
+                     &frameResources.m_ComputeToDrawSemaphore // const vk::Semaphore* pSignalSemaphores_ = {}
+      );
+    m_VulkanRenderer->SubmitToComputeQueue(computeSubmitInfo, nullptr);
+  }
 
+  // The frame's command allocator has been reset when the frame resources were acquired
+  vk::CommandBuffer commandBuffer = frameResources.m_CommandAllocator->AllocatePrimary();
   m_VulkanRenderer->BeginFrame(frameResources, commandBuffer);
+  m_VulkanRenderer->Defragment(frameResources, commandBuffer);
 
   Render(frameResources, commandBuffer);
 
   m_VulkanRenderer->EndFrame(frameResources, commandBuffer);
+  cpuTimings.m_RecordInMs = elapsedInMs(phaseStart);
 
-  vk::Semaphore waitSemaphores[] = { frameResources.m_PresentToDrawSemaphore };
-  vk::PipelineStageFlags waitStageMasks[] = { vk::PipelineStageFlagBits::eTransfer };
+  vk::Semaphore waitSemaphores[] = { frameResources.m_PresentToDrawSemaphore, frameResources.m_ComputeToDrawSemaphore };
+  // The swapchain image is first touched as a color attachment, see the import in AcquireNextFrameResources
+  vk::PipelineStageFlags waitStageMasks[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput, computeWaitStageMask };
 
   auto submitInfo =
-    vk::SubmitInfo(1,                                       // uint32_t waitSemaphoreCount_ = {},
+    vk::SubmitInfo(computeWaitStageMask ? 2 : 1,            // uint32_t waitSemaphoreCount_ = {},
                    waitSemaphores,                          // const vk::Semaphore* pWaitSemaphores_ = {},
                    waitStageMasks,                          // const vk::PipelineStageFlags* pWaitDstStageMask_ = {},
                    1,                                       // uint32_t commandBufferCount_ = {},
@@ -196,10 +301,14 @@ void Application::RenderCore()
     );
   m_VulkanRenderer->GetDevice().resetFences(frameResources.m_Fence);
   m_VulkanRenderer->SubmitToGraphicsQueue(submitInfo, frameResources.m_Fence);
+  cpuTimings.m_SubmitInMs = elapsedInMs(phaseStart);
   vk::Result presentResult = m_VulkanRenderer->PresentFrame(frameResources);
+  cpuTimings.m_PresentInMs = elapsedInMs(phaseStart);
+  m_VulkanRenderer->SetCpuFrameTimings(frameResources, cpuTimings);
 
   switch (presentResult) {
   case vk::Result::eSuccess: {
+    ++m_PresentedFrameCount;
     PostRender(frameResources.m_FrameStat);
   } break;
   case vk::Result::eErrorOutOfDateKHR:
@@ -209,7 +318,7 @@ void Application::RenderCore()
                                     __FILE__,
                                     __func__,
                                     __LINE__);
-    m_VulkanRenderer->RecreateSwapchain();
+    RecreateSwapchain();
     return;
   } break;
   default:
@@ -219,21 +328,71 @@ void Application::RenderCore()
 
 void Application::DestroyRendererCore()
 {
-  m_TransferRunning = false;
+  {
+    std::lock_guard<std::mutex> lock(m_TransferQueueCriticalSection);
+    m_TransferRunning = false;
+  }
+  m_TransferQueueWakeUp.notify_one();
   m_VulkanRenderer->GetDevice().waitIdle();
-  for (auto& commandPool : m_MainCommandPools) {
+  for (auto& commandPool : m_ComputeCommandPools) {
     m_VulkanRenderer->GetDevice().destroyCommandPool(commandPool);
   }
+  m_ParallelCommandRecorder.reset();
   OnDestroyRenderer();
 }
 
+void Application::LimitFrameRate()
+{
+  double frameLimitInMs = m_VulkanRenderer->GetFramePacing().m_FrameLimitInMs;
+  if (frameLimitInMs <= 0.0) { return; }
+
+  // Sleeping before the acquire keeps the input sampled by the frame as fresh as possible
+  m_NextFrameDeadline += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double, std::milli>(frameLimitInMs));
+  auto now = std::chrono::steady_clock::now();
+  if (m_NextFrameDeadline < now) {
+    // Fell behind, start over from now instead of rendering a burst of frames to catch up
+    m_NextFrameDeadline = now;
+    return;
+  }
+  Os::SleepUntil(m_NextFrameDeadline);
+}
+
 void Application::OnWindowClose(Os::Window* window)
 {
   UNREFERENCED_PARAMETER(window);
-  m_IsRunning = false;
+  Stop();
   OnWindowClosed();
 }
 
+void Application::OnWindowResize(Os::Window* window, uint32_t width, uint32_t height)
+{
+  UNREFERENCED_PARAMETER(window);
+  {
+    std::lock_guard<std::mutex> lock(m_RenderThreadCriticalSection);
+    m_IsMinimized = width == 0 || height == 0;
+    m_IsWaitingForResize = false;
+    ++m_WindowResizeCount;
+  }
+  // The swapchain is recreated by the render thread once the next acquire or present reports it as out of date
+  m_RenderThreadWakeUp.notify_all();
+}
+
+void Application::RecreateSwapchain()
+{
+  uint64_t windowResizeCount = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_RenderThreadCriticalSection);
+    windowResizeCount = m_WindowResizeCount;
+  }
+  if (m_VulkanRenderer->RecreateSwapchain()) { return; }
+
+  // Retrying right away would most likely fail the same way, the render thread parks until the window changes. A
+  // resize that arrived during the attempt is worth a retry already.
+  std::lock_guard<std::mutex> lock(m_RenderThreadCriticalSection);
+  m_IsWaitingForResize = windowResizeCount == m_WindowResizeCount;
+}
+
 DWORD WINAPI Application::RenderThreadStart(LPVOID param)
 {
   Application* app = reinterpret_cast<Application*>(param);
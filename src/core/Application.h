@@ -2,11 +2,16 @@
 
 #include "core/VulkanRenderer.h"
 #include "os/Window.h"
+#include <chrono>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <vector>
 
 namespace Core {
+class JobSystem;
+class ParallelCommandRecorder;
+
 class Application
 {
 public:
@@ -18,16 +23,34 @@ public:
 protected:
   inline Core::VulkanRenderer* Renderer() const { return m_VulkanRenderer.get(); }
   inline Os::Window* GetWindow() const { return m_Window.get(); }
+  // Shared pool for parallel CPU work, up from construction until the application is destroyed
+  inline Core::JobSystem* Jobs() const { return m_JobSystem.get(); }
+  // Lets Render spread the draws of a render pass over worker threads, see ParallelCommandRecorder
+  inline Core::ParallelCommandRecorder* CommandRecorder() const { return m_ParallelCommandRecorder.get(); }
 
   virtual void InitializeRenderer() = 0;
   virtual void PreRender(Core::FrameResource const& frameResources) = 0;
   virtual void Render(Core::FrameResource const& frameResources, vk::CommandBuffer const& commandBuffer) = 0;
+  // Records the frame's work for the compute queue, which starts before the graphics submission and may overlap the
+  // previous frame's graphics work. Returns the stages of the graphics submission that wait on it, nothing to skip the
+  // compute submission.
+  virtual vk::PipelineStageFlags RenderCompute(Core::FrameResource const& frameResources,
+                                               vk::CommandBuffer const& commandBuffer)
+  {
+    (void)frameResources;
+    (void)commandBuffer;
+    return {};
+  }
   virtual void PostRender(Core::FrameStat const& frameStats) = 0;
   virtual void OnDestroyRenderer() = 0;
   virtual void OnWindowClosed(){};
 
   bool Initialize(wchar_t const title[], uint32_t width, uint32_t height);
+  // No window is created, the application renders the given number of frames offscreen, logs the throughput and stops
+  bool InitializeHeadless(uint32_t width, uint32_t height, uint64_t frameCount);
   void AddToTransferQueue(std::shared_ptr<Core::CopyToLocalJob> const& job);
+  // Safe to call from any thread, wakes up the main and the render thread so they can exit
+  void Stop();
 
 private:
   void RenderThreadStart();
@@ -36,20 +59,35 @@ private:
   void RenderCore();
   void DestroyRendererCore();
   void OnWindowClose(Os::Window* window);
+  void OnWindowResize(Os::Window* window, uint32_t width, uint32_t height);
+  void LimitFrameRate();
+  void RecreateSwapchain();
 
   static DWORD WINAPI RenderThreadStart(LPVOID param);
   static DWORD WINAPI TransferThreadStart(LPVOID param);
 
-  static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+  static constexpr uint32_t DEFAULT_FRAMES_IN_FLIGHT = 3;
   static constexpr uint32_t STAGING_MEMORY_SIZE = 256 * 1024 * 1024;
   std::unique_ptr<Os::Window> m_Window;
   std::unique_ptr<Core::VulkanRenderer> m_VulkanRenderer;
+  std::unique_ptr<Core::JobSystem> m_JobSystem;
   volatile bool m_IsRunning;
   volatile bool m_TransferRunning;
+  std::mutex m_RenderThreadCriticalSection;
+  std::condition_variable m_RenderThreadWakeUp;
+  bool m_IsMinimized;
+  bool m_IsWaitingForResize; // the swapchain could not be recreated, retried once the window changes
+  uint64_t m_WindowResizeCount;
+  bool m_IsHeadless;
+  uint64_t m_HeadlessFrameCount;
+  uint64_t m_PresentedFrameCount;
   std::mutex m_TransferQueueCriticalSection;
+  std::condition_variable m_TransferQueueWakeUp;
   std::vector<std::shared_ptr<Core::CopyToLocalJob>> m_TransferQueue;
 
-  std::vector<vk::CommandPool> m_MainCommandPools;
-  std::vector<vk::CommandBuffer> m_MainCommandBuffers;
+  std::vector<vk::CommandPool> m_ComputeCommandPools;
+  std::vector<vk::CommandBuffer> m_ComputeCommandBuffers;
+  std::unique_ptr<Core::ParallelCommandRecorder> m_ParallelCommandRecorder;
+  std::chrono::steady_clock::time_point m_NextFrameDeadline;
 };
 } // namespace Core
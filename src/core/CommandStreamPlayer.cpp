@@ -0,0 +1,391 @@
+#include "CommandStreamPlayer.h"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "CopyToLocalBufferJob.h"
+#include "CopyToLocalImageJob.h"
+#include "RenderGraph.h"
+#include "utils/Logger.h"
+
+namespace Core {
+CommandStreamPlayer::CommandStreamPlayer() :
+  m_Renderer(nullptr),
+  m_UploadCallback(nullptr),
+  m_Data(std::vector<char>()),
+  m_Ops(std::vector<Op>()),
+  m_NextOpIdx(0),
+  m_FrameCommands(std::vector<Op>()),
+  m_FrameCount(0),
+  m_Extent(vk::Extent2D()),
+  m_Buffers(std::unordered_map<uint32_t, BufferData>()),
+  m_Images(std::unordered_map<uint32_t, PlayedImage>()),
+  m_Sampler(nullptr)
+{}
+
+bool CommandStreamPlayer::Load(std::filesystem::path const& path)
+{
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    Utils::Logger::Get().LogErrorEx(
+      "Could not open the capture file", "Renderer", __FILE__, __func__, __LINE__, path.string());
+    return false;
+  }
+
+  m_Data.resize(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(m_Data.data(), static_cast<std::streamsize>(m_Data.size()));
+  file.close();
+
+  CommandStreamHeader header;
+  if (m_Data.size() < sizeof(header)) {
+    Utils::Logger::Get().LogErrorEx("Capture file too short", "Renderer", __FILE__, __func__, __LINE__, path.string());
+    return false;
+  }
+  memcpy(&header, m_Data.data(), sizeof(header));
+  if (header.m_Magic != CommandStreamHeader::Magic || header.m_Version > CommandStreamHeader::CurrentVersion) {
+    Utils::Logger::Get().LogErrorEx(
+      "Not a capture file or written by a newer version", "Renderer", __FILE__, __func__, __LINE__, path.string());
+    return false;
+  }
+
+  size_t offset = sizeof(header);
+  while (offset < m_Data.size()) {
+    uint8_t type;
+    uint32_t payloadSize;
+    if (offset + sizeof(type) + sizeof(payloadSize) > m_Data.size()) { break; }
+    memcpy(&type, &m_Data[offset], sizeof(type));
+    memcpy(&payloadSize, &m_Data[offset + sizeof(type)], sizeof(payloadSize));
+    offset += sizeof(type) + sizeof(payloadSize);
+    if (offset + payloadSize > m_Data.size()) { break; }
+
+    // Ops of newer versions are skipped, their payload size is known
+    if (type <= static_cast<uint8_t>(CommandStreamOp::Draw)) {
+      Op op = Op{ static_cast<CommandStreamOp>(type), offset, payloadSize };
+      if (op.m_Type == CommandStreamOp::BeginFrame && m_Extent.width == 0) {
+        PayloadReader payload = GetPayload(op);
+        m_Extent.width = payload.Read<uint32_t>();
+        m_Extent.height = payload.Read<uint32_t>();
+      }
+      if (op.m_Type == CommandStreamOp::EndFrame) { ++m_FrameCount; }
+      m_Ops.push_back(op);
+    }
+    offset += payloadSize;
+  }
+
+  // The application may have been killed while capturing, everything up to the last complete op is still usable
+  if (offset < m_Data.size()) {
+    Utils::Logger::Get().LogWarningEx(
+      "Capture file ends with an incomplete op", "Renderer", __FILE__, __func__, __LINE__, path.string());
+  }
+
+  std::ostringstream debugOutput;
+  debugOutput << m_Ops.size() << " op(s), " << m_FrameCount << " frame(s) at " << m_Extent.width << "x"
+              << m_Extent.height;
+  Utils::Logger::Get().LogInfoEx("Capture loaded", "Renderer", __FILE__, __func__, __LINE__, debugOutput.str());
+  return m_FrameCount > 0;
+}
+
+void CommandStreamPlayer::Initialize(VulkanRenderer* renderer, UploadCallback uploadCallback)
+{
+  m_Renderer = renderer;
+  m_UploadCallback = uploadCallback;
+
+  // Samplers are not part of the capture, this matches the one of the sample application
+  auto samplerCreateInfo = vk::SamplerCreateInfo(
+    {},                                   // vk::SamplerCreateFlags flags_ = {},
+    vk::Filter::eLinear,                  // vk::Filter magFilter_ = vk::Filter::eNearest,
+    vk::Filter::eLinear,                  // vk::Filter minFilter_ = vk::Filter::eNearest,
+    vk::SamplerMipmapMode::eNearest,      // vk::SamplerMipmapMode mipmapMode_ = vk::SamplerMipmapMode::eNearest,
+    vk::SamplerAddressMode::eClampToEdge, // vk::SamplerAddressMode addressModeU_ = vk::SamplerAddressMode::eRepeat,
+    vk::SamplerAddressMode::eClampToEdge, // vk::SamplerAddressMode addressModeV_ = vk::SamplerAddressMode::eRepeat,
+    vk::SamplerAddressMode::eClampToEdge, // vk::SamplerAddressMode addressModeW_ = vk::SamplerAddressMode::eRepeat,
+    0.0f,                                 // float mipLodBias_ = {},
+    VK_FALSE,                             // vk::Bool32 anisotropyEnable_ = {},
+    1.0f,                                 // float maxAnisotropy_ = {},
+    VK_FALSE,                             // vk::Bool32 compareEnable_ = {},
+    vk::CompareOp::eAlways,               // vk::CompareOp compareOp_ = vk::CompareOp::eNever,
+    0.0f,                                 // float minLod_ = {},
+    0.0f,                                 // float maxLod_ = {},
+    vk::BorderColor::eFloatTransparentBlack, // vk::BorderColor borderColor_ =
+                                             // vk::BorderColor::eFloatTransparentBlack,
+    VK_FALSE                                 // vk::Bool32 unnormalizedCoordinates_ = {}
+  );
+  m_Sampler = m_Renderer->GetDevice().createSampler(samplerCreateInfo);
+
+  while (m_NextOpIdx != m_Ops.size() && m_Ops[m_NextOpIdx].m_Type != CommandStreamOp::BeginFrame) {
+    PlayResourceOp(m_Ops[m_NextOpIdx++], nullptr);
+  }
+}
+
+void CommandStreamPlayer::PlayFrame(FrameResource const& frameResources)
+{
+  m_FrameCommands.clear();
+  while (m_NextOpIdx != m_Ops.size() && m_Ops[m_NextOpIdx].m_Type != CommandStreamOp::BeginFrame) {
+    PlayResourceOp(m_Ops[m_NextOpIdx++], &frameResources);
+  }
+  if (m_NextOpIdx == m_Ops.size()) { return; }
+
+  ++m_NextOpIdx;
+  while (m_NextOpIdx != m_Ops.size() && m_Ops[m_NextOpIdx].m_Type != CommandStreamOp::EndFrame) {
+    Op const& op = m_Ops[m_NextOpIdx++];
+    if (IsCommand(op.m_Type)) {
+      m_FrameCommands.push_back(op);
+    } else {
+      PlayResourceOp(op, &frameResources);
+    }
+  }
+  if (m_NextOpIdx != m_Ops.size()) { ++m_NextOpIdx; }
+
+  if (m_FrameCommands.empty()) { return; }
+
+  vk::Framebuffer framebuffer = frameResources.m_Framebuffer;
+  vk::Extent2D extent =
+    vk::Extent2D(frameResources.m_SwapchainImage.m_ImageWidth, frameResources.m_SwapchainImage.m_ImageHeight);
+  vk::DescriptorSet descriptorSet = m_Renderer->GetDescriptorSet(frameResources);
+  RenderGraph& renderGraph = *frameResources.m_RenderGraph;
+  uint32_t replayPass =
+    renderGraph.AddPass("Replay pass", [this, framebuffer, extent, descriptorSet](vk::CommandBuffer commandBuffer) {
+      PlayCommands(commandBuffer, framebuffer, extent, descriptorSet);
+    });
+  renderGraph.Write(
+    replayPass, frameResources.m_SwapchainImage.m_GraphResourceId, RenderGraphAccess::ColorAttachmentWrite);
+
+  for (Op const& op : m_FrameCommands) {
+    if (op.m_Type != CommandStreamOp::BindVertexBuffer) { continue; }
+    auto buffer = m_Buffers.find(GetPayload(op).Read<uint32_t>());
+    if (buffer == m_Buffers.end()) { continue; }
+    RenderGraphResourceId vertexBuffer =
+      renderGraph.ImportBuffer("Replayed vertex buffer", buffer->second.m_Handle, 0, buffer->second.m_Size);
+    renderGraph.Read(replayPass, vertexBuffer, RenderGraphAccess::VertexBufferRead);
+  }
+}
+
+void CommandStreamPlayer::Free()
+{
+  if (!m_Renderer) { return; }
+
+  for (auto& [imageId, image] : m_Images) {
+    if (image.m_IsRegistered) {
+      m_Renderer->ReleaseImage(image.m_Handle);
+    } else {
+      m_Renderer->FreeImage(image.m_Data);
+    }
+  }
+  m_Images.clear();
+
+  for (auto& [bufferId, buffer] : m_Buffers) {
+    m_Renderer->FreeBuffer(buffer);
+  }
+  m_Buffers.clear();
+
+  if (m_Sampler) {
+    m_Renderer->GetDevice().destroySampler(m_Sampler);
+    m_Sampler = nullptr;
+  }
+}
+
+bool CommandStreamPlayer::IsCommand(CommandStreamOp type)
+{
+  switch (type) {
+  case CommandStreamOp::BeginRenderPass:
+  case CommandStreamOp::EndRenderPass:
+  case CommandStreamOp::BindPipeline:
+  case CommandStreamOp::BindDescriptorSets:
+  case CommandStreamOp::SetViewport:
+  case CommandStreamOp::SetScissor:
+  case CommandStreamOp::BindVertexBuffer:
+  case CommandStreamOp::Draw:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void CommandStreamPlayer::PlayResourceOp(Op const& op, FrameResource const* frameResources)
+{
+  PayloadReader payload = GetPayload(op);
+  switch (op.m_Type) {
+  case CommandStreamOp::CreateBuffer: {
+    uint32_t bufferId = payload.Read<uint32_t>();
+    vk::DeviceSize size = payload.Read<uint64_t>();
+    vk::BufferUsageFlags usage = vk::BufferUsageFlags(payload.Read<uint32_t>());
+    vk::MemoryPropertyFlags memoryProperties = vk::MemoryPropertyFlags(payload.Read<uint32_t>());
+    m_Buffers[bufferId] = m_Renderer->CreateBuffer(size, usage, memoryProperties);
+  } break;
+  case CommandStreamOp::FreeBuffer: {
+    auto buffer = m_Buffers.find(payload.Read<uint32_t>());
+    if (buffer == m_Buffers.end()) { break; }
+    m_Renderer->FreeBuffer(buffer->second);
+    m_Buffers.erase(buffer);
+  } break;
+  case CommandStreamOp::CreateImage: {
+    uint32_t imageId = payload.Read<uint32_t>();
+    uint32_t width = payload.Read<uint32_t>();
+    uint32_t height = payload.Read<uint32_t>();
+    vk::ImageUsageFlags usage = vk::ImageUsageFlags(payload.Read<uint32_t>());
+    vk::MemoryPropertyFlags memoryProperties = vk::MemoryPropertyFlags(payload.Read<uint32_t>());
+    m_Images[imageId] =
+      PlayedImage{ m_Renderer->CreateImage(width, height, usage, memoryProperties), ImageHandle(), false };
+  } break;
+  case CommandStreamOp::FreeImage: {
+    auto image = m_Images.find(payload.Read<uint32_t>());
+    if (image == m_Images.end()) { break; }
+    if (image->second.m_IsRegistered) {
+      m_Renderer->ReleaseImage(image->second.m_Handle);
+    } else {
+      m_Renderer->FreeImage(image->second.m_Data);
+    }
+    m_Images.erase(image);
+  } break;
+  case CommandStreamOp::UploadBuffer: {
+    auto buffer = m_Buffers.find(payload.Read<uint32_t>());
+    vk::DeviceSize destinationOffset = payload.Read<uint64_t>();
+    vk::AccessFlags destinationAccessFlags = vk::AccessFlags(payload.Read<uint32_t>());
+    vk::PipelineStageFlags destinationStageFlags = vk::PipelineStageFlags(payload.Read<uint32_t>());
+    vk::DeviceSize size = payload.Read<uint64_t>();
+    char* data = payload.ReadBytes(size);
+    if (buffer == m_Buffers.end()) { break; }
+
+    Upload(std::shared_ptr<CopyToLocalJob>(new CopyToLocalBufferJob(m_Renderer,
+                                                                    data,
+                                                                    size,
+                                                                    buffer->second.m_Handle,
+                                                                    destinationOffset,
+                                                                    destinationAccessFlags,
+                                                                    destinationStageFlags,
+                                                                    nullptr)));
+  } break;
+  case CommandStreamOp::UploadImage: {
+    auto image = m_Images.find(payload.Read<uint32_t>());
+    uint32_t width = payload.Read<uint32_t>();
+    uint32_t height = payload.Read<uint32_t>();
+    vk::ImageLayout destinationLayout = static_cast<vk::ImageLayout>(payload.Read<uint32_t>());
+    vk::AccessFlags destinationAccessFlags = vk::AccessFlags(payload.Read<uint32_t>());
+    vk::PipelineStageFlags destinationStageFlags = vk::PipelineStageFlags(payload.Read<uint32_t>());
+    vk::DeviceSize size = payload.Read<uint64_t>();
+    char* data = payload.ReadBytes(size);
+    if (image == m_Images.end()) { break; }
+
+    // Registered images may have been moved by the defragmenter since
+    PlayedImage& playedImage = image->second;
+    vk::Image destinationImage =
+      playedImage.m_IsRegistered ? m_Renderer->GetImage(playedImage.m_Handle).m_Handle : playedImage.m_Data.m_Handle;
+    Upload(std::shared_ptr<CopyToLocalJob>(new CopyToLocalImageJob(m_Renderer,
+                                                                   data,
+                                                                   size,
+                                                                   width,
+                                                                   height,
+                                                                   destinationImage,
+                                                                   destinationLayout,
+                                                                   destinationAccessFlags,
+                                                                   destinationStageFlags,
+                                                                   nullptr)));
+
+    // Same as the sample application does with its textures, so the defragmenter sees the same set of resources
+    vk::ImageUsageFlags const registrationUsage =
+      vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+    if (!playedImage.m_IsRegistered && (playedImage.m_Data.m_Usage & registrationUsage) == registrationUsage) {
+      playedImage.m_Handle = m_Renderer->RegisterImage(playedImage.m_Data, destinationLayout);
+      playedImage.m_IsRegistered = true;
+    }
+  } break;
+  case CommandStreamOp::WriteImageDescriptor: {
+    auto image = m_Images.find(payload.Read<uint32_t>());
+    if (image == m_Images.end()) { break; }
+    if (!image->second.m_IsRegistered) {
+      throw std::runtime_error("Only images registered with the renderer can be bound on replay");
+    }
+    m_Renderer->WriteImageDescriptor(m_Sampler, image->second.m_Handle, frameResources);
+  } break;
+  case CommandStreamOp::WriteUniformDescriptor: {
+    vk::DeviceSize size = payload.Read<uint64_t>();
+    char* data = payload.ReadBytes(size);
+    if (frameResources) { m_Renderer->WriteUniformDescriptor(*frameResources, data, size); }
+  } break;
+  default:
+    break;
+  }
+}
+
+void CommandStreamPlayer::PlayCommands(vk::CommandBuffer commandBuffer,
+                                       vk::Framebuffer framebuffer,
+                                       vk::Extent2D extent,
+                                       vk::DescriptorSet descriptorSet)
+{
+  for (Op const& op : m_FrameCommands) {
+    PayloadReader payload = GetPayload(op);
+    switch (op.m_Type) {
+    case CommandStreamOp::BeginRenderPass: {
+      std::array<float, 4> clearColor;
+      for (float& component : clearColor) {
+        component = payload.Read<float>();
+      }
+      vk::ClearValue clearValue = vk::ClearValue(vk::ClearColorValue(clearColor));
+      auto renderPassBeginInfo =
+        vk::RenderPassBeginInfo(m_Renderer->GetRenderPass(),            // vk::RenderPass renderPass_ = {},
+                                framebuffer,                            // vk::Framebuffer framebuffer_ = {},
+                                vk::Rect2D(vk::Offset2D(0, 0), extent), // vk::Rect2D renderArea_ = {},
+                                1,                                      // uint32_t clearValueCount_ = {},
+                                &clearValue                             // const vk::ClearValue* pClearValues_ = {}
+        );
+      commandBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+    } break;
+    case CommandStreamOp::EndRenderPass: {
+      commandBuffer.endRenderPass();
+    } break;
+    case CommandStreamOp::BindPipeline: {
+      commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_Renderer->GetPipeline());
+    } break;
+    case CommandStreamOp::BindDescriptorSets: {
+      commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+                                       m_Renderer->GetPipelineLayout(),
+                                       0,
+                                       descriptorSet,
+                                       nullptr);
+    } break;
+    case CommandStreamOp::SetViewport: {
+      vk::Viewport viewport;
+      viewport.x = payload.Read<float>();
+      viewport.y = payload.Read<float>();
+      viewport.width = payload.Read<float>();
+      viewport.height = payload.Read<float>();
+      viewport.minDepth = payload.Read<float>();
+      viewport.maxDepth = payload.Read<float>();
+      commandBuffer.setViewport(0, viewport);
+    } break;
+    case CommandStreamOp::SetScissor: {
+      vk::Rect2D scissor;
+      scissor.offset.x = payload.Read<int32_t>();
+      scissor.offset.y = payload.Read<int32_t>();
+      scissor.extent.width = payload.Read<uint32_t>();
+      scissor.extent.height = payload.Read<uint32_t>();
+      commandBuffer.setScissor(0, scissor);
+    } break;
+    case CommandStreamOp::BindVertexBuffer: {
+      auto buffer = m_Buffers.find(payload.Read<uint32_t>());
+      vk::DeviceSize offset = payload.Read<uint64_t>();
+      if (buffer == m_Buffers.end()) { throw std::runtime_error("Command stream binds an unknown buffer"); }
+      commandBuffer.bindVertexBuffers(0, buffer->second.m_Handle, offset);
+    } break;
+    case CommandStreamOp::Draw: {
+      uint32_t vertexCount = payload.Read<uint32_t>();
+      uint32_t instanceCount = payload.Read<uint32_t>();
+      uint32_t firstVertex = payload.Read<uint32_t>();
+      uint32_t firstInstance = payload.Read<uint32_t>();
+      commandBuffer.draw(vertexCount, instanceCount, firstVertex, firstInstance);
+    } break;
+    default:
+      break;
+    }
+  }
+}
+
+void CommandStreamPlayer::Upload(std::shared_ptr<CopyToLocalJob> const& job)
+{
+  m_UploadCallback(job);
+  job->WaitComplete();
+}
+} // namespace Core
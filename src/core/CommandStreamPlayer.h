@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "CommandStreamRecorder.h"
+#include "CopyToLocalJob.h"
+#include "VulkanRenderer.h"
+
+namespace Core {
+
+// Drives the operations of a CommandStreamRecorder capture through a renderer again. Resource operations and uploads
+// run on the CPU in their original order, the commands of a frame are replayed in a single render graph pass writing
+// the swapchain image. Uploads are waited on right away so every run sees the same resource contents at the same frame.
+class CommandStreamPlayer
+{
+public:
+  typedef std::function<void(std::shared_ptr<CopyToLocalJob> const& job)> UploadCallback;
+
+  CommandStreamPlayer();
+  CommandStreamPlayer(CommandStreamPlayer const& other) = delete;
+  CommandStreamPlayer& operator=(CommandStreamPlayer const& other) = delete;
+
+  // Reads and validates the whole capture, it stays in memory as the source of the uploads
+  bool Load(std::filesystem::path const& path);
+  inline uint64_t GetFrameCount() const { return m_FrameCount; }
+  // Swapchain extent of the first captured frame
+  inline vk::Extent2D GetExtent() const { return m_Extent; }
+
+  // Replays everything up to the first frame, uploads are queued through the callback, e.g. the application's transfer
+  // queue
+  void Initialize(VulkanRenderer* renderer, UploadCallback uploadCallback);
+  // Replays the next captured frame: its CPU side operations right away, its commands are added to the frame's graph
+  void PlayFrame(FrameResource const& frameResources);
+  // Frees the resources the capture left alive, has to run while the renderer is still around
+  void Free();
+
+private:
+  struct Op
+  {
+    CommandStreamOp m_Type;
+    size_t m_PayloadOffset;
+    uint32_t m_PayloadSize;
+  };
+
+  class PayloadReader
+  {
+  public:
+    PayloadReader(char* data, uint32_t size) : m_Data(data), m_Size(size), m_Position(0) {}
+
+    template <typename T> T Read()
+    {
+      T value;
+      memcpy(&value, ReadBytes(sizeof(T)), sizeof(T));
+      return value;
+    }
+
+    char* ReadBytes(uint64_t size)
+    {
+      if (m_Position + size > m_Size) { throw std::runtime_error("Truncated command stream op"); }
+      char* bytes = m_Data + m_Position;
+      m_Position += size;
+      return bytes;
+    }
+
+  private:
+    char* m_Data;
+    uint64_t m_Size;
+    uint64_t m_Position;
+  };
+
+  struct PlayedImage
+  {
+    ImageData m_Data;
+    ImageHandle m_Handle;
+    bool m_IsRegistered;
+  };
+
+  inline PayloadReader GetPayload(Op const& op) { return PayloadReader(&m_Data[op.m_PayloadOffset], op.m_PayloadSize); }
+  static bool IsCommand(CommandStreamOp type);
+  // Resource, upload and descriptor operations, the frame resources are only needed for the uniform writes
+  void PlayResourceOp(Op const& op, FrameResource const* frameResources);
+  void PlayCommands(vk::CommandBuffer commandBuffer,
+                    vk::Framebuffer framebuffer,
+                    vk::Extent2D extent,
+                    vk::DescriptorSet descriptorSet);
+  void Upload(std::shared_ptr<CopyToLocalJob> const& job);
+
+  VulkanRenderer* m_Renderer;
+  UploadCallback m_UploadCallback;
+  std::vector<char> m_Data;
+  std::vector<Op> m_Ops;
+  size_t m_NextOpIdx;
+  std::vector<Op> m_FrameCommands;
+  uint64_t m_FrameCount;
+  vk::Extent2D m_Extent;
+  std::unordered_map<uint32_t, BufferData> m_Buffers;
+  std::unordered_map<uint32_t, PlayedImage> m_Images;
+  vk::Sampler m_Sampler;
+};
+} // namespace Core
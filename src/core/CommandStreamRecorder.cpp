@@ -0,0 +1,420 @@
+#include "CommandStreamRecorder.h"
+
+#include <cassert>
+
+namespace Core {
+CommandStreamRecorder::CommandStreamRecorder() :
+  m_CriticalSection(std::mutex()),
+  m_BufferIds(std::unordered_map<VkBuffer, uint32_t>()),
+  m_ImageIds(std::unordered_map<VkImage, uint32_t>()),
+  m_NextResourceId(0),
+  m_FrameCount(0)
+{}
+
+CommandStreamRecorder::~CommandStreamRecorder()
+{
+  Close();
+}
+
+bool CommandStreamRecorder::Open(std::filesystem::path const& path)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  m_File.open(path, std::ios::binary | std::ios::trunc);
+  if (!m_File.is_open()) { return false; }
+
+  Write(CommandStreamHeader{ CommandStreamHeader::Magic, CommandStreamHeader::CurrentVersion });
+  return m_File.good();
+}
+
+void CommandStreamRecorder::Close()
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (m_File.is_open()) { m_File.close(); }
+  m_BufferIds.clear();
+  m_ImageIds.clear();
+}
+
+void CommandStreamRecorder::RecordCreateBuffer(BufferData const& buffer)
+{
+  if (buffer.m_MemoryProperties & vk::MemoryPropertyFlagBits::eHostVisible) { return; }
+
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (!m_File.is_open()) { return; }
+
+  uint32_t bufferId = m_NextResourceId++;
+  m_BufferIds[static_cast<VkBuffer>(buffer.m_Handle)] = bufferId;
+  BeginOp(CommandStreamOp::CreateBuffer, sizeof(uint32_t) * 3 + sizeof(uint64_t));
+  Write(bufferId);
+  Write(static_cast<uint64_t>(buffer.m_Size));
+  Write(static_cast<uint32_t>(buffer.m_Usage));
+  Write(static_cast<uint32_t>(buffer.m_MemoryProperties));
+}
+
+void CommandStreamRecorder::RecordFreeBuffer(BufferData const& buffer)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  uint32_t bufferId = FindBufferId(buffer.m_Handle);
+  if (!m_File.is_open() || bufferId == InvalidId) { return; }
+
+  m_BufferIds.erase(static_cast<VkBuffer>(buffer.m_Handle));
+  BeginOp(CommandStreamOp::FreeBuffer, sizeof(uint32_t));
+  Write(bufferId);
+}
+
+void CommandStreamRecorder::RecordCreateImage(ImageData const& image)
+{
+  if (image.m_MemoryProperties & vk::MemoryPropertyFlagBits::eHostVisible) { return; }
+
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (!m_File.is_open()) { return; }
+
+  uint32_t imageId = m_NextResourceId++;
+  m_ImageIds[static_cast<VkImage>(image.m_Handle)] = imageId;
+  BeginOp(CommandStreamOp::CreateImage, sizeof(uint32_t) * 5);
+  Write(imageId);
+  Write(image.m_Width);
+  Write(image.m_Height);
+  Write(static_cast<uint32_t>(image.m_Usage));
+  Write(static_cast<uint32_t>(image.m_MemoryProperties));
+}
+
+void CommandStreamRecorder::RecordFreeImage(ImageData const& image)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  uint32_t imageId = FindImageId(image.m_Handle);
+  if (!m_File.is_open() || imageId == InvalidId) { return; }
+
+  m_ImageIds.erase(static_cast<VkImage>(image.m_Handle));
+  BeginOp(CommandStreamOp::FreeImage, sizeof(uint32_t));
+  Write(imageId);
+}
+
+void CommandStreamRecorder::RecordMoveBuffer(vk::Buffer from, vk::Buffer to)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  uint32_t bufferId = FindBufferId(from);
+  if (bufferId == InvalidId) { return; }
+
+  m_BufferIds.erase(static_cast<VkBuffer>(from));
+  m_BufferIds[static_cast<VkBuffer>(to)] = bufferId;
+}
+
+void CommandStreamRecorder::RecordMoveImage(vk::Image from, vk::Image to)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  uint32_t imageId = FindImageId(from);
+  if (imageId == InvalidId) { return; }
+
+  m_ImageIds.erase(static_cast<VkImage>(from));
+  m_ImageIds[static_cast<VkImage>(to)] = imageId;
+}
+
+void CommandStreamRecorder::RecordUploadBuffer(CopyToLocalBufferJob const& job)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  uint32_t bufferId = FindBufferId(job.GetDestinationBuffer());
+  if (!m_File.is_open() || bufferId == InvalidId) { return; }
+
+  BeginOp(CommandStreamOp::UploadBuffer,
+          static_cast<uint32_t>(sizeof(uint32_t) * 3 + sizeof(uint64_t) * 2 + job.GetSize()));
+  Write(bufferId);
+  Write(static_cast<uint64_t>(job.GetDestinationOffset()));
+  Write(static_cast<uint32_t>(job.GetDestinationAccessFlags()));
+  Write(static_cast<uint32_t>(job.GetDestinationPipelineStageFlags()));
+  Write(static_cast<uint64_t>(job.GetSize()));
+  m_File.write(reinterpret_cast<char const*>(job.GetDataPtr()), static_cast<std::streamsize>(job.GetSize()));
+}
+
+void CommandStreamRecorder::RecordUploadImage(CopyToLocalImageJob const& job)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  uint32_t imageId = FindImageId(job.GetDestinationImage());
+  if (!m_File.is_open() || imageId == InvalidId) { return; }
+
+  BeginOp(CommandStreamOp::UploadImage,
+          static_cast<uint32_t>(sizeof(uint32_t) * 6 + sizeof(uint64_t) + job.GetSize()));
+  Write(imageId);
+  Write(job.GetImageWidth());
+  Write(job.GetImageHeight());
+  Write(static_cast<uint32_t>(job.GetDestinationLayout()));
+  Write(static_cast<uint32_t>(job.GetDestinationAccessFlags()));
+  Write(static_cast<uint32_t>(job.GetDestinationPipelineStageFlags()));
+  Write(static_cast<uint64_t>(job.GetSize()));
+  m_File.write(reinterpret_cast<char const*>(job.GetDataPtr()), static_cast<std::streamsize>(job.GetSize()));
+}
+
+void CommandStreamRecorder::RecordWriteImageDescriptor(vk::Image image)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  uint32_t imageId = FindImageId(image);
+  if (!m_File.is_open() || imageId == InvalidId) { return; }
+
+  BeginOp(CommandStreamOp::WriteImageDescriptor, sizeof(uint32_t));
+  Write(imageId);
+}
+
+void CommandStreamRecorder::RecordWriteUniformDescriptor(void const* data, vk::DeviceSize size)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (!m_File.is_open()) { return; }
+
+  BeginOp(CommandStreamOp::WriteUniformDescriptor, static_cast<uint32_t>(sizeof(uint64_t) + size));
+  Write(static_cast<uint64_t>(size));
+  m_File.write(reinterpret_cast<char const*>(data), static_cast<std::streamsize>(size));
+}
+
+void CommandStreamRecorder::RecordBeginFrame(vk::Extent2D extent)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (!m_File.is_open()) { return; }
+
+  BeginOp(CommandStreamOp::BeginFrame, sizeof(uint32_t) * 2);
+  Write(extent.width);
+  Write(extent.height);
+}
+
+void CommandStreamRecorder::RecordEndFrame()
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (!m_File.is_open()) { return; }
+
+  BeginOp(CommandStreamOp::EndFrame, 0);
+  ++m_FrameCount;
+}
+
+void CommandStreamRecorder::RecordBeginRenderPass(vk::ClearValue const& clearValue)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (!m_File.is_open()) { return; }
+
+  BeginOp(CommandStreamOp::BeginRenderPass, sizeof(float) * 4);
+  for (uint32_t componentIdx = 0; componentIdx != 4; ++componentIdx) {
+    Write(clearValue.color.float32[componentIdx]);
+  }
+}
+
+void CommandStreamRecorder::RecordEndRenderPass()
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (!m_File.is_open()) { return; }
+
+  BeginOp(CommandStreamOp::EndRenderPass, 0);
+}
+
+void CommandStreamRecorder::RecordBindPipeline()
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (!m_File.is_open()) { return; }
+
+  BeginOp(CommandStreamOp::BindPipeline, 0);
+}
+
+void CommandStreamRecorder::RecordBindDescriptorSets()
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (!m_File.is_open()) { return; }
+
+  BeginOp(CommandStreamOp::BindDescriptorSets, 0);
+}
+
+void CommandStreamRecorder::RecordSetViewport(vk::Viewport const& viewport)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (!m_File.is_open()) { return; }
+
+  BeginOp(CommandStreamOp::SetViewport, sizeof(float) * 6);
+  Write(viewport.x);
+  Write(viewport.y);
+  Write(viewport.width);
+  Write(viewport.height);
+  Write(viewport.minDepth);
+  Write(viewport.maxDepth);
+}
+
+void CommandStreamRecorder::RecordSetScissor(vk::Rect2D const& scissor)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (!m_File.is_open()) { return; }
+
+  BeginOp(CommandStreamOp::SetScissor, sizeof(int32_t) * 2 + sizeof(uint32_t) * 2);
+  Write(scissor.offset.x);
+  Write(scissor.offset.y);
+  Write(scissor.extent.width);
+  Write(scissor.extent.height);
+}
+
+void CommandStreamRecorder::RecordBindVertexBuffer(vk::Buffer buffer, vk::DeviceSize offset)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  uint32_t bufferId = FindBufferId(buffer);
+  if (!m_File.is_open() || bufferId == InvalidId) { return; }
+
+  BeginOp(CommandStreamOp::BindVertexBuffer, sizeof(uint32_t) + sizeof(uint64_t));
+  Write(bufferId);
+  Write(static_cast<uint64_t>(offset));
+}
+
+void CommandStreamRecorder::RecordDraw(uint32_t vertexCount,
+                                       uint32_t instanceCount,
+                                       uint32_t firstVertex,
+                                       uint32_t firstInstance)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  if (!m_File.is_open()) { return; }
+
+  BeginOp(CommandStreamOp::Draw, sizeof(uint32_t) * 4);
+  Write(vertexCount);
+  Write(instanceCount);
+  Write(firstVertex);
+  Write(firstInstance);
+}
+
+void CommandStreamRecorder::BeginOp(CommandStreamOp op, uint32_t payloadSize)
+{
+  Write(static_cast<uint8_t>(op));
+  Write(payloadSize);
+}
+
+uint32_t CommandStreamRecorder::FindBufferId(vk::Buffer buffer) const
+{
+  auto it = m_BufferIds.find(static_cast<VkBuffer>(buffer));
+  return it != m_BufferIds.end() ? it->second : InvalidId;
+}
+
+uint32_t CommandStreamRecorder::FindImageId(vk::Image image) const
+{
+  auto it = m_ImageIds.find(static_cast<VkImage>(image));
+  return it != m_ImageIds.end() ? it->second : InvalidId;
+}
+
+RecordingCommandBuffer::RecordingCommandBuffer(vk::CommandBuffer commandBuffer, CommandStreamRecorder* recorder) :
+  m_CommandBuffer(commandBuffer),
+  m_Recorder(recorder),
+  m_BoundPipeline(nullptr),
+  m_BoundPipelineLayout(nullptr),
+  m_BoundDescriptorSets(std::array<vk::DescriptorSet, MaxTrackedDescriptorSets>()),
+  m_BoundVertexBuffer(nullptr),
+  m_BoundVertexOffset(0),
+  m_Viewport(vk::Viewport()),
+  m_Scissor(vk::Rect2D()),
+  m_HasViewport(false),
+  m_HasScissor(false),
+  m_ElidedCommandCount(0)
+{}
+
+void RecordingCommandBuffer::InvalidateState()
+{
+  m_BoundPipeline = nullptr;
+  m_BoundPipelineLayout = nullptr;
+  m_BoundDescriptorSets.fill(nullptr);
+  m_BoundVertexBuffer = nullptr;
+  m_BoundVertexOffset = 0;
+  m_HasViewport = false;
+  m_HasScissor = false;
+}
+
+void RecordingCommandBuffer::BeginRenderPass(vk::RenderPassBeginInfo const& renderPassBeginInfo,
+                                             vk::SubpassContents contents)
+{
+  m_CommandBuffer.beginRenderPass(renderPassBeginInfo, contents);
+  if (m_Recorder) {
+    assert(renderPassBeginInfo.clearValueCount > 0);
+    m_Recorder->RecordBeginRenderPass(renderPassBeginInfo.pClearValues[0]);
+  }
+}
+
+void RecordingCommandBuffer::EndRenderPass()
+{
+  m_CommandBuffer.endRenderPass();
+  if (m_Recorder) { m_Recorder->RecordEndRenderPass(); }
+}
+
+void RecordingCommandBuffer::BindPipeline(vk::PipelineBindPoint bindPoint, vk::Pipeline pipeline)
+{
+  bool const isGraphics = bindPoint == vk::PipelineBindPoint::eGraphics;
+  if (isGraphics && pipeline == m_BoundPipeline) {
+    ++m_ElidedCommandCount;
+    return;
+  }
+
+  m_CommandBuffer.bindPipeline(bindPoint, pipeline);
+  if (m_Recorder) { m_Recorder->RecordBindPipeline(); }
+  if (!isGraphics) { return; }
+
+  // A pipeline with a static viewport or scissor overwrites them, the next Set calls have to go through
+  m_BoundPipeline = pipeline;
+  m_HasViewport = false;
+  m_HasScissor = false;
+}
+
+void RecordingCommandBuffer::BindDescriptorSets(vk::PipelineBindPoint bindPoint,
+                                                vk::PipelineLayout layout,
+                                                uint32_t firstSet,
+                                                vk::DescriptorSet descriptorSet)
+{
+  bool const isTracked = bindPoint == vk::PipelineBindPoint::eGraphics && firstSet < MaxTrackedDescriptorSets;
+  if (isTracked && layout == m_BoundPipelineLayout && descriptorSet == m_BoundDescriptorSets[firstSet]) {
+    ++m_ElidedCommandCount;
+    return;
+  }
+
+  m_CommandBuffer.bindDescriptorSets(bindPoint, layout, firstSet, descriptorSet, nullptr);
+  if (m_Recorder) { m_Recorder->RecordBindDescriptorSets(); }
+  if (!isTracked) { return; }
+
+  // Whether the other sets survive a layout change depends on the layouts being compatible, they are just forgotten
+  if (layout != m_BoundPipelineLayout) {
+    m_BoundDescriptorSets.fill(nullptr);
+    m_BoundPipelineLayout = layout;
+  }
+  m_BoundDescriptorSets[firstSet] = descriptorSet;
+}
+
+void RecordingCommandBuffer::SetViewport(vk::Viewport const& viewport)
+{
+  if (m_HasViewport && viewport == m_Viewport) {
+    ++m_ElidedCommandCount;
+    return;
+  }
+
+  m_CommandBuffer.setViewport(0, viewport);
+  if (m_Recorder) { m_Recorder->RecordSetViewport(viewport); }
+  m_Viewport = viewport;
+  m_HasViewport = true;
+}
+
+void RecordingCommandBuffer::SetScissor(vk::Rect2D const& scissor)
+{
+  if (m_HasScissor && scissor == m_Scissor) {
+    ++m_ElidedCommandCount;
+    return;
+  }
+
+  m_CommandBuffer.setScissor(0, scissor);
+  if (m_Recorder) { m_Recorder->RecordSetScissor(scissor); }
+  m_Scissor = scissor;
+  m_HasScissor = true;
+}
+
+void RecordingCommandBuffer::BindVertexBuffer(vk::Buffer buffer, vk::DeviceSize offset)
+{
+  if (buffer == m_BoundVertexBuffer && offset == m_BoundVertexOffset) {
+    ++m_ElidedCommandCount;
+    return;
+  }
+
+  m_CommandBuffer.bindVertexBuffers(0, buffer, offset);
+  if (m_Recorder) { m_Recorder->RecordBindVertexBuffer(buffer, offset); }
+  m_BoundVertexBuffer = buffer;
+  m_BoundVertexOffset = offset;
+}
+
+void RecordingCommandBuffer::Draw(uint32_t vertexCount,
+                                  uint32_t instanceCount,
+                                  uint32_t firstVertex,
+                                  uint32_t firstInstance)
+{
+  m_CommandBuffer.draw(vertexCount, instanceCount, firstVertex, firstInstance);
+  if (m_Recorder) { m_Recorder->RecordDraw(vertexCount, instanceCount, firstVertex, firstInstance); }
+}
+} // namespace Core
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <vulkan/vulkan.hpp>
+
+#include "VulkanRenderer.h"
+
+namespace Core {
+
+// Every op is written as its type, the size of its payload and the payload itself, so readers can skip the ones they
+// do not know. Resources are referred to by capture ids, the handles of the recording session mean nothing on replay.
+enum class CommandStreamOp : uint8_t
+{
+  CreateBuffer,
+  FreeBuffer,
+  CreateImage,
+  FreeImage,
+  UploadBuffer,
+  UploadImage,
+  WriteImageDescriptor,
+  WriteUniformDescriptor,
+  BeginFrame,
+  EndFrame,
+  BeginRenderPass,
+  EndRenderPass,
+  BindPipeline,
+  BindDescriptorSets,
+  SetViewport,
+  SetScissor,
+  BindVertexBuffer,
+  Draw
+};
+
+struct CommandStreamHeader
+{
+  static constexpr uint32_t Magic = 0x5343564c; // "LVCS"
+  static constexpr uint32_t CurrentVersion = 1;
+
+  uint32_t m_Magic;
+  uint32_t m_Version;
+};
+
+// Serializes the renderer level operations of a session into a compact binary file that CommandStreamPlayer can drive
+// again. Only resources in device local memory are captured: host visible ones are staging and upload arena buffers
+// of the renderer itself, their contents arrive through the recorded uploads and descriptor writes instead.
+// Operations on resources created before the capture started are dropped.
+class CommandStreamRecorder
+{
+public:
+  static constexpr uint32_t InvalidId = std::numeric_limits<uint32_t>::max();
+
+  CommandStreamRecorder();
+  CommandStreamRecorder(CommandStreamRecorder const& other) = delete;
+  CommandStreamRecorder& operator=(CommandStreamRecorder const& other) = delete;
+  ~CommandStreamRecorder();
+
+  bool Open(std::filesystem::path const& path);
+  void Close();
+  inline uint64_t GetFrameCount() const { return m_FrameCount; }
+
+  void RecordCreateBuffer(BufferData const& buffer);
+  void RecordFreeBuffer(BufferData const& buffer);
+  void RecordCreateImage(ImageData const& image);
+  void RecordFreeImage(ImageData const& image);
+  // The defragmenter moved a resource, later operations on the new handle keep referring to the same capture id
+  void RecordMoveBuffer(vk::Buffer from, vk::Buffer to);
+  void RecordMoveImage(vk::Image from, vk::Image to);
+  void RecordUploadBuffer(CopyToLocalBufferJob const& job);
+  void RecordUploadImage(CopyToLocalImageJob const& job);
+  void RecordWriteImageDescriptor(vk::Image image);
+  void RecordWriteUniformDescriptor(void const* data, vk::DeviceSize size);
+  void RecordBeginFrame(vk::Extent2D extent);
+  void RecordEndFrame();
+
+  void RecordBeginRenderPass(vk::ClearValue const& clearValue);
+  void RecordEndRenderPass();
+  void RecordBindPipeline();
+  void RecordBindDescriptorSets();
+  void RecordSetViewport(vk::Viewport const& viewport);
+  void RecordSetScissor(vk::Rect2D const& scissor);
+  void RecordBindVertexBuffer(vk::Buffer buffer, vk::DeviceSize offset);
+  void RecordDraw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance);
+
+private:
+  void BeginOp(CommandStreamOp op, uint32_t payloadSize);
+  template <typename T> void Write(T const& value)
+  {
+    m_File.write(reinterpret_cast<char const*>(&value), sizeof(T));
+  }
+  uint32_t FindBufferId(vk::Buffer buffer) const;
+  uint32_t FindImageId(vk::Image image) const;
+
+  std::mutex m_CriticalSection;
+  std::ofstream m_File;
+  std::unordered_map<VkBuffer, uint32_t> m_BufferIds;
+  std::unordered_map<VkImage, uint32_t> m_ImageIds;
+  uint32_t m_NextResourceId;
+  uint64_t m_FrameCount;
+};
+
+// Forwards to a command buffer and records the commands into the capture while one is running. Only the commands the
+// player can reproduce are wrapped, the renderer has a single pipeline and descriptor set, so binding them is recorded
+// without arguments. Anything else can still be recorded through Get(), it is just left out of the capture.
+//
+// The graphics pipeline, descriptor sets, vertex buffer, viewport and scissor set through the wrapper are tracked, and
+// calls that would leave them unchanged are dropped before they reach the command buffer or the capture. Binding a
+// different pipeline forgets the viewport and scissor, it may set them statically. The state starts out unknown.
+// Binding anything through Get() goes around the tracking, call InvalidateState afterwards.
+class RecordingCommandBuffer
+{
+public:
+  RecordingCommandBuffer(vk::CommandBuffer commandBuffer, CommandStreamRecorder* recorder);
+
+  inline vk::CommandBuffer Get() const { return m_CommandBuffer; }
+  void InvalidateState();
+  inline uint32_t GetElidedCommandCount() const { return m_ElidedCommandCount; }
+
+  void BeginRenderPass(vk::RenderPassBeginInfo const& renderPassBeginInfo, vk::SubpassContents contents);
+  void EndRenderPass();
+  void BindPipeline(vk::PipelineBindPoint bindPoint, vk::Pipeline pipeline);
+  void BindDescriptorSets(vk::PipelineBindPoint bindPoint,
+                          vk::PipelineLayout layout,
+                          uint32_t firstSet,
+                          vk::DescriptorSet descriptorSet);
+  void SetViewport(vk::Viewport const& viewport);
+  void SetScissor(vk::Rect2D const& scissor);
+  void BindVertexBuffer(vk::Buffer buffer, vk::DeviceSize offset);
+  void Draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance);
+
+private:
+  static constexpr uint32_t MaxTrackedDescriptorSets = 4; // sets bound at higher indices are always forwarded
+
+  vk::CommandBuffer m_CommandBuffer;
+  CommandStreamRecorder* m_Recorder;
+  vk::Pipeline m_BoundPipeline;
+  vk::PipelineLayout m_BoundPipelineLayout; // of the tracked descriptor sets
+  std::array<vk::DescriptorSet, MaxTrackedDescriptorSets> m_BoundDescriptorSets;
+  vk::Buffer m_BoundVertexBuffer;
+  vk::DeviceSize m_BoundVertexOffset;
+  vk::Viewport m_Viewport;
+  vk::Rect2D m_Scissor;
+  bool m_HasViewport;
+  bool m_HasScissor;
+  uint32_t m_ElidedCommandCount;
+};
+} // namespace Core
@@ -0,0 +1,346 @@
+#include "CpuCuller.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CORE_CULLING_X64 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC accepts the AVX2 intrinsics in any function, the CPU check happens at runtime
+#define CORE_CULLING_TARGET_AVX2
+#else
+#define CORE_CULLING_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace Core {
+namespace {
+// For every visible mask of a batch the lanes that are set, packed to the front, and their count
+struct CompactionTable
+{
+  alignas(32) std::array<std::array<uint32_t, 8>, 256> m_Lanes;
+  std::array<uint32_t, 256> m_Counts;
+};
+
+CompactionTable const& GetCompactionTable()
+{
+  static CompactionTable const table = []() {
+    CompactionTable result = CompactionTable();
+    for (uint32_t mask = 0; mask != 256; ++mask) {
+      uint32_t count = 0;
+      for (uint32_t lane = 0; lane != 8; ++lane) {
+        if (mask & (1u << lane)) { result.m_Lanes[mask][count++] = lane; }
+      }
+      result.m_Counts[mask] = count;
+    }
+    return result;
+  }();
+  return table;
+}
+
+// Branch free: the index is always written and only kept when the object is visible
+uint32_t CullAabbsScalar(
+  AabbBounds const& bounds, CullRect const& view, uint32_t begin, uint32_t end, uint32_t* visible, uint32_t count)
+{
+  for (uint32_t objectIdx = begin; objectIdx != end; ++objectIdx) {
+    bool isVisible = (bounds.m_MaxX[objectIdx] >= view.m_MinX) & (bounds.m_MinX[objectIdx] <= view.m_MaxX)
+                     & (bounds.m_MaxY[objectIdx] >= view.m_MinY) & (bounds.m_MinY[objectIdx] <= view.m_MaxY);
+    visible[count] = objectIdx;
+    count += isVisible ? 1u : 0u;
+  }
+  return count;
+}
+
+// Distance of the center from the view rectangle against the radius, zero inside the rectangle
+uint32_t CullCirclesScalar(
+  CircleBounds const& bounds, CullRect const& view, uint32_t begin, uint32_t end, uint32_t* visible, uint32_t count)
+{
+  for (uint32_t objectIdx = begin; objectIdx != end; ++objectIdx) {
+    float centerX = bounds.m_CenterX[objectIdx];
+    float centerY = bounds.m_CenterY[objectIdx];
+    float radius = bounds.m_Radius[objectIdx];
+    float distanceX = std::max(std::max(view.m_MinX - centerX, centerX - view.m_MaxX), 0.0f);
+    float distanceY = std::max(std::max(view.m_MinY - centerY, centerY - view.m_MaxY), 0.0f);
+    bool isVisible = distanceX * distanceX + distanceY * distanceY <= radius * radius;
+    visible[count] = objectIdx;
+    count += isVisible ? 1u : 0u;
+  }
+  return count;
+}
+
+#if defined(CORE_CULLING_X64)
+// SSE2 is part of x64, so this path needs no runtime check
+inline uint32_t CompactSse(
+  CompactionTable const& table, uint32_t mask, uint32_t firstIdx, uint32_t* visible, uint32_t count)
+{
+  __m128i lanes = _mm_load_si128(reinterpret_cast<__m128i const*>(table.m_Lanes[mask].data()));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(visible + count),
+                   _mm_add_epi32(lanes, _mm_set1_epi32(static_cast<int>(firstIdx))));
+  return count + table.m_Counts[mask];
+}
+
+uint32_t CullAabbsSse(AabbBounds const& bounds, CullRect const& view, uint32_t objectCount, uint32_t* visible)
+{
+  CompactionTable const& table = GetCompactionTable();
+  __m128 const viewMinX = _mm_set1_ps(view.m_MinX);
+  __m128 const viewMinY = _mm_set1_ps(view.m_MinY);
+  __m128 const viewMaxX = _mm_set1_ps(view.m_MaxX);
+  __m128 const viewMaxY = _mm_set1_ps(view.m_MaxY);
+
+  uint32_t count = 0;
+  uint32_t objectIdx = 0;
+  for (; objectIdx + 4 <= objectCount; objectIdx += 4) {
+    __m128 overlapX = _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(&bounds.m_MaxX[objectIdx]), viewMinX),
+                                 _mm_cmple_ps(_mm_loadu_ps(&bounds.m_MinX[objectIdx]), viewMaxX));
+    __m128 overlapY = _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(&bounds.m_MaxY[objectIdx]), viewMinY),
+                                 _mm_cmple_ps(_mm_loadu_ps(&bounds.m_MinY[objectIdx]), viewMaxY));
+    uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(_mm_and_ps(overlapX, overlapY)));
+    count = CompactSse(table, mask, objectIdx, visible, count);
+  }
+  return CullAabbsScalar(bounds, view, objectIdx, objectCount, visible, count);
+}
+
+uint32_t CullCirclesSse(CircleBounds const& bounds, CullRect const& view, uint32_t objectCount, uint32_t* visible)
+{
+  CompactionTable const& table = GetCompactionTable();
+  __m128 const viewMinX = _mm_set1_ps(view.m_MinX);
+  __m128 const viewMinY = _mm_set1_ps(view.m_MinY);
+  __m128 const viewMaxX = _mm_set1_ps(view.m_MaxX);
+  __m128 const viewMaxY = _mm_set1_ps(view.m_MaxY);
+  __m128 const zero = _mm_setzero_ps();
+
+  uint32_t count = 0;
+  uint32_t objectIdx = 0;
+  for (; objectIdx + 4 <= objectCount; objectIdx += 4) {
+    __m128 centerX = _mm_loadu_ps(&bounds.m_CenterX[objectIdx]);
+    __m128 centerY = _mm_loadu_ps(&bounds.m_CenterY[objectIdx]);
+    __m128 radius = _mm_loadu_ps(&bounds.m_Radius[objectIdx]);
+    __m128 distanceX = _mm_max_ps(_mm_max_ps(_mm_sub_ps(viewMinX, centerX), _mm_sub_ps(centerX, viewMaxX)), zero);
+    __m128 distanceY = _mm_max_ps(_mm_max_ps(_mm_sub_ps(viewMinY, centerY), _mm_sub_ps(centerY, viewMaxY)), zero);
+    __m128 distanceSquared = _mm_add_ps(_mm_mul_ps(distanceX, distanceX), _mm_mul_ps(distanceY, distanceY));
+    uint32_t mask =
+      static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(distanceSquared, _mm_mul_ps(radius, radius))));
+    count = CompactSse(table, mask, objectIdx, visible, count);
+  }
+  return CullCirclesScalar(bounds, view, objectIdx, objectCount, visible, count);
+}
+
+CORE_CULLING_TARGET_AVX2 inline uint32_t CompactAvx2(
+  CompactionTable const& table, uint32_t mask, uint32_t firstIdx, uint32_t* visible, uint32_t count)
+{
+  __m256i lanes = _mm256_load_si256(reinterpret_cast<__m256i const*>(table.m_Lanes[mask].data()));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(visible + count),
+                      _mm256_add_epi32(lanes, _mm256_set1_epi32(static_cast<int>(firstIdx))));
+  return count + table.m_Counts[mask];
+}
+
+CORE_CULLING_TARGET_AVX2 uint32_t CullAabbsAvx2(AabbBounds const& bounds,
+                                                CullRect const& view,
+                                                uint32_t objectCount,
+                                                uint32_t* visible)
+{
+  CompactionTable const& table = GetCompactionTable();
+  __m256 const viewMinX = _mm256_set1_ps(view.m_MinX);
+  __m256 const viewMinY = _mm256_set1_ps(view.m_MinY);
+  __m256 const viewMaxX = _mm256_set1_ps(view.m_MaxX);
+  __m256 const viewMaxY = _mm256_set1_ps(view.m_MaxY);
+
+  uint32_t count = 0;
+  uint32_t objectIdx = 0;
+  for (; objectIdx + 8 <= objectCount; objectIdx += 8) {
+    __m256 overlapX = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(&bounds.m_MaxX[objectIdx]), viewMinX, _CMP_GE_OQ),
+                                    _mm256_cmp_ps(_mm256_loadu_ps(&bounds.m_MinX[objectIdx]), viewMaxX, _CMP_LE_OQ));
+    __m256 overlapY = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(&bounds.m_MaxY[objectIdx]), viewMinY, _CMP_GE_OQ),
+                                    _mm256_cmp_ps(_mm256_loadu_ps(&bounds.m_MinY[objectIdx]), viewMaxY, _CMP_LE_OQ));
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_and_ps(overlapX, overlapY)));
+    count = CompactAvx2(table, mask, objectIdx, visible, count);
+  }
+  return CullAabbsScalar(bounds, view, objectIdx, objectCount, visible, count);
+}
+
+CORE_CULLING_TARGET_AVX2 uint32_t CullCirclesAvx2(CircleBounds const& bounds,
+                                                  CullRect const& view,
+                                                  uint32_t objectCount,
+                                                  uint32_t* visible)
+{
+  CompactionTable const& table = GetCompactionTable();
+  __m256 const viewMinX = _mm256_set1_ps(view.m_MinX);
+  __m256 const viewMinY = _mm256_set1_ps(view.m_MinY);
+  __m256 const viewMaxX = _mm256_set1_ps(view.m_MaxX);
+  __m256 const viewMaxY = _mm256_set1_ps(view.m_MaxY);
+  __m256 const zero = _mm256_setzero_ps();
+
+  uint32_t count = 0;
+  uint32_t objectIdx = 0;
+  for (; objectIdx + 8 <= objectCount; objectIdx += 8) {
+    __m256 centerX = _mm256_loadu_ps(&bounds.m_CenterX[objectIdx]);
+    __m256 centerY = _mm256_loadu_ps(&bounds.m_CenterY[objectIdx]);
+    __m256 radius = _mm256_loadu_ps(&bounds.m_Radius[objectIdx]);
+    __m256 distanceX =
+      _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(viewMinX, centerX), _mm256_sub_ps(centerX, viewMaxX)), zero);
+    __m256 distanceY =
+      _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(viewMinY, centerY), _mm256_sub_ps(centerY, viewMaxY)), zero);
+    __m256 distanceSquared =
+      _mm256_add_ps(_mm256_mul_ps(distanceX, distanceX), _mm256_mul_ps(distanceY, distanceY));
+    uint32_t mask = static_cast<uint32_t>(
+      _mm256_movemask_ps(_mm256_cmp_ps(distanceSquared, _mm256_mul_ps(radius, radius), _CMP_LE_OQ)));
+    count = CompactAvx2(table, mask, objectIdx, visible, count);
+  }
+  return CullCirclesScalar(bounds, view, objectIdx, objectCount, visible, count);
+}
+
+bool IsAvx2Supported()
+{
+#if defined(_MSC_VER)
+  int cpuInfo[4];
+  __cpuid(cpuInfo, 0);
+  if (cpuInfo[0] < 7) { return false; }
+
+  // The OS has to save the YMM registers as well, otherwise AVX faults even on a CPU that has it
+  __cpuid(cpuInfo, 1);
+  bool const hasOsxsave = (cpuInfo[2] & (1 << 27)) != 0;
+  bool const hasAvx = (cpuInfo[2] & (1 << 28)) != 0;
+  if (!hasOsxsave || !hasAvx || (_xgetbv(0) & 0x6) != 0x6) { return false; }
+
+  __cpuidex(cpuInfo, 7, 0);
+  return (cpuInfo[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+} // namespace
+
+void AabbBounds::Add(float minX, float minY, float maxX, float maxY)
+{
+  m_MinX.push_back(minX);
+  m_MinY.push_back(minY);
+  m_MaxX.push_back(maxX);
+  m_MaxY.push_back(maxY);
+}
+
+void AabbBounds::Clear()
+{
+  m_MinX.clear();
+  m_MinY.clear();
+  m_MaxX.clear();
+  m_MaxY.clear();
+}
+
+void CircleBounds::Add(float centerX, float centerY, float radius)
+{
+  m_CenterX.push_back(centerX);
+  m_CenterY.push_back(centerY);
+  m_Radius.push_back(radius);
+}
+
+void CircleBounds::Clear()
+{
+  m_CenterX.clear();
+  m_CenterY.clear();
+  m_Radius.clear();
+}
+
+CpuCuller::CpuCuller() :
+  m_InstructionSet(GetSupportedInstructionSet()),
+  m_VisibleIndices(),
+  m_VisibleCount(0)
+{}
+
+CullRect CpuCuller::GetViewRect(Mat4 const& viewProjection)
+{
+  // Clip space x = scaleX * x + offsetX, the view is where it falls into [-1, 1], same for y
+  float const* data = viewProjection.GetData();
+  float scaleX = data[0];
+  float scaleY = data[5];
+  float offsetX = data[12];
+  float offsetY = data[13];
+  assert(scaleX != 0.0f && scaleY != 0.0f);
+
+  float x0 = (-1.0f - offsetX) / scaleX;
+  float x1 = (1.0f - offsetX) / scaleX;
+  float y0 = (-1.0f - offsetY) / scaleY;
+  float y1 = (1.0f - offsetY) / scaleY;
+  return CullRect{ std::min(x0, x1), std::min(y0, y1), std::max(x0, x1), std::max(y0, y1) };
+}
+
+CpuCuller::InstructionSet CpuCuller::GetSupportedInstructionSet()
+{
+#if defined(CORE_CULLING_X64)
+  static bool const isAvx2Supported = IsAvx2Supported();
+  return isAvx2Supported ? InstructionSet::Avx2 : InstructionSet::Sse;
+#else
+  return InstructionSet::Scalar;
+#endif
+}
+
+char const* CpuCuller::GetInstructionSetName(InstructionSet instructionSet)
+{
+  switch (instructionSet) {
+  case InstructionSet::Scalar:
+    return "scalar";
+  case InstructionSet::Sse:
+    return "SSE";
+  case InstructionSet::Avx2:
+    return "AVX2";
+  }
+  return "unknown";
+}
+
+void CpuCuller::SetInstructionSet(InstructionSet instructionSet)
+{
+  m_InstructionSet = std::min(instructionSet, GetSupportedInstructionSet());
+}
+
+uint32_t CpuCuller::Cull(AabbBounds const& bounds, CullRect const& view)
+{
+  assert(bounds.m_MinY.size() == bounds.GetCount() && bounds.m_MaxX.size() == bounds.GetCount()
+         && bounds.m_MaxY.size() == bounds.GetCount());
+  uint32_t objectCount = bounds.GetCount();
+  uint32_t* visible = PrepareOutput(objectCount);
+
+#if defined(CORE_CULLING_X64)
+  if (m_InstructionSet == InstructionSet::Avx2) {
+    m_VisibleCount = CullAabbsAvx2(bounds, view, objectCount, visible);
+    return m_VisibleCount;
+  }
+  if (m_InstructionSet == InstructionSet::Sse) {
+    m_VisibleCount = CullAabbsSse(bounds, view, objectCount, visible);
+    return m_VisibleCount;
+  }
+#endif
+  m_VisibleCount = CullAabbsScalar(bounds, view, 0, objectCount, visible, 0);
+  return m_VisibleCount;
+}
+
+uint32_t CpuCuller::Cull(CircleBounds const& bounds, CullRect const& view)
+{
+  assert(bounds.m_CenterY.size() == bounds.GetCount() && bounds.m_Radius.size() == bounds.GetCount());
+  uint32_t objectCount = bounds.GetCount();
+  uint32_t* visible = PrepareOutput(objectCount);
+
+#if defined(CORE_CULLING_X64)
+  if (m_InstructionSet == InstructionSet::Avx2) {
+    m_VisibleCount = CullCirclesAvx2(bounds, view, objectCount, visible);
+    return m_VisibleCount;
+  }
+  if (m_InstructionSet == InstructionSet::Sse) {
+    m_VisibleCount = CullCirclesSse(bounds, view, objectCount, visible);
+    return m_VisibleCount;
+  }
+#endif
+  m_VisibleCount = CullCirclesScalar(bounds, view, 0, objectCount, visible, 0);
+  return m_VisibleCount;
+}
+
+uint32_t* CpuCuller::PrepareOutput(uint32_t objectCount)
+{
+  // Growing only, a resize down and up again would clear the whole list every call
+  if (m_VisibleIndices.size() < objectCount + OutputPadding) { m_VisibleIndices.resize(objectCount + OutputPadding); }
+  m_VisibleCount = 0;
+  return m_VisibleIndices.data();
+}
+} // namespace Core
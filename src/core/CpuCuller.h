@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Mat4.h"
+
+namespace Core {
+
+// Part of the world a view shows, in world units
+struct CullRect
+{
+  float m_MinX;
+  float m_MinY;
+  float m_MaxX;
+  float m_MaxY;
+};
+
+// Bounds as structure of arrays, a batch of objects is a single load per component
+struct AabbBounds
+{
+  std::vector<float> m_MinX;
+  std::vector<float> m_MinY;
+  std::vector<float> m_MaxX;
+  std::vector<float> m_MaxY;
+
+  void Add(float minX, float minY, float maxX, float maxY);
+  void Clear();
+  inline uint32_t GetCount() const { return static_cast<uint32_t>(m_MinX.size()); }
+};
+
+struct CircleBounds
+{
+  std::vector<float> m_CenterX;
+  std::vector<float> m_CenterY;
+  std::vector<float> m_Radius;
+
+  void Add(float centerX, float centerY, float radius);
+  void Clear();
+  inline uint32_t GetCount() const { return static_cast<uint32_t>(m_CenterX.size()); }
+};
+
+// Culls 2D bounds against an orthographic view on the CPU, 8 objects at a time with AVX2, 4 with SSE and one by one
+// everywhere else. The widest instruction set the CPU supports is picked at construction. The indices of the visible
+// objects come out compacted and in increasing order.
+class CpuCuller
+{
+public:
+  enum class InstructionSet : uint32_t
+  {
+    Scalar,
+    Sse,
+    Avx2
+  };
+
+  CpuCuller();
+  CpuCuller(CpuCuller const& other) = delete;
+  CpuCuller& operator=(CpuCuller const& other) = delete;
+
+  // The view rectangle of an orthographic projection without rotation, like the ones from Mat4::GetOrthographic
+  static CullRect GetViewRect(Mat4 const& viewProjection);
+  static InstructionSet GetSupportedInstructionSet();
+  static char const* GetInstructionSetName(InstructionSet instructionSet);
+
+  // Anything wider than what the CPU supports falls back to the supported one
+  void SetInstructionSet(InstructionSet instructionSet);
+  inline InstructionSet GetInstructionSet() const { return m_InstructionSet; }
+
+  // Both replace the visible indices of the previous call and return their count. Bounds touching the edge of the view
+  // count as visible.
+  uint32_t Cull(AabbBounds const& bounds, CullRect const& view);
+  uint32_t Cull(CircleBounds const& bounds, CullRect const& view);
+
+  inline uint32_t const* GetVisibleIndices() const { return m_VisibleIndices.data(); }
+  inline uint32_t GetVisibleCount() const { return m_VisibleCount; }
+
+private:
+  // The batches store all of their lanes and only advance by the visible ones, so the output needs room for one more
+  static constexpr uint32_t OutputPadding = 8;
+
+  uint32_t* PrepareOutput(uint32_t objectCount);
+
+  InstructionSet m_InstructionSet;
+  std::vector<uint32_t> m_VisibleIndices; // never shrinks, the padding stays allocated between calls
+  uint32_t m_VisibleCount;
+};
+} // namespace Core
@@ -0,0 +1,129 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "utils/Logger.h"
+
+namespace Core {
+DynamicResolution::DynamicResolution(DynamicResolutionSettings const& settings) :
+  m_Settings(settings),
+  m_IsEnabled(false),
+  m_Scale(settings.m_MaxScale),
+  m_FramesToSkip(0),
+  m_FrameTimeSumInMs(0.0),
+  m_SampleCount(0)
+{}
+
+bool DynamicResolution::IsSupported(VulkanRenderer const& renderer, vk::Format format)
+{
+  vk::FormatFeatureFlags const requiredFeatures = vk::FormatFeatureFlagBits::eBlitSrc
+                                                  | vk::FormatFeatureFlagBits::eBlitDst
+                                                  | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+  vk::FormatProperties formatProperties = renderer.GetPhysicalDevice().getFormatProperties(format);
+  return (formatProperties.optimalTilingFeatures & requiredFeatures) == requiredFeatures;
+}
+
+void DynamicResolution::Update(double gpuFrameTimeInMs)
+{
+  if (!m_IsEnabled) { return; }
+  if (m_FramesToSkip > 0) {
+    --m_FramesToSkip;
+    return;
+  }
+
+  m_FrameTimeSumInMs += gpuFrameTimeInMs;
+  if (++m_SampleCount < m_Settings.m_SampleWindowInFrames) { return; }
+
+  double averageFrameTimeInMs = m_FrameTimeSumInMs / m_SampleCount;
+  float scale = m_Scale;
+  if (averageFrameTimeInMs > m_Settings.m_TargetFrameTimeInMs) {
+    float idealScale = m_Scale * static_cast<float>(std::sqrt(m_Settings.m_TargetFrameTimeInMs / averageFrameTimeInMs));
+    scale = std::floor(idealScale / m_Settings.m_ScaleStep) * m_Settings.m_ScaleStep;
+  } else if (averageFrameTimeInMs < m_Settings.m_TargetFrameTimeInMs * (1.0 - m_Settings.m_Headroom)) {
+    scale = m_Scale + m_Settings.m_ScaleStep;
+  }
+  scale = std::clamp(scale, m_Settings.m_MinScale, m_Settings.m_MaxScale);
+
+  if (std::abs(scale - m_Scale) < m_Settings.m_ScaleStep / 2.0f) {
+    Restart(0);
+    return;
+  }
+
+  std::ostringstream debugOutput;
+  debugOutput << "Average GPU frame time: " << averageFrameTimeInMs << " ms, scale: " << m_Scale << " -> " << scale;
+  Utils::Logger::Get().LogDebugEx(
+    "Render scale changed", "Renderer", __FILE__, __func__, __LINE__, debugOutput.str());
+  m_Scale = scale;
+  Restart(m_Settings.m_SkippedFramesAfterChange);
+}
+
+void DynamicResolution::SetEnabled(bool isEnabled)
+{
+  m_IsEnabled = isEnabled;
+  m_Scale = m_Settings.m_MaxScale;
+  Restart(m_Settings.m_SkippedFramesAfterChange);
+}
+
+vk::Extent2D DynamicResolution::GetRenderExtent(vk::Extent2D outputExtent) const
+{
+  float scale = m_IsEnabled ? m_Scale : 1.0f;
+  return vk::Extent2D(std::max(1u, static_cast<uint32_t>(static_cast<float>(outputExtent.width) * scale + 0.5f)),
+                      std::max(1u, static_cast<uint32_t>(static_cast<float>(outputExtent.height) * scale + 0.5f)));
+}
+
+RenderGraphResourceId DynamicResolution::CreateSceneTarget(RenderGraph& renderGraph,
+                                                           vk::Extent2D outputExtent,
+                                                           vk::Format format) const
+{
+  vk::Extent2D renderExtent = GetRenderExtent(outputExtent);
+  return renderGraph.CreateImage("Scene target", renderExtent.width, renderExtent.height, format);
+}
+
+uint32_t DynamicResolution::AddUpscalePass(RenderGraph& renderGraph,
+                                           RenderGraphResourceId sceneTarget,
+                                           RenderGraphResourceId output,
+                                           vk::Image outputImage,
+                                           vk::Extent2D outputExtent) const
+{
+  vk::Extent2D renderExtent = GetRenderExtent(outputExtent);
+  RenderGraph* graph = &renderGraph;
+  uint32_t upscalePass = renderGraph.AddPass(
+    "Upscale pass", [graph, sceneTarget, outputImage, renderExtent, outputExtent](vk::CommandBuffer commandBuffer) {
+      auto subresourceLayers = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, // aspectMask_
+                                                          0,                               // mipLevel_
+                                                          0,                               // baseArrayLayer_
+                                                          1                                // layerCount_
+      );
+      auto region = vk::ImageBlit(
+        subresourceLayers, // vk::ImageSubresourceLayers srcSubresource_ = {},
+        { vk::Offset3D(0, 0, 0),
+          vk::Offset3D(static_cast<int32_t>(renderExtent.width),
+                       static_cast<int32_t>(renderExtent.height),
+                       1) },  // std::array<vk::Offset3D,2> const& srcOffsets_
+        subresourceLayers, // vk::ImageSubresourceLayers dstSubresource_ = {},
+        { vk::Offset3D(0, 0, 0),
+          vk::Offset3D(static_cast<int32_t>(outputExtent.width),
+                       static_cast<int32_t>(outputExtent.height),
+                       1) } // std::array<vk::Offset3D,2> const& dstOffsets_
+      );
+      commandBuffer.blitImage(graph->GetImage(sceneTarget).m_Handle,
+                              vk::ImageLayout::eTransferSrcOptimal,
+                              outputImage,
+                              vk::ImageLayout::eTransferDstOptimal,
+                              region,
+                              vk::Filter::eLinear);
+    });
+  renderGraph.Read(upscalePass, sceneTarget, RenderGraphAccess::TransferRead);
+  renderGraph.Write(upscalePass, output, RenderGraphAccess::TransferWrite);
+  return upscalePass;
+}
+
+void DynamicResolution::Restart(uint32_t skippedFrames)
+{
+  m_FramesToSkip = skippedFrames;
+  m_FrameTimeSumInMs = 0.0;
+  m_SampleCount = 0;
+}
+} // namespace Core
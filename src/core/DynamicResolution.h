@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+
+#include "RenderGraph.h"
+#include "VulkanRenderer.h"
+
+namespace Core {
+
+struct DynamicResolutionSettings
+{
+  double m_TargetFrameTimeInMs;
+  float m_MinScale;
+  float m_MaxScale;
+  // Scales are multiples of the step, so the transient scene target is only recreated on an actual change
+  float m_ScaleStep;
+  // The scale only goes up once the frame time is this fraction below the target, going down starts right at the
+  // target. The gap keeps a scale that lands just around the target from flipping back and forth.
+  double m_Headroom;
+  // Frame times are averaged over this many frames before a decision
+  uint32_t m_SampleWindowInFrames;
+  // Frames still in flight or read back late were rendered at the previous scale, they are ignored after a change
+  uint32_t m_SkippedFramesAfterChange;
+
+  static DynamicResolutionSettings Default()
+  {
+    return DynamicResolutionSettings{
+      1000.0 / 60.0, 0.5f, 1.0f, 0.05f, 0.15, 8, VulkanRenderer::MAX_FRAMES_IN_FLIGHT + 1
+    };
+  }
+};
+
+// Picks the render scale of an offscreen scene target from the measured GPU frame time, the scene is then upscaled
+// to the swapchain in a final pass. GPU time is assumed to scale with the pixel count, so an overloaded frame shrinks
+// the scale by the square root of the overshoot at once, while it only grows back one step at a time. It starts out
+// disabled.
+class DynamicResolution
+{
+public:
+  DynamicResolution(DynamicResolutionSettings const& settings = DynamicResolutionSettings::Default());
+
+  // The upscale is a linearly filtered blit between two images of the format, which the device has to support
+  static bool IsSupported(VulkanRenderer const& renderer, vk::Format format);
+
+  // GPU time of a completed frame, see VulkanRenderer::GetFrameTimeInMs
+  void Update(double gpuFrameTimeInMs);
+  void SetEnabled(bool isEnabled);
+  inline bool IsEnabled() const { return m_IsEnabled; }
+  inline float GetScale() const { return m_Scale; }
+  vk::Extent2D GetRenderExtent(vk::Extent2D outputExtent) const;
+
+  // Transient scene target of the frame at the current render scale
+  RenderGraphResourceId CreateSceneTarget(RenderGraph& renderGraph,
+                                          vk::Extent2D outputExtent,
+                                          vk::Format format) const;
+  // Blits the scene target onto the output with linear filtering, the output image is the one imported as output
+  uint32_t AddUpscalePass(RenderGraph& renderGraph,
+                          RenderGraphResourceId sceneTarget,
+                          RenderGraphResourceId output,
+                          vk::Image outputImage,
+                          vk::Extent2D outputExtent) const;
+
+private:
+  void Restart(uint32_t skippedFrames);
+
+  DynamicResolutionSettings m_Settings;
+  bool m_IsEnabled;
+  float m_Scale;
+  uint32_t m_FramesToSkip;
+  double m_FrameTimeSumInMs;
+  uint32_t m_SampleCount;
+};
+} // namespace Core
@@ -0,0 +1,71 @@
+#include "FrameCommandAllocator.h"
+
+namespace Core {
+FrameCommandAllocator::FrameCommandAllocator(VulkanRenderer* renderer) : m_Renderer(renderer), m_ThreadPools() {}
+
+FrameCommandAllocator::~FrameCommandAllocator()
+{
+  // Destroying a pool frees its command buffers as well
+  for (auto& [threadId, threadPool] : m_ThreadPools) {
+    (void)threadId;
+    m_Renderer->GetDevice().destroyCommandPool(threadPool->m_CommandPool);
+  }
+}
+
+vk::CommandBuffer FrameCommandAllocator::AllocatePrimary()
+{
+  ThreadPool& threadPool = GetThreadPool();
+  return Allocate(threadPool.m_CommandPool, threadPool.m_Primary, vk::CommandBufferLevel::ePrimary);
+}
+
+vk::CommandBuffer FrameCommandAllocator::AllocateSecondary()
+{
+  ThreadPool& threadPool = GetThreadPool();
+  return Allocate(threadPool.m_CommandPool, threadPool.m_Secondary, vk::CommandBufferLevel::eSecondary);
+}
+
+void FrameCommandAllocator::Reset()
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  for (auto& [threadId, threadPool] : m_ThreadPools) {
+    (void)threadId;
+    m_Renderer->GetDevice().resetCommandPool(threadPool->m_CommandPool, {});
+    threadPool->m_Primary.m_UsedCount = 0;
+    threadPool->m_Secondary.m_UsedCount = 0;
+  }
+}
+
+FrameCommandAllocator::ThreadPool& FrameCommandAllocator::GetThreadPool()
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  std::unique_ptr<ThreadPool>& threadPool = m_ThreadPools[std::this_thread::get_id()];
+  if (!threadPool) {
+    // Buffers are recorded from scratch every frame, the whole pool is reset at once
+    auto commandPoolCreateInfo = vk::CommandPoolCreateInfo(
+      { vk::CommandPoolCreateFlagBits::eTransient }, // vk::CommandPoolCreateFlags flags_ = {},
+      m_Renderer->GetGraphicsQueueFamilyIdx()        // uint32_t queueFamilyIndex_ = {}
+    );
+    threadPool = std::make_unique<ThreadPool>();
+    threadPool->m_CommandPool = m_Renderer->GetDevice().createCommandPool(commandPoolCreateInfo);
+    threadPool->m_Primary.m_UsedCount = 0;
+    threadPool->m_Secondary.m_UsedCount = 0;
+  }
+  return *threadPool;
+}
+
+vk::CommandBuffer FrameCommandAllocator::Allocate(vk::CommandPool commandPool,
+                                                  CommandBuffers& commandBuffers,
+                                                  vk::CommandBufferLevel level)
+{
+  if (commandBuffers.m_UsedCount == commandBuffers.m_Buffers.size()) {
+    auto allocateInfo = vk::CommandBufferAllocateInfo(
+      commandPool, // vk::CommandPool commandPool_ = {},
+      level,       // vk::CommandBufferLevel level_ = vk::CommandBufferLevel::ePrimary,
+      1            // uint32_t commandBufferCount_ = {}
+    );
+    commandBuffers.m_Buffers.push_back(m_Renderer->GetDevice().allocateCommandBuffers(allocateInfo)[0]);
+  }
+
+  return commandBuffers.m_Buffers[commandBuffers.m_UsedCount++];
+}
+} // namespace Core
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "VulkanRenderer.h"
+
+namespace Core {
+
+// Per frame source of graphics command buffers. Every thread recording for the frame gets its own command pool, so
+// allocation and recording need no locking beyond finding that pool. Buffers are allocated once and handed out again
+// after Reset(), which resets all pools together when the owning frame's fence has signaled.
+class FrameCommandAllocator
+{
+public:
+  FrameCommandAllocator(VulkanRenderer* renderer);
+  FrameCommandAllocator(FrameCommandAllocator const& other) = delete;
+  FrameCommandAllocator& operator=(FrameCommandAllocator const& other) = delete;
+  ~FrameCommandAllocator();
+
+  // Valid until the next Reset(), to be recorded on the calling thread only
+  vk::CommandBuffer AllocatePrimary();
+  vk::CommandBuffer AllocateSecondary();
+  void Reset();
+
+private:
+  struct CommandBuffers
+  {
+    std::vector<vk::CommandBuffer> m_Buffers;
+    uint32_t m_UsedCount;
+  };
+
+  struct ThreadPool
+  {
+    vk::CommandPool m_CommandPool;
+    CommandBuffers m_Primary;
+    CommandBuffers m_Secondary;
+  };
+
+  ThreadPool& GetThreadPool();
+  vk::CommandBuffer Allocate(vk::CommandPool commandPool, CommandBuffers& commandBuffers, vk::CommandBufferLevel level);
+
+  VulkanRenderer* m_Renderer;
+  std::mutex m_CriticalSection;
+  // Pools are never removed before destruction, so the references handed out stay valid
+  std::unordered_map<std::thread::id, std::unique_ptr<ThreadPool>> m_ThreadPools;
+};
+} // namespace Core
@@ -0,0 +1,252 @@
+#include "GpuCuller.h"
+
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+namespace Core {
+GpuCuller::GpuCuller(VulkanRenderer* renderer, uint32_t maxObjectCount) :
+  m_Renderer(renderer),
+  m_MaxObjectCount(maxObjectCount),
+  m_ObjectBuffer(BufferData()),
+  m_Frames(),
+  m_DescriptorSetLayout(nullptr),
+  m_DescriptorPool(nullptr),
+  m_PipelineLayout(nullptr),
+  m_Pipeline(nullptr)
+{
+  assert(maxObjectCount != 0);
+  m_ObjectBuffer = m_Renderer->CreateBuffer(static_cast<vk::DeviceSize>(maxObjectCount) * sizeof(CullObject),
+                                            { vk::BufferUsageFlagBits::eStorageBuffer
+                                              | vk::BufferUsageFlagBits::eTransferDst },
+                                            { vk::MemoryPropertyFlagBits::eDeviceLocal });
+  m_Renderer->SetDebugName(m_ObjectBuffer, "Cull objects");
+
+  for (FrameData& frame : m_Frames) {
+    frame.m_DrawCommandBuffer =
+      m_Renderer->CreateBuffer(static_cast<vk::DeviceSize>(maxObjectCount) * sizeof(vk::DrawIndirectCommand),
+                               { vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer },
+                               { vk::MemoryPropertyFlagBits::eDeviceLocal });
+    m_Renderer->SetDebugName(frame.m_DrawCommandBuffer, "Culled draw commands");
+    frame.m_DrawCountBuffer = m_Renderer->CreateBuffer(sizeof(uint32_t),
+                                                       { vk::BufferUsageFlagBits::eStorageBuffer
+                                                         | vk::BufferUsageFlagBits::eIndirectBuffer
+                                                         | vk::BufferUsageFlagBits::eTransferDst },
+                                                       { vk::MemoryPropertyFlagBits::eDeviceLocal });
+    m_Renderer->SetDebugName(frame.m_DrawCountBuffer, "Culled draw count");
+    frame.m_DescriptorSet = nullptr;
+    frame.m_ObjectCount = 0;
+  }
+
+  CreateDescriptorSets();
+  CreatePipeline();
+}
+
+GpuCuller::~GpuCuller()
+{
+  vk::Device device = m_Renderer->GetDevice();
+  device.destroyPipeline(m_Pipeline);
+  device.destroyPipelineLayout(m_PipelineLayout);
+  device.destroyDescriptorPool(m_DescriptorPool);
+  device.destroyDescriptorSetLayout(m_DescriptorSetLayout);
+
+  for (FrameData& frame : m_Frames) {
+    m_Renderer->FreeBuffer(frame.m_DrawCountBuffer);
+    m_Renderer->FreeBuffer(frame.m_DrawCommandBuffer);
+  }
+  m_Renderer->FreeBuffer(m_ObjectBuffer);
+}
+
+GpuCullOutput GpuCuller::AddCullPasses(RenderGraph& graph,
+                                       FrameResource const& frameResources,
+                                       Mat4 const& viewProjection,
+                                       uint32_t objectCount)
+{
+  assert(frameResources.m_FrameIdx < m_Frames.size() && objectCount <= m_MaxObjectCount);
+  FrameData& frame = m_Frames[frameResources.m_FrameIdx];
+  frame.m_ObjectCount = objectCount;
+
+  // The frame's previous use of its buffers is over once its fence has signaled, nothing is pending on them here
+  GpuCullOutput output = GpuCullOutput{ graph.ImportBuffer("Culled draw commands",
+                                                           frame.m_DrawCommandBuffer.m_Handle,
+                                                           0,
+                                                           frame.m_DrawCommandBuffer.m_Size),
+                                        graph.ImportBuffer("Culled draw count",
+                                                           frame.m_DrawCountBuffer.m_Handle,
+                                                           0,
+                                                           frame.m_DrawCountBuffer.m_Size) };
+
+  vk::Buffer drawCountBuffer = frame.m_DrawCountBuffer.m_Handle;
+  uint32_t resetPass = graph.AddPass("Cull reset", [drawCountBuffer](vk::CommandBuffer commandBuffer) {
+    commandBuffer.fillBuffer(drawCountBuffer, 0, sizeof(uint32_t), 0);
+  });
+  graph.Write(resetPass, output.m_DrawCount, RenderGraphAccess::TransferWrite);
+
+  PushConstants pushConstants = PushConstants{ viewProjection,
+                                               objectCount,
+                                               IsCompacted() ? 1u : 0u,
+                                               m_Renderer->IsDrawIndirectFirstInstanceSupported() ? 1u : 0u };
+  vk::DescriptorSet descriptorSet = frame.m_DescriptorSet;
+  uint32_t cullPass =
+    graph.AddPass("GPU culling", [this, pushConstants, descriptorSet](vk::CommandBuffer commandBuffer) {
+      if (pushConstants.m_ObjectCount == 0) { return; }
+      commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_Pipeline);
+      commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_PipelineLayout, 0, descriptorSet, nullptr);
+      commandBuffer.pushConstants(
+        m_PipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants), &pushConstants);
+      commandBuffer.dispatch((pushConstants.m_ObjectCount + WorkgroupSize - 1) / WorkgroupSize, 1, 1);
+    });
+  graph.Write(cullPass, output.m_DrawCommands, RenderGraphAccess::ComputeShaderWrite);
+  graph.Write(cullPass, output.m_DrawCount, RenderGraphAccess::ComputeShaderWrite);
+
+  return output;
+}
+
+void GpuCuller::Draw(FrameResource const& frameResources,
+                     vk::CommandBuffer commandBuffer,
+                     BindObjectCallback const& bindObject) const
+{
+  FrameData const& frame = m_Frames[frameResources.m_FrameIdx];
+  if (frame.m_ObjectCount == 0) { return; }
+
+  uint32_t const stride = sizeof(vk::DrawIndirectCommand);
+  if (!m_Renderer->IsDrawIndirectFirstInstanceSupported()) {
+    // The commands keep the slots of their objects, so the object of each one is known here
+    assert(bindObject);
+    for (uint32_t objectIdx = 0; objectIdx != frame.m_ObjectCount; ++objectIdx) {
+      bindObject(commandBuffer, objectIdx);
+      commandBuffer.drawIndirect(
+        frame.m_DrawCommandBuffer.m_Handle, static_cast<vk::DeviceSize>(objectIdx) * stride, 1, stride);
+    }
+  } else if (IsCompacted()) {
+    commandBuffer.drawIndirectCount(
+      frame.m_DrawCommandBuffer.m_Handle, 0, frame.m_DrawCountBuffer.m_Handle, 0, frame.m_ObjectCount, stride);
+  } else if (m_Renderer->IsMultiDrawIndirectSupported()) {
+    commandBuffer.drawIndirect(frame.m_DrawCommandBuffer.m_Handle, 0, frame.m_ObjectCount, stride);
+  } else {
+    // Without multiDrawIndirect the draw count is limited to one, the culled commands still draw nothing
+    for (uint32_t objectIdx = 0; objectIdx != frame.m_ObjectCount; ++objectIdx) {
+      commandBuffer.drawIndirect(
+        frame.m_DrawCommandBuffer.m_Handle, static_cast<vk::DeviceSize>(objectIdx) * stride, 1, stride);
+    }
+  }
+}
+
+bool GpuCuller::IsCompacted() const
+{
+  // A compacted command cannot be traced back to its object, which is needed for the rebinds
+  return m_Renderer->IsDrawIndirectCountSupported() && m_Renderer->IsDrawIndirectFirstInstanceSupported();
+}
+
+void GpuCuller::CreateDescriptorSets()
+{
+  vk::Device device = m_Renderer->GetDevice();
+
+  auto bindings = std::vector<vk::DescriptorSetLayoutBinding>();
+  for (uint32_t bindingIdx = 0; bindingIdx != 3; ++bindingIdx) {
+    bindings.push_back(vk::DescriptorSetLayoutBinding(
+      bindingIdx,                            // uint32_t binding_ = {},
+      vk::DescriptorType::eStorageBuffer,    // vk::DescriptorType descriptorType_ = vk::DescriptorType::eSampler,
+      1,                                     // uint32_t descriptorCount_ = {},
+      { vk::ShaderStageFlagBits::eCompute }, // vk::ShaderStageFlags stageFlags_ = {},
+      nullptr                                // const vk::Sampler* pImmutableSamplers_ = {}
+      ));
+  }
+
+  auto descriptorSetLayoutCreateInfo =
+    vk::DescriptorSetLayoutCreateInfo({}, // vk::DescriptorSetLayoutCreateFlags flags_ = {},
+                                      static_cast<uint32_t>(bindings.size()), // uint32_t bindingCount_ = {},
+                                      bindings.data() // const vk::DescriptorSetLayoutBinding* pBindings_ = {}
+    );
+  m_DescriptorSetLayout = device.createDescriptorSetLayout(descriptorSetLayoutCreateInfo);
+
+  uint32_t descriptorCount = static_cast<uint32_t>(bindings.size() * m_Frames.size());
+  auto poolSize = vk::DescriptorPoolSize(
+    vk::DescriptorType::eStorageBuffer, // vk::DescriptorType type_ = vk::DescriptorType::eSampler,
+    descriptorCount                     // uint32_t descriptorCount_ = {}
+  );
+
+  auto descriptorPoolCreateInfo =
+    vk::DescriptorPoolCreateInfo({},                                     // vk::DescriptorPoolCreateFlags flags_ = {},
+                                 static_cast<uint32_t>(m_Frames.size()), // uint32_t maxSets_ = {},
+                                 1,                                      // uint32_t poolSizeCount_ = {},
+                                 &poolSize // const vk::DescriptorPoolSize* pPoolSizes_ = {}
+    );
+  m_DescriptorPool = device.createDescriptorPool(descriptorPoolCreateInfo);
+
+  auto setLayouts = std::vector<vk::DescriptorSetLayout>(m_Frames.size(), m_DescriptorSetLayout);
+  auto descriptorSetAllocateInfo = vk::DescriptorSetAllocateInfo(
+    m_DescriptorPool,                         // vk::DescriptorPool descriptorPool_ = {},
+    static_cast<uint32_t>(setLayouts.size()), // uint32_t descriptorSetCount_ = {},
+    setLayouts.data()                         // const vk::DescriptorSetLayout* pSetLayouts_ = {}
+  );
+  std::vector<vk::DescriptorSet> descriptorSets = device.allocateDescriptorSets(descriptorSetAllocateInfo);
+
+  // The buffers never change, so the sets are written once
+  for (size_t frameIdx = 0; frameIdx != m_Frames.size(); ++frameIdx) {
+    FrameData& frame = m_Frames[frameIdx];
+    frame.m_DescriptorSet = descriptorSets[frameIdx];
+
+    auto bufferInfos = std::array<vk::DescriptorBufferInfo, 3>(
+      { vk::DescriptorBufferInfo(m_ObjectBuffer.m_Handle, 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(frame.m_DrawCommandBuffer.m_Handle, 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(frame.m_DrawCountBuffer.m_Handle, 0, VK_WHOLE_SIZE) });
+
+    auto descriptorWrites = std::vector<vk::WriteDescriptorSet>();
+    for (uint32_t bindingIdx = 0; bindingIdx != bufferInfos.size(); ++bindingIdx) {
+      descriptorWrites.push_back(
+        vk::WriteDescriptorSet(frame.m_DescriptorSet,              // vk::DescriptorSet dstSet_ = {},
+                               bindingIdx,                         // uint32_t dstBinding_ = {},
+                               0,                                  // uint32_t dstArrayElement_ = {},
+                               1,                                  // uint32_t descriptorCount_ = {},
+                               vk::DescriptorType::eStorageBuffer, // vk::DescriptorType descriptorType_ = {},
+                               nullptr,                            // const vk::DescriptorImageInfo* pImageInfo_ = {},
+                               &bufferInfos[bindingIdx], // const vk::DescriptorBufferInfo* pBufferInfo_ = {},
+                               nullptr                   // const vk::BufferView* pTexelBufferView_ = {}
+                               ));
+    }
+    device.updateDescriptorSets(descriptorWrites, nullptr);
+  }
+}
+
+void GpuCuller::CreatePipeline()
+{
+  vk::Device device = m_Renderer->GetDevice();
+
+  auto pushConstantRange = vk::PushConstantRange(
+    { vk::ShaderStageFlagBits::eCompute }, // vk::ShaderStageFlags stageFlags_ = {},
+    0,                                     // uint32_t offset_ = {},
+    sizeof(PushConstants)                  // uint32_t size_ = {}
+  );
+
+  auto pipelineLayoutCreateInfo = vk::PipelineLayoutCreateInfo(
+    {},                     // vk::PipelineLayoutCreateFlags flags_ = {}, reserved
+    1,                      // uint32_t setLayoutCount_ = {},
+    &m_DescriptorSetLayout, // const vk::DescriptorSetLayout* pSetLayouts_ = {},
+    1,                      // uint32_t pushConstantRangeCount_ = {},
+    &pushConstantRange      // const vk::PushConstantRange* pPushConstantRanges_ = {}
+  );
+  m_PipelineLayout = device.createPipelineLayout(pipelineLayoutCreateInfo);
+
+  auto computeShaderModule = m_Renderer->CreateShaderModule("shaders/cull.comp.spv");
+  auto pipelineCreateInfo = vk::ComputePipelineCreateInfo(
+    {}, // vk::PipelineCreateFlags flags_ = {},
+    vk::PipelineShaderStageCreateInfo(
+      {},                                    // vk::PipelineShaderStageCreateFlags flags_ = {},
+      { vk::ShaderStageFlagBits::eCompute }, // vk::ShaderStageFlagBits stage_ = vk::ShaderStageFlagBits::eVertex,
+      computeShaderModule.get(),             // vk::ShaderModule module_ = {},
+      "main",                                // const char* pName_ = {},
+      nullptr                                // const vk::SpecializationInfo* pSpecializationInfo_ = {}
+      ),              // vk::PipelineShaderStageCreateInfo stage_ = {},
+    m_PipelineLayout, // vk::PipelineLayout layout_ = {},
+    nullptr,          // vk::Pipeline basePipelineHandle_ = {},
+    -1                // int32_t basePipelineIndex_ = {}
+  );
+
+  auto result = device.createComputePipeline(nullptr, pipelineCreateInfo);
+  if (result.result != vk::Result::eSuccess) {
+    throw std::runtime_error("Could not create culling pipeline " + vk::to_string(result.result));
+  }
+  m_Pipeline = result.value;
+}
+} // namespace Core
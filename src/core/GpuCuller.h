@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vulkan/vulkan.hpp>
+
+#include "Mat4.h"
+#include "RenderGraph.h"
+#include "VulkanRenderer.h"
+
+namespace Core {
+
+// One entry of the object buffer, laid out for std430 as read by shaders/cull.comp
+struct CullObject
+{
+  float m_Center[3]; // bounding sphere, in the space the view projection is applied to
+  float m_Radius;
+  uint32_t m_VertexCount;
+  uint32_t m_InstanceCount;
+  uint32_t m_FirstVertex;
+  uint32_t m_FirstInstance;
+};
+
+struct GpuCullOutput
+{
+  RenderGraphResourceId m_DrawCommands;
+  RenderGraphResourceId m_DrawCount;
+};
+
+// Culls the bounding spheres of a storage buffer of objects against the view frustum in a compute pass and turns the
+// visible ones into indirect draw commands, so the CPU cost of a frame does not depend on the number of objects.
+// Where drawIndirectCount is available the visible commands are compacted and counted on the GPU, otherwise every
+// object keeps its command and the culled ones are left without instances. Without drawIndirectFirstInstance the
+// commands start at instance 0 and are drawn one by one, the caller rebinds the object's instances before each of them.
+//
+// The output buffers are kept per frame resource. The culling and the draws are recorded outside of a running capture.
+class GpuCuller
+{
+public:
+  // Binds the instances of an object at its first instance, only called where drawIndirectFirstInstance is missing
+  typedef std::function<void(vk::CommandBuffer commandBuffer, uint32_t objectIdx)> BindObjectCallback;
+
+  GpuCuller(VulkanRenderer* renderer, uint32_t maxObjectCount);
+  GpuCuller(GpuCuller const& other) = delete;
+  GpuCuller& operator=(GpuCuller const& other) = delete;
+  ~GpuCuller();
+
+  // Device local storage buffer of maxObjectCount objects, to be filled e.g. by a CopyToLocalBufferJob with the compute
+  // shader read as its destination access
+  inline vk::Buffer GetObjectBuffer() const { return m_ObjectBuffer.m_Handle; }
+  inline uint32_t GetMaxObjectCount() const { return m_MaxObjectCount; }
+
+  // Adds the passes that reset the draw count and cull the first objectCount objects. The pass that draws them has to
+  // read both outputs as RenderGraphAccess::IndirectBufferRead.
+  GpuCullOutput AddCullPasses(RenderGraph& graph,
+                              FrameResource const& frameResources,
+                              Mat4 const& viewProjection,
+                              uint32_t objectCount);
+  // Draws the surviving commands of the frame, with the pipeline, descriptor sets and vertex buffers already bound
+  void Draw(FrameResource const& frameResources,
+            vk::CommandBuffer commandBuffer,
+            BindObjectCallback const& bindObject) const;
+
+private:
+  static constexpr uint32_t WorkgroupSize = 64; // has to match local_size_x in shaders/cull.comp
+
+  struct PushConstants
+  {
+    Mat4 m_ViewProjection;
+    uint32_t m_ObjectCount;
+    uint32_t m_IsCompacted;
+    uint32_t m_HasFirstInstance;
+  };
+
+  struct FrameData
+  {
+    BufferData m_DrawCommandBuffer;
+    BufferData m_DrawCountBuffer;
+    vk::DescriptorSet m_DescriptorSet;
+    uint32_t m_ObjectCount;
+  };
+
+  void CreateDescriptorSets();
+  void CreatePipeline();
+  bool IsCompacted() const;
+
+  VulkanRenderer* m_Renderer;
+  uint32_t m_MaxObjectCount;
+  BufferData m_ObjectBuffer;
+  std::array<FrameData, VulkanRenderer::MAX_FRAMES_IN_FLIGHT> m_Frames;
+  vk::DescriptorSetLayout m_DescriptorSetLayout;
+  vk::DescriptorPool m_DescriptorPool;
+  vk::PipelineLayout m_PipelineLayout;
+  vk::Pipeline m_Pipeline;
+};
+} // namespace Core
@@ -0,0 +1,197 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace Core {
+namespace {
+thread_local JobSystem const* t_CurrentJobSystem = nullptr;
+thread_local uint32_t t_CurrentWorkerIdx = JobSystem::InvalidWorkerIdx;
+} // namespace
+
+JobSystem::JobSystem(uint32_t workerCount) :
+  m_Queues(),
+  m_Workers(),
+  m_NextQueueIdx(0),
+  m_QueuedJobCount(0),
+  m_IsRunning(true)
+{
+  workerCount = std::max(1u, workerCount);
+  for (uint32_t workerIdx = 0; workerIdx != workerCount; ++workerIdx) {
+    m_Queues.push_back(std::make_unique<WorkerQueue>());
+  }
+  for (uint32_t workerIdx = 0; workerIdx != workerCount; ++workerIdx) {
+    m_Workers.push_back(std::thread(&JobSystem::WorkerThreadStart, this, workerIdx));
+  }
+}
+
+JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_SleepCriticalSection);
+    m_IsRunning = false;
+  }
+  m_JobAvailable.notify_all();
+
+  for (std::thread& worker : m_Workers) {
+    worker.join();
+  }
+}
+
+uint32_t JobSystem::GetDefaultWorkerCount()
+{
+  // hardware_concurrency is allowed to return 0 when it does not know
+  uint32_t coreCount = std::thread::hardware_concurrency();
+  return coreCount > 3 ? coreCount - 2 : 1;
+}
+
+uint32_t JobSystem::GetCurrentWorkerIdx() const
+{
+  return t_CurrentJobSystem == this ? t_CurrentWorkerIdx : InvalidWorkerIdx;
+}
+
+void JobSystem::Run(Job job, JobCounter* counter, JobCounter* dependency)
+{
+  if (counter) { counter->m_Count.fetch_add(1, std::memory_order_relaxed); }
+
+  if (dependency) {
+    std::lock_guard<std::mutex> lock(m_DependencyCriticalSection);
+    // Finish drops the count under the same lock, so the job is either parked here or queued right away
+    if (!dependency->IsDone()) {
+      dependency->m_DependentJobs.push_back(JobCounter::DependentJob{ std::move(job), counter });
+      return;
+    }
+  }
+
+  Push(QueuedJob{ std::move(job), counter });
+}
+
+void JobSystem::Wait(JobCounter& counter)
+{
+  uint32_t workerIdx = GetCurrentWorkerIdx();
+  if (workerIdx != InvalidWorkerIdx) {
+    // Blocking a worker could starve the very jobs it waits on
+    while (!counter.IsDone()) {
+      if (!RunOneJob(workerIdx)) { std::this_thread::yield(); }
+    }
+    // The last Finish may still be working on the counter under the lock, the caller is free to destroy it on return
+    std::lock_guard<std::mutex> lock(m_DependencyCriticalSection);
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(m_DependencyCriticalSection);
+  m_CounterDone.wait(lock, [&counter]() { return counter.IsDone(); });
+}
+
+void JobSystem::ParallelFor(uint32_t count,
+                            uint32_t batchSize,
+                            std::function<void(uint32_t begin, uint32_t end)> body,
+                            JobCounter& counter)
+{
+  assert(batchSize != 0);
+  // Shared by the batches, released with the last of them
+  auto sharedBody = std::make_shared<std::function<void(uint32_t begin, uint32_t end)>>(std::move(body));
+  for (uint32_t begin = 0; begin < count; begin += batchSize) {
+    uint32_t end = std::min(count, begin + batchSize);
+    Run([sharedBody, begin, end]() { (*sharedBody)(begin, end); }, &counter);
+  }
+}
+
+void JobSystem::ParallelFor(uint32_t count, uint32_t batchSize, std::function<void(uint32_t begin, uint32_t end)> body)
+{
+  JobCounter counter;
+  ParallelFor(count, batchSize, std::move(body), counter);
+  Wait(counter);
+}
+
+void JobSystem::WorkerThreadStart(uint32_t workerIdx)
+{
+  t_CurrentJobSystem = this;
+  t_CurrentWorkerIdx = workerIdx;
+
+  for (;;) {
+    if (RunOneJob(workerIdx)) { continue; }
+
+    std::unique_lock<std::mutex> lock(m_SleepCriticalSection);
+    m_JobAvailable.wait(lock, [this]() { return !m_IsRunning || m_QueuedJobCount != 0; });
+    if (!m_IsRunning) { return; }
+  }
+}
+
+void JobSystem::Push(QueuedJob job)
+{
+  // Workers keep what they spawn, it is likely to share their caches, other threads spread their jobs around
+  uint32_t queueIdx = GetCurrentWorkerIdx();
+  if (queueIdx == InvalidWorkerIdx) {
+    queueIdx = m_NextQueueIdx.fetch_add(1, std::memory_order_relaxed) % static_cast<uint32_t>(m_Queues.size());
+  }
+
+  // Counted ahead of the push, so the count never drops below zero when the job is popped right away
+  {
+    std::lock_guard<std::mutex> lock(m_SleepCriticalSection);
+    ++m_QueuedJobCount;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_Queues[queueIdx]->m_CriticalSection);
+    m_Queues[queueIdx]->m_Jobs.push_back(std::move(job));
+  }
+  m_JobAvailable.notify_one();
+}
+
+bool JobSystem::RunOneJob(uint32_t workerIdx)
+{
+  QueuedJob job = QueuedJob();
+  if (!PopJob(workerIdx, job)) { return false; }
+
+  job.m_Function();
+  Finish(job.m_Counter);
+  return true;
+}
+
+bool JobSystem::PopJob(uint32_t workerIdx, QueuedJob& job)
+{
+  uint32_t queueCount = static_cast<uint32_t>(m_Queues.size());
+  for (uint32_t offset = 0; offset != queueCount; ++offset) {
+    uint32_t queueIdx = (workerIdx + offset) % queueCount;
+    WorkerQueue& queue = *m_Queues[queueIdx];
+    std::lock_guard<std::mutex> lock(queue.m_CriticalSection);
+    if (queue.m_Jobs.empty()) { continue; }
+
+    // The own queue is used as a stack, the newest job is the hottest. Stealing takes the oldest one, which tends
+    // to be the largest piece of work left.
+    if (offset == 0) {
+      job = std::move(queue.m_Jobs.back());
+      queue.m_Jobs.pop_back();
+    } else {
+      job = std::move(queue.m_Jobs.front());
+      queue.m_Jobs.pop_front();
+    }
+
+    std::lock_guard<std::mutex> sleepLock(m_SleepCriticalSection);
+    --m_QueuedJobCount;
+    return true;
+  }
+
+  return false;
+}
+
+void JobSystem::Finish(JobCounter* counter)
+{
+  if (!counter) { return; }
+
+  std::vector<JobCounter::DependentJob> dependentJobs;
+  {
+    // Jobs only finish under this lock, and waiters take it before they return, so the counter outlives it. The last
+    // job is told by the decrement itself: a Run adding to the counter at the same time either lands before it, or
+    // after the count has reached zero and the dependent jobs have been released.
+    std::lock_guard<std::mutex> lock(m_DependencyCriticalSection);
+    if (counter->m_Count.fetch_sub(1, std::memory_order_acq_rel) != 1) { return; }
+    dependentJobs.swap(counter->m_DependentJobs);
+  }
+  m_CounterDone.notify_all();
+
+  for (JobCounter::DependentJob& dependentJob : dependentJobs) {
+    Push(QueuedJob{ std::move(dependentJob.m_Function), dependentJob.m_Counter });
+  }
+}
+} // namespace Core
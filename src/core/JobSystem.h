@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Core {
+
+// Number of jobs still pending in a group. Jobs can be waited on or scheduled to run after the count drops to zero.
+// Has to outlive the jobs it counts.
+class JobCounter
+{
+public:
+  JobCounter() : m_Count(0) {}
+  JobCounter(JobCounter const& other) = delete;
+  JobCounter& operator=(JobCounter const& other) = delete;
+
+  inline bool IsDone() const { return m_Count.load(std::memory_order_acquire) == 0; }
+
+private:
+  friend class JobSystem;
+
+  struct DependentJob
+  {
+    std::function<void()> m_Function;
+    JobCounter* m_Counter;
+  };
+
+  std::atomic<uint32_t> m_Count;
+  std::vector<DependentJob> m_DependentJobs; // guarded by the job system's dependency lock
+};
+
+// Work stealing scheduler. Every worker pushes and pops its own jobs at the back of its deque, idle workers steal the
+// oldest jobs from the front of the others. Waiting on a counter from a worker runs other jobs in the meantime, so jobs
+// can wait on the jobs they spawn, other threads simply block. Jobs must not throw.
+class JobSystem
+{
+public:
+  typedef std::function<void()> Job;
+  static constexpr uint32_t InvalidWorkerIdx = std::numeric_limits<uint32_t>::max();
+
+  JobSystem(uint32_t workerCount);
+  JobSystem(JobSystem const& other) = delete;
+  JobSystem& operator=(JobSystem const& other) = delete;
+  // Jobs still queued at this point are dropped, wait on them first
+  ~JobSystem();
+
+  // The counter, if any, is incremented right away and decremented once the job has run. A job with a dependency is
+  // only queued when the dependency's counter drops to zero.
+  void Run(Job job, JobCounter* counter = nullptr, JobCounter* dependency = nullptr);
+  void Wait(JobCounter& counter);
+
+  // Calls body(begin, end) for consecutive ranges of at most batchSize elements covering [0, count), without waiting
+  void ParallelFor(uint32_t count,
+                   uint32_t batchSize,
+                   std::function<void(uint32_t begin, uint32_t end)> body,
+                   JobCounter& counter);
+  // Same as above, returns when the whole range has been processed
+  void ParallelFor(uint32_t count, uint32_t batchSize, std::function<void(uint32_t begin, uint32_t end)> body);
+
+  inline uint32_t GetWorkerCount() const { return static_cast<uint32_t>(m_Workers.size()); }
+  // Index of the calling worker thread of this job system, InvalidWorkerIdx on any other thread
+  uint32_t GetCurrentWorkerIdx() const;
+
+  // One worker per core, minus the render and the transfer thread
+  static uint32_t GetDefaultWorkerCount();
+
+private:
+  struct QueuedJob
+  {
+    Job m_Function;
+    JobCounter* m_Counter;
+  };
+
+  struct WorkerQueue
+  {
+    std::mutex m_CriticalSection;
+    std::deque<QueuedJob> m_Jobs;
+  };
+
+  void WorkerThreadStart(uint32_t workerIdx);
+  void Push(QueuedJob job);
+  bool RunOneJob(uint32_t workerIdx);
+  bool PopJob(uint32_t workerIdx, QueuedJob& job);
+  void Finish(JobCounter* counter);
+
+  std::vector<std::unique_ptr<WorkerQueue>> m_Queues;
+  std::vector<std::thread> m_Workers;
+  std::atomic<uint32_t> m_NextQueueIdx; // spreads the jobs coming from other threads
+
+  std::mutex m_SleepCriticalSection;
+  std::condition_variable m_JobAvailable;
+  uint32_t m_QueuedJobCount; // guarded by the sleep lock, so no wake up is lost
+  bool m_IsRunning;
+
+  std::mutex m_DependencyCriticalSection;
+  std::condition_variable m_CounterDone;
+};
+} // namespace Core
@@ -11,6 +11,7 @@ public:
 
   static constexpr vk::DeviceSize GetSize() { return 16 * sizeof(float); }
   float* GetData() { return m_Data.data(); }
+  float const* GetData() const { return m_Data.data(); }
 
 private:
   std::array<float, 16> m_Data;
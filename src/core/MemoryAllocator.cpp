@@ -0,0 +1,280 @@
+#include "MemoryAllocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <sstream>
+
+#include "utils/Logger.h"
+
+namespace Core {
+MemoryAllocation::MemoryAllocation() :
+  m_Memory(nullptr),
+  m_Offset(0),
+  m_Size(0),
+  m_MappedPtr(nullptr),
+  m_MemoryTypeIdx(0),
+  m_BlockId(InvalidBlockId)
+{}
+
+MemoryAllocator::MemoryAllocator() :
+  m_Device(nullptr),
+  m_MemoryProperties(vk::PhysicalDeviceMemoryProperties()),
+  m_NonCoherentAtomSize(1),
+  m_NextBlockId(0),
+  m_Blocks(std::map<uint32_t, MemoryBlock>()),
+  m_CriticalSection(std::mutex())
+{}
+
+MemoryAllocator::~MemoryAllocator()
+{
+  assert(m_Blocks.empty());
+}
+
+void MemoryAllocator::Initialize(vk::Device device, vk::PhysicalDevice physicalDevice)
+{
+  m_Device = device;
+  m_MemoryProperties = physicalDevice.getMemoryProperties();
+  m_NonCoherentAtomSize = physicalDevice.getProperties().limits.nonCoherentAtomSize;
+}
+
+void MemoryAllocator::Destroy()
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  for (auto& [blockId, block] : m_Blocks) {
+    if (block.m_Ranges.GetAllocationCount() != 0) {
+      std::ostringstream debugOutput;
+      debugOutput << "Block #" << blockId << " still has " << block.m_Ranges.GetAllocationCount()
+                  << " live allocation(s), " << block.m_Ranges.GetUsedSize() << " bytes";
+      Utils::Logger::Get().LogWarningEx(
+        "Leaking device memory allocations", "Renderer", __FILE__, __func__, __LINE__, debugOutput.str());
+    }
+    if (block.m_MappedPtr) { m_Device.unmapMemory(block.m_Memory); }
+    m_Device.freeMemory(block.m_Memory);
+  }
+  m_Blocks.clear();
+}
+
+MemoryAllocation MemoryAllocator::Allocate(vk::MemoryRequirements const& requirements,
+                                           vk::MemoryPropertyFlags requiredProperties,
+                                           MemoryResourceKind kind,
+                                           MemoryAllocationOptions const& options)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  bool const dedicated = requirements.size > DEFAULT_BLOCK_SIZE / 2;
+
+  for (uint32_t memoryTypeIdx = 0; memoryTypeIdx != m_MemoryProperties.memoryTypeCount; ++memoryTypeIdx) {
+    vk::MemoryPropertyFlags propertyFlags = m_MemoryProperties.memoryTypes[memoryTypeIdx].propertyFlags;
+    if (!(requirements.memoryTypeBits & (1 << memoryTypeIdx))
+        || (propertyFlags & requiredProperties) != requiredProperties) {
+      continue;
+    }
+
+    // Flushes and invalidates on non-coherent memory work on nonCoherentAtomSize granularity, neighbouring allocations
+    // must not share an atom
+    vk::DeviceSize alignment = requirements.alignment;
+    if ((propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+        && !(propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent)) {
+      alignment = std::max(alignment, m_NonCoherentAtomSize);
+    }
+
+    if (!dedicated) {
+      for (auto& [blockId, block] : m_Blocks) {
+        if (block.m_Dedicated || block.m_MemoryTypeIdx != memoryTypeIdx || block.m_Kind != kind
+            || blockId == options.m_ExcludedBlockId) {
+          continue;
+        }
+
+        MemoryAllocation allocation = AllocateFromBlock(block, requirements.size, alignment);
+        if (allocation.m_Memory) { return allocation; }
+      }
+    }
+
+    if (!options.m_AllowNewBlock) { continue; }
+
+    vk::DeviceSize blockSize = dedicated ? requirements.size : DEFAULT_BLOCK_SIZE;
+    MemoryBlock* block = CreateBlock(memoryTypeIdx, blockSize, kind, dedicated);
+    if (block) { return AllocateFromBlock(*block, requirements.size, alignment); }
+  }
+
+  return MemoryAllocation();
+}
+
+void MemoryAllocator::Free(MemoryAllocation const& allocation)
+{
+  if (!allocation.m_Memory) { return; }
+
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  auto blockIt = m_Blocks.find(allocation.m_BlockId);
+  assert(blockIt != m_Blocks.end());
+
+  MemoryBlock& block = blockIt->second;
+  block.m_Ranges.Free(allocation.m_Offset, allocation.m_Size);
+  block.m_Allocations.erase(allocation.m_Offset);
+  if (!block.m_Ranges.IsEmpty()) { return; }
+
+  // Keep one empty block around per memory type so a single resource being recreated does not thrash vkAllocateMemory
+  bool hasSibling = std::any_of(m_Blocks.cbegin(), m_Blocks.cend(), [&](auto const& other) {
+    return other.first != block.m_Id && !other.second.m_Dedicated
+           && other.second.m_MemoryTypeIdx == block.m_MemoryTypeIdx && other.second.m_Kind == block.m_Kind;
+  });
+
+  if (block.m_Dedicated || hasSibling) { FreeBlock(block.m_Id); }
+}
+
+void MemoryAllocator::SetAllocationName(MemoryAllocation const& allocation, std::string const& name)
+{
+  if (!allocation.m_Memory) { return; }
+
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  auto blockIt = m_Blocks.find(allocation.m_BlockId);
+  assert(blockIt != m_Blocks.end());
+  auto recordIt = blockIt->second.m_Allocations.find(allocation.m_Offset);
+  assert(recordIt != blockIt->second.m_Allocations.end());
+  recordIt->second.m_Name = name;
+}
+
+std::string MemoryAllocator::GetAllocationName(MemoryAllocation const& allocation) const
+{
+  if (!allocation.m_Memory) { return std::string(); }
+
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  auto blockIt = m_Blocks.find(allocation.m_BlockId);
+  if (blockIt == m_Blocks.end()) { return std::string(); }
+  auto recordIt = blockIt->second.m_Allocations.find(allocation.m_Offset);
+  if (recordIt == blockIt->second.m_Allocations.end()) { return std::string(); }
+  return recordIt->second.m_Name;
+}
+
+MemoryStatistics MemoryAllocator::GetStatistics() const
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  MemoryStatistics statistics;
+  statistics.m_Heaps = std::vector<vk::MemoryHeap>(m_MemoryProperties.memoryHeaps,
+                                                   m_MemoryProperties.memoryHeaps + m_MemoryProperties.memoryHeapCount);
+
+  for (uint32_t memoryTypeIdx = 0; memoryTypeIdx != m_MemoryProperties.memoryTypeCount; ++memoryTypeIdx) {
+    MemoryTypeStatistics typeStatistics = {};
+    typeStatistics.m_MemoryTypeIdx = memoryTypeIdx;
+    typeStatistics.m_HeapIdx = m_MemoryProperties.memoryTypes[memoryTypeIdx].heapIndex;
+    typeStatistics.m_PropertyFlags = m_MemoryProperties.memoryTypes[memoryTypeIdx].propertyFlags;
+    statistics.m_MemoryTypes.push_back(typeStatistics);
+  }
+
+  for (auto const& blockEntry : m_Blocks) {
+    MemoryBlock const& block = blockEntry.second;
+    MemoryTypeStatistics& typeStatistics = statistics.m_MemoryTypes[block.m_MemoryTypeIdx];
+    ++typeStatistics.m_BlockCount;
+    typeStatistics.m_AllocationCount += block.m_Ranges.GetAllocationCount();
+    typeStatistics.m_AllocatedBytes += block.m_Ranges.GetSize();
+    typeStatistics.m_UsedBytes += block.m_Ranges.GetUsedSize();
+    typeStatistics.m_LargestFreeRange =
+      std::max(typeStatistics.m_LargestFreeRange, block.m_Ranges.GetLargestFreeRange());
+
+    for (auto const& allocationEntry : block.m_Allocations) {
+      MemoryAllocationRecord const& record = allocationEntry.second;
+      uint32_t bucketIdx = 0;
+      while (bucketIdx != MEMORY_SIZE_HISTOGRAM_BUCKET_COUNT - 1
+             && record.m_Size > (vk::DeviceSize(1024) << bucketIdx)) {
+        ++bucketIdx;
+      }
+      ++typeStatistics.m_SizeHistogram[bucketIdx];
+      statistics.m_Allocations.push_back(record);
+    }
+  }
+
+  std::sort(statistics.m_Allocations.begin(),
+            statistics.m_Allocations.end(),
+            [](MemoryAllocationRecord const& lhs, MemoryAllocationRecord const& rhs) {
+              return lhs.m_Size > rhs.m_Size;
+            });
+  return statistics;
+}
+
+uint32_t MemoryAllocator::FindDefragmentationCandidate(float maxOccupancy) const
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  uint32_t candidateId = MemoryAllocation::InvalidBlockId;
+  float candidateOccupancy = maxOccupancy;
+
+  for (auto const& blockEntry : m_Blocks) {
+    MemoryBlock const& block = blockEntry.second;
+    if (block.m_Dedicated || block.m_Ranges.IsEmpty()) { continue; }
+
+    bool hasSibling = std::any_of(m_Blocks.cbegin(), m_Blocks.cend(), [&](auto const& other) {
+      return other.first != block.m_Id && !other.second.m_Dedicated
+             && other.second.m_MemoryTypeIdx == block.m_MemoryTypeIdx && other.second.m_Kind == block.m_Kind;
+    });
+    if (!hasSibling) { continue; }
+
+    float occupancy =
+      static_cast<float>(block.m_Ranges.GetUsedSize()) / static_cast<float>(block.m_Ranges.GetSize());
+    if (occupancy <= candidateOccupancy) {
+      candidateId = block.m_Id;
+      candidateOccupancy = occupancy;
+    }
+  }
+
+  return candidateId;
+}
+
+MemoryAllocation MemoryAllocator::AllocateFromBlock(MemoryBlock& block, vk::DeviceSize size, vk::DeviceSize alignment)
+{
+  vk::DeviceSize offset = block.m_Ranges.Allocate(size, alignment);
+  if (offset == RangeAllocator::InvalidOffset) { return MemoryAllocation(); }
+
+  MemoryAllocation allocation;
+  allocation.m_Memory = block.m_Memory;
+  allocation.m_Offset = offset;
+  allocation.m_Size = size;
+  allocation.m_MappedPtr = block.m_MappedPtr ? reinterpret_cast<uint8_t*>(block.m_MappedPtr) + offset : nullptr;
+  allocation.m_MemoryTypeIdx = block.m_MemoryTypeIdx;
+  allocation.m_BlockId = block.m_Id;
+  block.m_Allocations[offset] =
+    MemoryAllocationRecord{ block.m_MemoryTypeIdx, block.m_Id, offset, size, std::string() };
+  return allocation;
+}
+
+MemoryBlock* MemoryAllocator::CreateBlock(uint32_t memoryTypeIdx,
+                                          vk::DeviceSize size,
+                                          MemoryResourceKind kind,
+                                          bool dedicated)
+{
+  auto allocateInfo = vk::MemoryAllocateInfo(size,         // vk::DeviceSize allocationSize_ = {},
+                                             memoryTypeIdx // uint32_t memoryTypeIndex_ = {}
+  );
+
+  vk::DeviceMemory memory;
+  try {
+    memory = m_Device.allocateMemory(allocateInfo);
+  } catch (vk::OutOfDeviceMemoryError const&) {
+    // Let the caller fall back to the next compatible memory type
+    return nullptr;
+  }
+
+  void* mappedPtr = nullptr;
+  if (m_MemoryProperties.memoryTypes[memoryTypeIdx].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+    mappedPtr = m_Device.mapMemory(memory, 0, VK_WHOLE_SIZE, {});
+  }
+
+  uint32_t blockId = m_NextBlockId++;
+  MemoryBlock& block = m_Blocks[blockId];
+  block.m_Id = blockId;
+  block.m_Memory = memory;
+  block.m_MemoryTypeIdx = memoryTypeIdx;
+  block.m_Kind = kind;
+  block.m_Dedicated = dedicated;
+  block.m_MappedPtr = mappedPtr;
+  block.m_Ranges = RangeAllocator(size);
+  return &block;
+}
+
+void MemoryAllocator::FreeBlock(uint32_t blockId)
+{
+  auto blockIt = m_Blocks.find(blockId);
+  assert(blockIt != m_Blocks.end());
+
+  if (blockIt->second.m_MappedPtr) { m_Device.unmapMemory(blockIt->second.m_Memory); }
+  m_Device.freeMemory(blockIt->second.m_Memory);
+  m_Blocks.erase(blockIt);
+}
+} // namespace Core
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "RangeAllocator.h"
+
+namespace Core {
+
+// Buffers and optimal tiling images never share a block, that way bufferImageGranularity never has to be considered.
+enum class MemoryResourceKind
+{
+  Buffer,
+  Image
+};
+
+struct MemoryAllocation
+{
+  static constexpr uint32_t InvalidBlockId = std::numeric_limits<uint32_t>::max();
+
+  vk::DeviceMemory m_Memory;
+  vk::DeviceSize m_Offset;
+  vk::DeviceSize m_Size;
+  void* m_MappedPtr;
+  uint32_t m_MemoryTypeIdx;
+  uint32_t m_BlockId;
+  MemoryAllocation();
+};
+
+struct MemoryAllocationOptions
+{
+  uint32_t m_ExcludedBlockId = MemoryAllocation::InvalidBlockId;
+  bool m_AllowNewBlock = true;
+};
+
+struct MemoryAllocationRecord
+{
+  uint32_t m_MemoryTypeIdx;
+  uint32_t m_BlockId;
+  vk::DeviceSize m_Offset;
+  vk::DeviceSize m_Size;
+  std::string m_Name;
+};
+
+struct MemoryBlock
+{
+  uint32_t m_Id;
+  vk::DeviceMemory m_Memory;
+  uint32_t m_MemoryTypeIdx;
+  MemoryResourceKind m_Kind;
+  bool m_Dedicated;
+  void* m_MappedPtr;
+  RangeAllocator m_Ranges;
+  std::map<vk::DeviceSize, MemoryAllocationRecord> m_Allocations; // offset -> allocation
+};
+
+// Bucket i counts allocations of at most 1 KB << i bytes, the last bucket everything above that
+static constexpr uint32_t MEMORY_SIZE_HISTOGRAM_BUCKET_COUNT = 16;
+
+struct MemoryTypeStatistics
+{
+  uint32_t m_MemoryTypeIdx;
+  uint32_t m_HeapIdx;
+  vk::MemoryPropertyFlags m_PropertyFlags;
+  uint32_t m_BlockCount;
+  uint32_t m_AllocationCount;
+  vk::DeviceSize m_AllocatedBytes;
+  vk::DeviceSize m_UsedBytes;
+  vk::DeviceSize m_LargestFreeRange;
+  std::array<uint32_t, MEMORY_SIZE_HISTOGRAM_BUCKET_COUNT> m_SizeHistogram;
+};
+
+struct MemoryStatistics
+{
+  std::vector<vk::MemoryHeap> m_Heaps;
+  std::vector<MemoryTypeStatistics> m_MemoryTypes;
+  std::vector<MemoryAllocationRecord> m_Allocations; // sorted by size, largest first
+};
+
+// Sub-allocates device memory out of large blocks per memory type. Host visible blocks are persistently mapped, so
+// callers must use MemoryAllocation::m_MappedPtr instead of mapping the memory themselves.
+class MemoryAllocator
+{
+public:
+  MemoryAllocator();
+  MemoryAllocator(MemoryAllocator const& other) = delete;
+  MemoryAllocator& operator=(MemoryAllocator const& other) = delete;
+  ~MemoryAllocator();
+
+  void Initialize(vk::Device device, vk::PhysicalDevice physicalDevice);
+  void Destroy();
+
+  MemoryAllocation Allocate(vk::MemoryRequirements const& requirements,
+                            vk::MemoryPropertyFlags requiredProperties,
+                            MemoryResourceKind kind,
+                            MemoryAllocationOptions const& options = MemoryAllocationOptions());
+  void Free(MemoryAllocation const& allocation);
+
+  void SetAllocationName(MemoryAllocation const& allocation, std::string const& name);
+  std::string GetAllocationName(MemoryAllocation const& allocation) const;
+  MemoryStatistics GetStatistics() const;
+
+  // Returns the id of the least occupied, non-dedicated block that has at least one sibling block of the same memory
+  // type and resource kind to move its allocations to. Returns InvalidBlockId if there is nothing worth compacting.
+  uint32_t FindDefragmentationCandidate(float maxOccupancy) const;
+
+  static constexpr vk::DeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
+private:
+  MemoryAllocation AllocateFromBlock(MemoryBlock& block, vk::DeviceSize size, vk::DeviceSize alignment);
+  MemoryBlock* CreateBlock(uint32_t memoryTypeIdx, vk::DeviceSize size, MemoryResourceKind kind, bool dedicated);
+  void FreeBlock(uint32_t blockId);
+
+  vk::Device m_Device;
+  vk::PhysicalDeviceMemoryProperties m_MemoryProperties;
+  vk::DeviceSize m_NonCoherentAtomSize;
+  uint32_t m_NextBlockId;
+  std::map<uint32_t, MemoryBlock> m_Blocks;
+  mutable std::mutex m_CriticalSection;
+};
+} // namespace Core
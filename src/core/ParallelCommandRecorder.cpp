@@ -0,0 +1,50 @@
+#include "ParallelCommandRecorder.h"
+
+#include "FrameCommandAllocator.h"
+
+namespace Core {
+ParallelCommandRecorder::ParallelCommandRecorder(VulkanRenderer* renderer, JobSystem* jobSystem) :
+  m_Renderer(renderer),
+  m_JobSystem(jobSystem),
+  m_Exception(nullptr)
+{}
+
+std::vector<vk::CommandBuffer> ParallelCommandRecorder::Record(FrameResource const& frameResources,
+                                                               vk::RenderPass renderPass,
+                                                               vk::Framebuffer framebuffer,
+                                                               uint32_t chunkCount,
+                                                               RecordCallback const& record)
+{
+  auto inheritanceInfo = vk::CommandBufferInheritanceInfo(
+    renderPass,                             // vk::RenderPass renderPass_ = {},
+    0,                                      // uint32_t subpass_ = {},
+    framebuffer,                            // vk::Framebuffer framebuffer_ = {},
+    VK_FALSE,                               // vk::Bool32 occlusionQueryEnable_ = {},
+    {},                                     // vk::QueryControlFlags queryFlags_ = {},
+    m_Renderer->GetPipelineStatisticFlags() // vk::QueryPipelineStatisticFlags pipelineStatistics_ = {}
+  );
+  std::vector<vk::CommandBuffer> commandBuffers(chunkCount);
+  m_Exception = nullptr;
+
+  // One chunk per job, the workers that run out of chunks steal the rest. Each worker allocates from its own pool of
+  // the frame's command allocator.
+  m_JobSystem->ParallelFor(chunkCount, 1, [&](uint32_t chunkIdx, uint32_t chunkEnd) {
+    (void)chunkEnd;
+    try {
+      vk::CommandBuffer commandBuffer = frameResources.m_CommandAllocator->AllocateSecondary();
+      commandBuffer.begin(vk::CommandBufferBeginInfo(
+        { vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue },
+        &inheritanceInfo));
+      record(chunkIdx, commandBuffer);
+      commandBuffer.end();
+      commandBuffers[chunkIdx] = commandBuffer;
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(m_ExceptionCriticalSection);
+      if (!m_Exception) { m_Exception = std::current_exception(); }
+    }
+  });
+
+  if (m_Exception) { std::rethrow_exception(m_Exception); }
+  return commandBuffers;
+}
+} // namespace Core
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "JobSystem.h"
+#include "VulkanRenderer.h"
+
+namespace Core {
+
+// Records the draws of a render pass on the job system's workers. The work is split into chunks, every chunk goes into
+// its own secondary command buffer and the buffers come back in chunk order, ready to be executed inside the render
+// pass begun with vk::SubpassContents::eSecondaryCommandBuffers. The buffers come from the frame's command allocator
+// and stay valid until the frame resource is acquired again.
+class ParallelCommandRecorder
+{
+public:
+  typedef std::function<void(uint32_t chunkIdx, vk::CommandBuffer commandBuffer)> RecordCallback;
+
+  ParallelCommandRecorder(VulkanRenderer* renderer, JobSystem* jobSystem);
+  ParallelCommandRecorder(ParallelCommandRecorder const& other) = delete;
+  ParallelCommandRecorder& operator=(ParallelCommandRecorder const& other) = delete;
+
+  // Returns once every chunk has been recorded, the callback runs concurrently on the workers. The first exception
+  // thrown by a chunk is rethrown here. Only one thread may record at a time, the render thread.
+  std::vector<vk::CommandBuffer> Record(FrameResource const& frameResources,
+                                        vk::RenderPass renderPass,
+                                        vk::Framebuffer framebuffer,
+                                        uint32_t chunkCount,
+                                        RecordCallback const& record);
+
+private:
+  VulkanRenderer* m_Renderer;
+  JobSystem* m_JobSystem;
+  std::mutex m_ExceptionCriticalSection;
+  std::exception_ptr m_Exception;
+};
+} // namespace Core
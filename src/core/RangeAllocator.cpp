@@ -0,0 +1,77 @@
+#include "RangeAllocator.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace Core {
+RangeAllocator::RangeAllocator(vk::DeviceSize size) :
+  m_Size(size),
+  m_UsedSize(0),
+  m_AllocationCount(0),
+  m_FreeRanges(std::map<vk::DeviceSize, vk::DeviceSize>())
+{
+  if (m_Size > 0) { m_FreeRanges.emplace(vk::DeviceSize(0), m_Size); }
+}
+
+vk::DeviceSize RangeAllocator::Allocate(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+  assert(alignment != 0);
+  if (size == 0) { return InvalidOffset; }
+
+  for (auto it = m_FreeRanges.begin(); it != m_FreeRanges.end(); ++it) {
+    vk::DeviceSize rangeBegin = it->first;
+    vk::DeviceSize rangeEnd = it->first + it->second;
+    // Not restricted to powers of two, vertex ranges are aligned to their stride so they can be drawn with firstVertex
+    vk::DeviceSize alignedOffset = (rangeBegin + alignment - 1) / alignment * alignment;
+    if (alignedOffset + size > rangeEnd) { continue; }
+
+    m_FreeRanges.erase(it);
+    // The alignment padding stays free and gets merged back once the neighbouring allocation is freed
+    if (alignedOffset > rangeBegin) { m_FreeRanges.emplace(rangeBegin, alignedOffset - rangeBegin); }
+    if (alignedOffset + size < rangeEnd) {
+      m_FreeRanges.emplace(alignedOffset + size, rangeEnd - alignedOffset - size);
+    }
+
+    m_UsedSize += size;
+    ++m_AllocationCount;
+    return alignedOffset;
+  }
+
+  return InvalidOffset;
+}
+
+void RangeAllocator::Free(vk::DeviceSize offset, vk::DeviceSize size)
+{
+  assert(offset + size <= m_Size && m_AllocationCount > 0);
+
+  vk::DeviceSize rangeBegin = offset;
+  vk::DeviceSize rangeEnd = offset + size;
+
+  auto next = m_FreeRanges.lower_bound(offset);
+  if (next != m_FreeRanges.begin()) {
+    auto previous = std::prev(next);
+    if (previous->first + previous->second == rangeBegin) {
+      rangeBegin = previous->first;
+      m_FreeRanges.erase(previous);
+    }
+  }
+
+  if (next != m_FreeRanges.end() && next->first == rangeEnd) {
+    rangeEnd = next->first + next->second;
+    m_FreeRanges.erase(next);
+  }
+
+  m_FreeRanges.emplace(rangeBegin, rangeEnd - rangeBegin);
+  m_UsedSize -= size;
+  --m_AllocationCount;
+}
+
+vk::DeviceSize RangeAllocator::GetLargestFreeRange() const
+{
+  vk::DeviceSize largestFreeRange = 0;
+  for (auto const& freeRange : m_FreeRanges) {
+    largestFreeRange = std::max(largestFreeRange, freeRange.second);
+  }
+  return largestFreeRange;
+}
+} // namespace Core
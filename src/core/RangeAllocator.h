@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <vulkan/vulkan.hpp>
+
+namespace Core {
+// First fit offset allocator over a [0, size) range. It only does the bookkeeping, the memory itself is owned by the
+// caller. Neighbouring free ranges are merged on free.
+class RangeAllocator
+{
+public:
+  static constexpr vk::DeviceSize InvalidOffset = std::numeric_limits<vk::DeviceSize>::max();
+
+  RangeAllocator(vk::DeviceSize size = 0);
+
+  vk::DeviceSize Allocate(vk::DeviceSize size, vk::DeviceSize alignment);
+  void Free(vk::DeviceSize offset, vk::DeviceSize size);
+
+  inline vk::DeviceSize GetSize() const { return m_Size; }
+  inline vk::DeviceSize GetUsedSize() const { return m_UsedSize; }
+  inline uint32_t GetAllocationCount() const { return m_AllocationCount; }
+  inline bool IsEmpty() const { return m_AllocationCount == 0; }
+  vk::DeviceSize GetLargestFreeRange() const;
+
+private:
+  vk::DeviceSize m_Size;
+  vk::DeviceSize m_UsedSize;
+  uint32_t m_AllocationCount;
+  std::map<vk::DeviceSize, vk::DeviceSize> m_FreeRanges; // offset -> size
+};
+} // namespace Core
@@ -0,0 +1,537 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace Core {
+RenderGraph::RenderGraph(VulkanRenderer* renderer, TransientResourcePool* transientResourcePool) :
+  m_Renderer(renderer),
+  m_TransientResourcePool(transientResourcePool),
+  m_Resources(std::vector<Resource>()),
+  m_Passes(std::vector<Pass>()),
+  m_Schedule(std::vector<uint32_t>()),
+  m_PassBarriers(std::vector<BarrierBatch>()),
+  m_FinalBarriers(BarrierBatch()),
+  m_RetiredTransientStages(vk::PipelineStageFlags()),
+  m_RetiredTransientAccess(vk::AccessFlags()),
+  m_CulledPassCount(0),
+  m_BarrierCount(0),
+  m_IsCompiled(false)
+{}
+
+RenderGraphResourceId RenderGraph::ImportImage(char const* name,
+                                               vk::Image image,
+                                               vk::ImageAspectFlags aspectMask,
+                                               vk::ImageLayout currentLayout,
+                                               vk::PipelineStageFlags readyStages)
+{
+  Resource resource = Resource();
+  resource.m_Name = name;
+  resource.m_IsImage = true;
+  resource.m_IsImported = true;
+  resource.m_Image = image;
+  resource.m_AspectMask = aspectMask;
+  resource.m_TransientId = InvalidIdx;
+  // Nothing to make visible, but the first access still has to wait for the ready stages
+  resource.m_InitialState = ResourceState{ {}, {}, readyStages, {}, currentLayout };
+  m_Resources.push_back(resource);
+  return static_cast<RenderGraphResourceId>(m_Resources.size() - 1);
+}
+
+RenderGraphResourceId RenderGraph::ImportBuffer(char const* name,
+                                                vk::Buffer buffer,
+                                                vk::DeviceSize offset,
+                                                vk::DeviceSize size)
+{
+  Resource resource = Resource();
+  resource.m_Name = name;
+  resource.m_IsImage = false;
+  resource.m_IsImported = true;
+  resource.m_Buffer = buffer;
+  resource.m_Offset = offset;
+  resource.m_Size = size;
+  resource.m_TransientId = InvalidIdx;
+  resource.m_InitialState = ResourceState{ {}, {}, {}, {}, vk::ImageLayout::eUndefined };
+  m_Resources.push_back(resource);
+  return static_cast<RenderGraphResourceId>(m_Resources.size() - 1);
+}
+
+RenderGraphResourceId RenderGraph::CreateImage(char const* name, uint32_t width, uint32_t height, vk::Format format)
+{
+  Resource resource = Resource();
+  resource.m_Name = name;
+  resource.m_IsImage = true;
+  resource.m_IsImported = false;
+  resource.m_TransientDesc = TransientImageDesc{ width, height, format, {}, vk::ImageLayout::eUndefined };
+  resource.m_TransientId = InvalidIdx;
+  resource.m_InitialState = ResourceState{ {}, {}, {}, {}, vk::ImageLayout::eUndefined };
+  m_Resources.push_back(resource);
+  return static_cast<RenderGraphResourceId>(m_Resources.size() - 1);
+}
+
+void RenderGraph::SetFinalAccess(RenderGraphResourceId resourceId, RenderGraphAccess access)
+{
+  assert(resourceId < m_Resources.size() && m_Resources[resourceId].m_IsImported);
+  m_Resources[resourceId].m_HasFinalAccess = true;
+  m_Resources[resourceId].m_FinalAccess = access;
+}
+
+uint32_t RenderGraph::AddPass(char const* name, ExecuteCallback execute)
+{
+  m_Passes.push_back(Pass{ name, std::move(execute), std::vector<ResourceAccess>(), std::vector<uint32_t>(), false });
+  return static_cast<uint32_t>(m_Passes.size() - 1);
+}
+
+void RenderGraph::Read(uint32_t passIdx, RenderGraphResourceId resourceId, RenderGraphAccess access)
+{
+  assert(!GetAccessInfo(access).m_IsWrite);
+  AddAccess(passIdx, resourceId, access);
+}
+
+void RenderGraph::Write(uint32_t passIdx, RenderGraphResourceId resourceId, RenderGraphAccess access)
+{
+  assert(GetAccessInfo(access).m_IsWrite);
+  AddAccess(passIdx, resourceId, access);
+}
+
+void RenderGraph::AddAccess(uint32_t passIdx, RenderGraphResourceId resourceId, RenderGraphAccess access)
+{
+  assert(passIdx < m_Passes.size() && resourceId < m_Resources.size());
+  // Buffers ignore the layout, but images cannot be accessed as vertex, index or indirect buffers
+  assert(!m_Resources[resourceId].m_IsImage || GetAccessInfo(access).m_Layout != vk::ImageLayout::eUndefined);
+  m_Passes[passIdx].m_Accesses.push_back(ResourceAccess{ resourceId, access });
+}
+
+void RenderGraph::Compile()
+{
+  FindDependencies();
+  CullPasses();
+  SchedulePasses();
+  PlaceTransientImages();
+  ComputeBarriers();
+  m_IsCompiled = true;
+}
+
+void RenderGraph::Execute(FrameResource const& frameResources, vk::CommandBuffer commandBuffer)
+{
+  assert(m_IsCompiled);
+  for (uint32_t position = 0; position != m_Schedule.size(); ++position) {
+    Pass const& pass = m_Passes[m_Schedule[position]];
+    RecordBarriers(commandBuffer, m_PassBarriers[position]);
+
+    uint32_t timedPassIdx = m_Renderer->BeginTimedPass(frameResources, commandBuffer, pass.m_Name);
+    if (pass.m_Execute) { pass.m_Execute(commandBuffer); }
+    m_Renderer->EndTimedPass(frameResources, commandBuffer, timedPassIdx);
+  }
+  RecordBarriers(commandBuffer, m_FinalBarriers);
+}
+
+void RenderGraph::Reset()
+{
+  // The vectors keep their capacity, the graph is rebuilt every frame
+  m_Resources.clear();
+  m_Passes.clear();
+  m_Schedule.clear();
+  m_PassBarriers.clear();
+  m_FinalBarriers = BarrierBatch();
+  m_RetiredTransientStages = vk::PipelineStageFlags();
+  m_RetiredTransientAccess = vk::AccessFlags();
+  m_CulledPassCount = 0;
+  m_BarrierCount = 0;
+  m_IsCompiled = false;
+}
+
+ImageData const& RenderGraph::GetImage(RenderGraphResourceId resourceId) const
+{
+  assert(m_IsCompiled && resourceId < m_Resources.size() && m_Resources[resourceId].m_TransientId != InvalidIdx);
+  return m_TransientResourcePool->GetImage(m_Resources[resourceId].m_TransientId);
+}
+
+vk::Framebuffer RenderGraph::GetFramebuffer(RenderGraphResourceId resourceId, vk::RenderPass renderPass)
+{
+  assert(m_IsCompiled && resourceId < m_Resources.size() && m_Resources[resourceId].m_TransientId != InvalidIdx);
+  return m_TransientResourcePool->GetFramebuffer(m_Resources[resourceId].m_TransientId, renderPass);
+}
+
+RenderGraphAccessInfo RenderGraph::GetAccessInfo(RenderGraphAccess access)
+{
+  vk::AccessFlags const shaderRead = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eUniformRead;
+  vk::PipelineStageFlags const fragmentTests =
+    vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+
+  switch (access) {
+  case RenderGraphAccess::ColorAttachmentWrite:
+    // Load ops and blending read the attachment as well
+    return RenderGraphAccessInfo{ vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                                  vk::AccessFlagBits::eColorAttachmentRead
+                                    | vk::AccessFlagBits::eColorAttachmentWrite,
+                                  vk::ImageLayout::eColorAttachmentOptimal,
+                                  vk::ImageUsageFlagBits::eColorAttachment,
+                                  true };
+  case RenderGraphAccess::DepthStencilAttachmentWrite:
+    return RenderGraphAccessInfo{ fragmentTests,
+                                  vk::AccessFlagBits::eDepthStencilAttachmentRead
+                                    | vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+                                  vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                                  vk::ImageUsageFlagBits::eDepthStencilAttachment,
+                                  true };
+  case RenderGraphAccess::DepthStencilAttachmentRead:
+    return RenderGraphAccessInfo{ fragmentTests,
+                                  vk::AccessFlagBits::eDepthStencilAttachmentRead,
+                                  vk::ImageLayout::eDepthStencilReadOnlyOptimal,
+                                  vk::ImageUsageFlagBits::eDepthStencilAttachment,
+                                  false };
+  case RenderGraphAccess::VertexShaderRead:
+    return RenderGraphAccessInfo{ vk::PipelineStageFlagBits::eVertexShader,
+                                  shaderRead,
+                                  vk::ImageLayout::eShaderReadOnlyOptimal,
+                                  vk::ImageUsageFlagBits::eSampled,
+                                  false };
+  case RenderGraphAccess::FragmentShaderRead:
+    return RenderGraphAccessInfo{ vk::PipelineStageFlagBits::eFragmentShader,
+                                  shaderRead,
+                                  vk::ImageLayout::eShaderReadOnlyOptimal,
+                                  vk::ImageUsageFlagBits::eSampled,
+                                  false };
+  case RenderGraphAccess::ComputeShaderRead:
+    return RenderGraphAccessInfo{ vk::PipelineStageFlagBits::eComputeShader,
+                                  shaderRead,
+                                  vk::ImageLayout::eShaderReadOnlyOptimal,
+                                  vk::ImageUsageFlagBits::eSampled,
+                                  false };
+  case RenderGraphAccess::ComputeShaderWrite:
+    return RenderGraphAccessInfo{ vk::PipelineStageFlagBits::eComputeShader,
+                                  vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+                                  vk::ImageLayout::eGeneral,
+                                  vk::ImageUsageFlagBits::eStorage,
+                                  true };
+  case RenderGraphAccess::TransferRead:
+    return RenderGraphAccessInfo{ vk::PipelineStageFlagBits::eTransfer,
+                                  vk::AccessFlagBits::eTransferRead,
+                                  vk::ImageLayout::eTransferSrcOptimal,
+                                  vk::ImageUsageFlagBits::eTransferSrc,
+                                  false };
+  case RenderGraphAccess::TransferWrite:
+    return RenderGraphAccessInfo{ vk::PipelineStageFlagBits::eTransfer,
+                                  vk::AccessFlagBits::eTransferWrite,
+                                  vk::ImageLayout::eTransferDstOptimal,
+                                  vk::ImageUsageFlagBits::eTransferDst,
+                                  true };
+  case RenderGraphAccess::VertexBufferRead:
+    return RenderGraphAccessInfo{ vk::PipelineStageFlagBits::eVertexInput,
+                                  vk::AccessFlagBits::eVertexAttributeRead,
+                                  vk::ImageLayout::eUndefined,
+                                  {},
+                                  false };
+  case RenderGraphAccess::IndexBufferRead:
+    return RenderGraphAccessInfo{
+      vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eIndexRead, vk::ImageLayout::eUndefined, {}, false
+    };
+  case RenderGraphAccess::IndirectBufferRead:
+    return RenderGraphAccessInfo{ vk::PipelineStageFlagBits::eDrawIndirect,
+                                  vk::AccessFlagBits::eIndirectCommandRead,
+                                  vk::ImageLayout::eUndefined,
+                                  {},
+                                  false };
+  case RenderGraphAccess::Present:
+    // The present engine waits on a semaphore, the barrier only has to get the layout right
+    return RenderGraphAccessInfo{
+      vk::PipelineStageFlagBits::eBottomOfPipe, {}, vk::ImageLayout::ePresentSrcKHR, {}, false
+    };
+  default:
+    throw std::runtime_error("Unknown render graph access");
+  }
+}
+
+void RenderGraph::FindDependencies()
+{
+  // Declaration order defines the meaning of the graph: a pass depends on the last earlier writer of everything it
+  // accesses, and a write also depends on the earlier readers of the previous contents
+  std::vector<uint32_t> lastWriters(m_Resources.size(), InvalidIdx);
+  std::vector<std::vector<uint32_t>> readersSinceWrite(m_Resources.size());
+
+  for (uint32_t passIdx = 0; passIdx != m_Passes.size(); ++passIdx) {
+    Pass& pass = m_Passes[passIdx];
+    pass.m_Dependencies.clear();
+    for (ResourceAccess const& access : pass.m_Accesses) {
+      uint32_t lastWriter = lastWriters[access.m_ResourceId];
+      if (lastWriter != InvalidIdx && lastWriter != passIdx) { pass.m_Dependencies.push_back(lastWriter); }
+      if (GetAccessInfo(access.m_Access).m_IsWrite) {
+        for (uint32_t reader : readersSinceWrite[access.m_ResourceId]) {
+          if (reader != passIdx) { pass.m_Dependencies.push_back(reader); }
+        }
+      }
+    }
+
+    for (ResourceAccess const& access : pass.m_Accesses) {
+      if (GetAccessInfo(access.m_Access).m_IsWrite) {
+        lastWriters[access.m_ResourceId] = passIdx;
+        readersSinceWrite[access.m_ResourceId].clear();
+      } else {
+        readersSinceWrite[access.m_ResourceId].push_back(passIdx);
+      }
+    }
+
+    std::sort(pass.m_Dependencies.begin(), pass.m_Dependencies.end());
+    pass.m_Dependencies.erase(std::unique(pass.m_Dependencies.begin(), pass.m_Dependencies.end()),
+                              pass.m_Dependencies.end());
+  }
+}
+
+void RenderGraph::CullPasses()
+{
+  // Passes writing imported resources are the outputs of the frame, passes without any write are kept as they may
+  // have side effects the graph knows nothing about. Everything they depend on is needed too.
+  std::vector<uint32_t> stack;
+  for (uint32_t passIdx = 0; passIdx != m_Passes.size(); ++passIdx) {
+    Pass& pass = m_Passes[passIdx];
+    bool writesAnything = false;
+    bool writesOutput = false;
+    for (ResourceAccess const& access : pass.m_Accesses) {
+      if (!GetAccessInfo(access.m_Access).m_IsWrite) { continue; }
+      writesAnything = true;
+      writesOutput = writesOutput || m_Resources[access.m_ResourceId].m_IsImported;
+    }
+    pass.m_IsNeeded = writesOutput || !writesAnything;
+    if (pass.m_IsNeeded) { stack.push_back(passIdx); }
+  }
+
+  while (!stack.empty()) {
+    uint32_t passIdx = stack.back();
+    stack.pop_back();
+    for (uint32_t dependency : m_Passes[passIdx].m_Dependencies) {
+      if (m_Passes[dependency].m_IsNeeded) { continue; }
+      m_Passes[dependency].m_IsNeeded = true;
+      stack.push_back(dependency);
+    }
+  }
+
+  m_CulledPassCount = static_cast<uint32_t>(
+    std::count_if(m_Passes.cbegin(), m_Passes.cend(), [](Pass const& pass) { return !pass.m_IsNeeded; }));
+}
+
+void RenderGraph::SchedulePasses()
+{
+  // Topological order that puts as much independent work as possible between a producer and its consumers: of the
+  // passes whose dependencies have all been scheduled, the one whose latest dependency was scheduled the earliest goes
+  // next. Ties keep the declaration order.
+  m_Schedule.clear();
+  std::vector<uint32_t> positions(m_Passes.size(), InvalidIdx);
+  std::vector<uint32_t> candidates;
+  for (uint32_t passIdx = 0; passIdx != m_Passes.size(); ++passIdx) {
+    if (m_Passes[passIdx].m_IsNeeded) { candidates.push_back(passIdx); }
+  }
+
+  while (!candidates.empty()) {
+    uint32_t bestCandidate = InvalidIdx;
+    int64_t bestLatestDependency = std::numeric_limits<int64_t>::max();
+    for (uint32_t candidateIdx = 0; candidateIdx != candidates.size(); ++candidateIdx) {
+      int64_t latestDependency = -1;
+      bool isReady = true;
+      for (uint32_t dependency : m_Passes[candidates[candidateIdx]].m_Dependencies) {
+        if (positions[dependency] == InvalidIdx) {
+          isReady = false;
+          break;
+        }
+        latestDependency = std::max(latestDependency, static_cast<int64_t>(positions[dependency]));
+      }
+
+      if (isReady && latestDependency < bestLatestDependency) {
+        bestCandidate = candidateIdx;
+        bestLatestDependency = latestDependency;
+      }
+    }
+
+    // Dependencies only ever point to earlier declared passes, so there is always a ready candidate
+    assert(bestCandidate != InvalidIdx);
+    positions[candidates[bestCandidate]] = static_cast<uint32_t>(m_Schedule.size());
+    m_Schedule.push_back(candidates[bestCandidate]);
+    candidates.erase(candidates.begin() + bestCandidate);
+  }
+}
+
+void RenderGraph::PlaceTransientImages()
+{
+  for (Resource& resource : m_Resources) {
+    resource.m_FirstPosition = InvalidIdx;
+    resource.m_LastPosition = InvalidIdx;
+  }
+
+  for (uint32_t position = 0; position != m_Schedule.size(); ++position) {
+    for (ResourceAccess const& access : m_Passes[m_Schedule[position]].m_Accesses) {
+      Resource& resource = m_Resources[access.m_ResourceId];
+      RenderGraphAccessInfo accessInfo = GetAccessInfo(access.m_Access);
+      if (resource.m_FirstPosition == InvalidIdx) {
+        resource.m_FirstPosition = position;
+        resource.m_TransientDesc.m_InitialLayout = accessInfo.m_Layout;
+      }
+      resource.m_LastPosition = position;
+      resource.m_TransientDesc.m_Usage |= accessInfo.m_ImageUsage;
+    }
+  }
+
+  bool hasTransientImages = false;
+  for (Resource& resource : m_Resources) {
+    // Images only used by culled passes are never created
+    if (resource.m_IsImported || resource.m_FirstPosition == InvalidIdx) { continue; }
+    resource.m_TransientId = m_TransientResourcePool->DeclareImage(
+      resource.m_TransientDesc, resource.m_FirstPosition, resource.m_LastPosition);
+    hasTransientImages = true;
+  }
+
+  if (hasTransientImages) {
+    m_TransientResourcePool->Compile();
+    for (Resource& resource : m_Resources) {
+      if (resource.m_TransientId != InvalidIdx) {
+        resource.m_Image = m_TransientResourcePool->GetImage(resource.m_TransientId).m_Handle;
+        resource.m_AspectMask = TransientResourcePool::GetAspectFlags(resource.m_TransientDesc.m_Format);
+      }
+    }
+  }
+}
+
+void RenderGraph::ComputeBarriers()
+{
+  std::vector<ResourceState> states(m_Resources.size());
+  for (uint32_t resourceIdx = 0; resourceIdx != m_Resources.size(); ++resourceIdx) {
+    states[resourceIdx] = m_Resources[resourceIdx].m_InitialState;
+  }
+
+  m_PassBarriers.clear();
+  m_PassBarriers.resize(m_Schedule.size());
+  std::vector<RenderGraphResourceId> passResources;
+  std::vector<RenderGraphAccessInfo> passAccesses;
+  for (uint32_t position = 0; position != m_Schedule.size(); ++position) {
+    // A pass may access a resource more than once, e.g. as a copy source and destination, those are merged into one
+    // access so the resource gets a single barrier
+    passResources.clear();
+    passAccesses.clear();
+    for (ResourceAccess const& access : m_Passes[m_Schedule[position]].m_Accesses) {
+      RenderGraphAccessInfo accessInfo = GetAccessInfo(access.m_Access);
+      auto it = std::find(passResources.begin(), passResources.end(), access.m_ResourceId);
+      if (it == passResources.end()) {
+        passResources.push_back(access.m_ResourceId);
+        passAccesses.push_back(accessInfo);
+        continue;
+      }
+
+      RenderGraphAccessInfo& mergedInfo = passAccesses[it - passResources.begin()];
+      assert(!m_Resources[access.m_ResourceId].m_IsImage || mergedInfo.m_Layout == accessInfo.m_Layout);
+      mergedInfo.m_Stages |= accessInfo.m_Stages;
+      mergedInfo.m_Access |= accessInfo.m_Access;
+      mergedInfo.m_IsWrite = mergedInfo.m_IsWrite || accessInfo.m_IsWrite;
+    }
+
+    for (uint32_t idx = 0; idx != passResources.size(); ++idx) {
+      RenderGraphResourceId resourceId = passResources[idx];
+      bool isFirstUse = !m_Resources[resourceId].m_IsImported && m_Resources[resourceId].m_FirstPosition == position;
+      AddBarrier(m_PassBarriers[position], resourceId, states[resourceId], passAccesses[idx], isFirstUse);
+    }
+
+    for (RenderGraphResourceId resourceId : passResources) {
+      Resource const& resource = m_Resources[resourceId];
+      if (resource.m_IsImported || resource.m_LastPosition != position) { continue; }
+      m_RetiredTransientStages |= states[resourceId].m_WriteStages | states[resourceId].m_ReadStages;
+      m_RetiredTransientAccess |= states[resourceId].m_WriteAccess;
+    }
+  }
+
+  for (uint32_t resourceIdx = 0; resourceIdx != m_Resources.size(); ++resourceIdx) {
+    Resource const& resource = m_Resources[resourceIdx];
+    if (!resource.m_HasFinalAccess) { continue; }
+    AddBarrier(m_FinalBarriers, resourceIdx, states[resourceIdx], GetAccessInfo(resource.m_FinalAccess), false);
+  }
+}
+
+void RenderGraph::AddBarrier(BarrierBatch& batch,
+                             RenderGraphResourceId resourceId,
+                             ResourceState& state,
+                             RenderGraphAccessInfo const& accessInfo,
+                             bool isFirstUse)
+{
+  Resource const& resource = m_Resources[resourceId];
+  bool layoutChange = resource.m_IsImage && (isFirstUse || state.m_Layout != accessInfo.m_Layout);
+
+  vk::PipelineStageFlags srcStages;
+  vk::AccessFlags srcAccess;
+  if (isFirstUse) {
+    // The contents are undefined, but the memory may still be in use by an image aliasing it earlier in the frame
+    srcStages = m_RetiredTransientStages;
+    srcAccess = m_RetiredTransientAccess;
+  } else if (accessInfo.m_IsWrite || layoutChange) {
+    // Write after write needs the previous write to be available, write after read only has to wait for the reads.
+    // Layout transitions are writes as well.
+    srcStages = state.m_WriteStages | state.m_ReadStages;
+    srcAccess = state.m_WriteAccess;
+    if (!layoutChange && !srcStages) {
+      state = ResourceState{ accessInfo.m_Stages, accessInfo.m_Access, {}, {}, state.m_Layout };
+      return;
+    }
+  } else {
+    // Read after read is free, read after write only if the write has already been made visible to this access
+    bool alreadyVisible = (accessInfo.m_Stages & ~state.m_ReadStages) == vk::PipelineStageFlags()
+                          && (accessInfo.m_Access & ~state.m_ReadAccess) == vk::AccessFlags();
+    if (!state.m_WriteStages || alreadyVisible) {
+      state.m_ReadStages |= accessInfo.m_Stages;
+      state.m_ReadAccess |= accessInfo.m_Access;
+      return;
+    }
+    srcStages = state.m_WriteStages;
+    srcAccess = state.m_WriteAccess;
+  }
+
+  batch.m_SrcStages |= srcStages;
+  batch.m_DstStages |= accessInfo.m_Stages;
+  if (resource.m_IsImage) {
+    vk::ImageLayout oldLayout = isFirstUse ? vk::ImageLayout::eUndefined : state.m_Layout;
+    batch.m_ImageBarriers.push_back(vk::ImageMemoryBarrier(
+      srcAccess,                                       // vk::AccessFlags srcAccessMask_ = {},
+      accessInfo.m_Access,                             // vk::AccessFlags dstAccessMask_ = {},
+      oldLayout,                                       // vk::ImageLayout oldLayout_ = vk::ImageLayout::eUndefined,
+      accessInfo.m_Layout,                             // vk::ImageLayout newLayout_ = vk::ImageLayout::eUndefined,
+      VK_QUEUE_FAMILY_IGNORED,                         // uint32_t srcQueueFamilyIndex_ = {},
+      VK_QUEUE_FAMILY_IGNORED,                         // uint32_t dstQueueFamilyIndex_ = {},
+      resource.m_Image,                                // vk::Image image_ = {},
+      vk::ImageSubresourceRange(resource.m_AspectMask, // vk::ImageAspectFlags aspectMask_ = {},
+                                0,                     // uint32_t baseMipLevel_ = {},
+                                VK_REMAINING_MIP_LEVELS,  // uint32_t levelCount_ = {},
+                                0,                        // uint32_t baseArrayLayer_ = {},
+                                VK_REMAINING_ARRAY_LAYERS // uint32_t layerCount_ = {}
+                                )                         // vk::ImageSubresourceRange subresourceRange_ = {}
+      ));
+  } else {
+    batch.m_BufferBarriers.push_back(
+      vk::BufferMemoryBarrier(srcAccess,               // vk::AccessFlags srcAccessMask_ = {},
+                              accessInfo.m_Access,     // vk::AccessFlags dstAccessMask_ = {},
+                              VK_QUEUE_FAMILY_IGNORED, // uint32_t srcQueueFamilyIndex_ = {},
+                              VK_QUEUE_FAMILY_IGNORED, // uint32_t dstQueueFamilyIndex_ = {},
+                              resource.m_Buffer,       // vk::Buffer buffer_ = {},
+                              resource.m_Offset,       // vk::DeviceSize offset_ = {},
+                              resource.m_Size          // vk::DeviceSize size_ = {}
+                              ));
+  }
+  ++m_BarrierCount;
+
+  // After a write or a transition only this access has seen the new contents, a read keeps the previous write around
+  // for later readers that still need it made visible
+  if (accessInfo.m_IsWrite || layoutChange) {
+    state = accessInfo.m_IsWrite
+              ? ResourceState{ accessInfo.m_Stages, accessInfo.m_Access, {}, {}, accessInfo.m_Layout }
+              : ResourceState{ accessInfo.m_Stages, {}, accessInfo.m_Stages, accessInfo.m_Access, accessInfo.m_Layout };
+  } else {
+    state.m_ReadStages |= accessInfo.m_Stages;
+    state.m_ReadAccess |= accessInfo.m_Access;
+  }
+}
+
+void RenderGraph::RecordBarriers(vk::CommandBuffer commandBuffer, BarrierBatch const& batch) const
+{
+  if (batch.m_ImageBarriers.empty() && batch.m_BufferBarriers.empty()) { return; }
+
+  // An empty source scope only happens for the first use of fresh memory, there is nothing to wait for
+  vk::PipelineStageFlags srcStages = batch.m_SrcStages ? batch.m_SrcStages : vk::PipelineStageFlagBits::eTopOfPipe;
+  vk::PipelineStageFlags dstStages = batch.m_DstStages ? batch.m_DstStages : vk::PipelineStageFlagBits::eBottomOfPipe;
+  commandBuffer.pipelineBarrier(srcStages, dstStages, {}, nullptr, batch.m_BufferBarriers, batch.m_ImageBarriers);
+}
+} // namespace Core
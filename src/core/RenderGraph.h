@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "TransientResourcePool.h"
+#include "VulkanRenderer.h"
+
+namespace Core {
+
+enum class RenderGraphAccess : uint32_t
+{
+  ColorAttachmentWrite,
+  DepthStencilAttachmentWrite,
+  DepthStencilAttachmentRead,
+  VertexShaderRead,
+  FragmentShaderRead,
+  ComputeShaderRead,
+  ComputeShaderWrite,
+  TransferRead,
+  TransferWrite,
+  VertexBufferRead,
+  IndexBufferRead,
+  IndirectBufferRead,
+  Present
+};
+
+struct RenderGraphAccessInfo
+{
+  vk::PipelineStageFlags m_Stages;
+  vk::AccessFlags m_Access;
+  vk::ImageLayout m_Layout; // ignored for buffers
+  vk::ImageUsageFlags m_ImageUsage;
+  bool m_IsWrite;
+};
+
+// Per frame graph of passes that declare the resources they read and write instead of recording barriers themselves.
+// Compile() drops the passes nothing depends on, orders the rest so producers run as early as possible relative to
+// their consumers, and computes the barriers each pass needs from the previous accesses of its resources: reads after
+// reads of an already visible state cost nothing, everything else gets exactly the stages and access masks involved.
+// The barriers of a pass are recorded as a single vkCmdPipelineBarrier right before it.
+//
+// Images created by the graph are placed into the frame's TransientResourcePool with lifetimes taken from the final
+// pass order, so the pool must not be used directly while the graph manages transient images.
+class RenderGraph
+{
+public:
+  typedef std::function<void(vk::CommandBuffer commandBuffer)> ExecuteCallback;
+
+  RenderGraph(VulkanRenderer* renderer, TransientResourcePool* transientResourcePool);
+  RenderGraph(RenderGraph const& other) = delete;
+  RenderGraph& operator=(RenderGraph const& other) = delete;
+
+  // Imported resources keep their contents and always count as graph outputs. The image is expected in currentLayout
+  // with nothing pending on it except for the work in readyStages, e.g. the wait stage of an acquire semaphore.
+  RenderGraphResourceId ImportImage(char const* name,
+                                    vk::Image image,
+                                    vk::ImageAspectFlags aspectMask,
+                                    vk::ImageLayout currentLayout,
+                                    vk::PipelineStageFlags readyStages);
+  RenderGraphResourceId ImportBuffer(char const* name, vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize size);
+  // Transient image, its usage flags are derived from the declared accesses
+  RenderGraphResourceId CreateImage(char const* name, uint32_t width, uint32_t height, vk::Format format);
+  // State an imported resource is left in once the graph has executed, e.g. Present for the swapchain image
+  void SetFinalAccess(RenderGraphResourceId resourceId, RenderGraphAccess access);
+
+  uint32_t AddPass(char const* name, ExecuteCallback execute);
+  void Read(uint32_t passIdx, RenderGraphResourceId resourceId, RenderGraphAccess access);
+  void Write(uint32_t passIdx, RenderGraphResourceId resourceId, RenderGraphAccess access);
+
+  void Compile();
+  // Every executed pass gets its own timestamp pair in the frame stats
+  void Execute(FrameResource const& frameResources, vk::CommandBuffer commandBuffer);
+  void Reset();
+
+  // Only valid for transient images after Compile()
+  ImageData const& GetImage(RenderGraphResourceId resourceId) const;
+  vk::Framebuffer GetFramebuffer(RenderGraphResourceId resourceId, vk::RenderPass renderPass);
+  inline uint32_t GetCulledPassCount() const { return m_CulledPassCount; }
+  inline uint32_t GetBarrierCount() const { return m_BarrierCount; }
+
+  static RenderGraphAccessInfo GetAccessInfo(RenderGraphAccess access);
+
+private:
+  static constexpr uint32_t InvalidIdx = std::numeric_limits<uint32_t>::max();
+
+  struct ResourceState
+  {
+    vk::PipelineStageFlags m_WriteStages;
+    vk::AccessFlags m_WriteAccess;
+    // Stages and accesses the last write has already been made visible to
+    vk::PipelineStageFlags m_ReadStages;
+    vk::AccessFlags m_ReadAccess;
+    vk::ImageLayout m_Layout;
+  };
+
+  struct Resource
+  {
+    char const* m_Name;
+    bool m_IsImage;
+    bool m_IsImported;
+    vk::Image m_Image;
+    vk::ImageAspectFlags m_AspectMask;
+    vk::Buffer m_Buffer;
+    vk::DeviceSize m_Offset;
+    vk::DeviceSize m_Size;
+    TransientImageDesc m_TransientDesc;
+    TransientImageId m_TransientId;
+    uint32_t m_FirstPosition; // in m_Schedule, for the lifetime of transient images
+    uint32_t m_LastPosition;
+    ResourceState m_InitialState;
+    bool m_HasFinalAccess;
+    RenderGraphAccess m_FinalAccess;
+  };
+
+  struct ResourceAccess
+  {
+    RenderGraphResourceId m_ResourceId;
+    RenderGraphAccess m_Access;
+  };
+
+  struct BarrierBatch
+  {
+    vk::PipelineStageFlags m_SrcStages;
+    vk::PipelineStageFlags m_DstStages;
+    std::vector<vk::ImageMemoryBarrier> m_ImageBarriers;
+    std::vector<vk::BufferMemoryBarrier> m_BufferBarriers;
+  };
+
+  struct Pass
+  {
+    char const* m_Name;
+    ExecuteCallback m_Execute;
+    std::vector<ResourceAccess> m_Accesses;
+    std::vector<uint32_t> m_Dependencies;
+    bool m_IsNeeded;
+  };
+
+  void AddAccess(uint32_t passIdx, RenderGraphResourceId resourceId, RenderGraphAccess access);
+  void FindDependencies();
+  void CullPasses();
+  void SchedulePasses();
+  void PlaceTransientImages();
+  void ComputeBarriers();
+  void AddBarrier(BarrierBatch& batch,
+                  RenderGraphResourceId resourceId,
+                  ResourceState& state,
+                  RenderGraphAccessInfo const& accessInfo,
+                  bool isFirstUse);
+  void RecordBarriers(vk::CommandBuffer commandBuffer, BarrierBatch const& batch) const;
+
+  VulkanRenderer* m_Renderer;
+  TransientResourcePool* m_TransientResourcePool;
+  std::vector<Resource> m_Resources;
+  std::vector<Pass> m_Passes;
+  std::vector<uint32_t> m_Schedule;          // pass indices in execution order
+  std::vector<BarrierBatch> m_PassBarriers;  // parallel to m_Schedule
+  BarrierBatch m_FinalBarriers;
+  // Accumulated accesses of the transient images whose lifetime has ended, their memory may be reused by later ones
+  vk::PipelineStageFlags m_RetiredTransientStages;
+  vk::AccessFlags m_RetiredTransientAccess;
+  uint32_t m_CulledPassCount;
+  uint32_t m_BarrierCount;
+  bool m_IsCompiled;
+};
+} // namespace Core
@@ -0,0 +1,176 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace Core {
+RenderQueue::RenderQueue() :
+  m_Draws(),
+  m_Items(),
+  m_SortBuffer(),
+  m_PipelineIds(),
+  m_DescriptorSetIds(),
+  m_IsSorted(true),
+  m_ExecutedDrawCount(0),
+  m_StateChangeCount(0)
+{}
+
+uint64_t RenderQueue::MakeSortKey(uint32_t pass,
+                                  uint32_t pipelineId,
+                                  uint32_t descriptorSetId,
+                                  float depth,
+                                  uint32_t material)
+{
+  assert(pass < MaxPasses && pipelineId < MaxPipelines && descriptorSetId < MaxDescriptorSets
+         && material < MaxMaterials);
+  uint64_t const maxDepth = (1ull << DepthBits) - 1;
+  uint64_t quantizedDepth = static_cast<uint64_t>(std::clamp(depth, 0.0f, 1.0f) * static_cast<float>(maxDepth));
+
+  return (static_cast<uint64_t>(pass) << 60) | (static_cast<uint64_t>(pipelineId) << 50)
+         | (static_cast<uint64_t>(descriptorSetId) << 36) | (quantizedDepth << 12) | static_cast<uint64_t>(material);
+}
+
+void RenderQueue::Submit(uint32_t pass, DrawRequest const& draw, float depth, uint32_t material)
+{
+  uint64_t key =
+    MakeSortKey(pass, GetPipelineId(draw.m_Pipeline), GetDescriptorSetId(draw.m_DescriptorSet), depth, material);
+  m_Items.push_back(SortItem{ key, static_cast<uint32_t>(m_Draws.size()) });
+  m_Draws.push_back(draw);
+  m_IsSorted = false;
+}
+
+void RenderQueue::Sort()
+{
+  if (m_IsSorted) { return; }
+
+  size_t const itemCount = m_Items.size();
+  m_SortBuffer.resize(itemCount);
+
+  // All byte histograms in a single read of the keys
+  std::array<std::array<uint32_t, 256>, 8> histograms = {};
+  for (SortItem const& item : m_Items) {
+    for (uint32_t byteIdx = 0; byteIdx != 8; ++byteIdx) {
+      ++histograms[byteIdx][(item.m_Key >> (8 * byteIdx)) & 0xff];
+    }
+  }
+
+  for (uint32_t byteIdx = 0; byteIdx != 8; ++byteIdx) {
+    std::array<uint32_t, 256>& histogram = histograms[byteIdx];
+    // Every key has the same byte here, e.g. the unused pass or material bits, the scatter would not move anything
+    if (std::any_of(histogram.cbegin(), histogram.cend(), [itemCount](uint32_t count) { return count == itemCount; })) {
+      continue;
+    }
+
+    uint32_t offset = 0;
+    for (uint32_t& count : histogram) {
+      uint32_t bucketSize = count;
+      count = offset;
+      offset += bucketSize;
+    }
+
+    for (SortItem const& item : m_Items) {
+      m_SortBuffer[histogram[(item.m_Key >> (8 * byteIdx)) & 0xff]++] = item;
+    }
+    m_Items.swap(m_SortBuffer);
+  }
+
+  m_IsSorted = true;
+}
+
+void RenderQueue::Execute(RecordingCommandBuffer& commandBuffer, uint32_t pass) const
+{
+  assert(m_IsSorted);
+  m_ExecutedDrawCount = 0;
+  m_StateChangeCount = 0;
+
+  // The pass sits in the top bits, so its draws form one contiguous range of the sorted keys
+  auto passBegin = std::lower_bound(
+    m_Items.cbegin(), m_Items.cend(), static_cast<uint64_t>(pass) << 60, [](SortItem const& item, uint64_t key) {
+      return item.m_Key < key;
+    });
+  auto passEnd = pass + 1 == MaxPasses ? m_Items.cend()
+                                        : std::lower_bound(passBegin,
+                                                           m_Items.cend(),
+                                                           static_cast<uint64_t>(pass + 1) << 60,
+                                                           [](SortItem const& item, uint64_t key) {
+                                                             return item.m_Key < key;
+                                                           });
+
+  vk::Pipeline boundPipeline = nullptr;
+  vk::DescriptorSet boundDescriptorSet = nullptr;
+  vk::Buffer boundVertexBuffer = nullptr;
+  DrawRequest pendingDraw = DrawRequest();
+  bool hasPendingDraw = false;
+
+  auto flush = [&]() {
+    if (!hasPendingDraw) { return; }
+    commandBuffer.Draw(
+      pendingDraw.m_VertexCount, pendingDraw.m_InstanceCount, pendingDraw.m_FirstVertex, pendingDraw.m_FirstInstance);
+    ++m_ExecutedDrawCount;
+    hasPendingDraw = false;
+  };
+
+  for (auto it = passBegin; it != passEnd; ++it) {
+    DrawRequest const& draw = m_Draws[it->m_DrawIdx];
+    bool const sameState = draw.m_Pipeline == boundPipeline && draw.m_DescriptorSet == boundDescriptorSet
+                           && draw.m_VertexBuffer == boundVertexBuffer;
+
+    // The same mesh continuing the instance range of the previous draw
+    if (hasPendingDraw && sameState && draw.m_VertexCount == pendingDraw.m_VertexCount
+        && draw.m_FirstVertex == pendingDraw.m_FirstVertex
+        && draw.m_FirstInstance == pendingDraw.m_FirstInstance + pendingDraw.m_InstanceCount) {
+      pendingDraw.m_InstanceCount += draw.m_InstanceCount;
+      continue;
+    }
+
+    flush();
+    if (draw.m_Pipeline != boundPipeline) {
+      commandBuffer.BindPipeline(vk::PipelineBindPoint::eGraphics, draw.m_Pipeline);
+      boundPipeline = draw.m_Pipeline;
+      ++m_StateChangeCount;
+    }
+    if (draw.m_DescriptorSet != boundDescriptorSet) {
+      commandBuffer.BindDescriptorSets(
+        vk::PipelineBindPoint::eGraphics, draw.m_PipelineLayout, 0, draw.m_DescriptorSet);
+      boundDescriptorSet = draw.m_DescriptorSet;
+      ++m_StateChangeCount;
+    }
+    if (draw.m_VertexBuffer != boundVertexBuffer) {
+      commandBuffer.BindVertexBuffer(draw.m_VertexBuffer, vk::DeviceSize(0));
+      boundVertexBuffer = draw.m_VertexBuffer;
+      ++m_StateChangeCount;
+    }
+    pendingDraw = draw;
+    hasPendingDraw = true;
+  }
+  flush();
+}
+
+void RenderQueue::Reset()
+{
+  m_Draws.clear();
+  m_Items.clear();
+  m_PipelineIds.clear();
+  m_DescriptorSetIds.clear();
+  m_IsSorted = true;
+}
+
+uint32_t RenderQueue::GetPipelineId(vk::Pipeline pipeline)
+{
+  auto [it, isInserted] =
+    m_PipelineIds.emplace(static_cast<VkPipeline>(pipeline), static_cast<uint32_t>(m_PipelineIds.size()));
+  (void)isInserted;
+  if (it->second >= MaxPipelines) { throw std::runtime_error("Render queue is out of pipeline ids"); }
+  return it->second;
+}
+
+uint32_t RenderQueue::GetDescriptorSetId(vk::DescriptorSet descriptorSet)
+{
+  auto [it, isInserted] = m_DescriptorSetIds.emplace(static_cast<VkDescriptorSet>(descriptorSet),
+                                                      static_cast<uint32_t>(m_DescriptorSetIds.size()));
+  (void)isInserted;
+  if (it->second >= MaxDescriptorSets) { throw std::runtime_error("Render queue is out of descriptor set ids"); }
+  return it->second;
+}
+} // namespace Core
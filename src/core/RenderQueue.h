@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "CommandStreamRecorder.h"
+
+namespace Core {
+
+struct DrawRequest
+{
+  vk::Pipeline m_Pipeline;
+  vk::PipelineLayout m_PipelineLayout;
+  vk::DescriptorSet m_DescriptorSet;
+  vk::Buffer m_VertexBuffer;
+  uint32_t m_VertexCount;
+  uint32_t m_InstanceCount;
+  uint32_t m_FirstVertex;
+  uint32_t m_FirstInstance;
+};
+
+// Collects the draws of a frame as 64 bit sort keys and replays them in key order. From the most significant bits
+// down a key holds the pass, the pipeline, the descriptor set, the quantized depth and a material id, so sorting puts
+// the draws sharing state next to each other and the replay only binds what actually changes. Pipelines and descriptor
+// sets are numbered in the order the frame first submits them. Adjacent draws of the same mesh with consecutive
+// instances are merged into one draw.
+//
+// The keys are sorted with a stable LSD radix sort over their bytes, bytes that are the same in every key are skipped.
+// The storage is kept between frames, so a steady scene does not allocate.
+class RenderQueue
+{
+public:
+  static constexpr uint32_t MaxPasses = 1 << 4;
+  static constexpr uint32_t MaxPipelines = 1 << 10;
+  static constexpr uint32_t MaxDescriptorSets = 1 << 14;
+  static constexpr uint32_t MaxMaterials = 1 << 12;
+
+  RenderQueue();
+  RenderQueue(RenderQueue const& other) = delete;
+  RenderQueue& operator=(RenderQueue const& other) = delete;
+
+  // Depth is expected in [0, 1], draws of equal state are replayed front to back. Pass 1 - depth for back to front.
+  void Submit(uint32_t pass, DrawRequest const& draw, float depth, uint32_t material = 0);
+  void Sort();
+  // Replays the sorted draws of a pass, viewport and scissor are left to the caller
+  void Execute(RecordingCommandBuffer& commandBuffer, uint32_t pass) const;
+  // Drops the draws and the pipeline and descriptor set ids
+  void Reset();
+
+  inline uint32_t GetDrawCount() const { return static_cast<uint32_t>(m_Items.size()); }
+  // State of the last Execute call
+  inline uint32_t GetExecutedDrawCount() const { return m_ExecutedDrawCount; }
+  inline uint32_t GetStateChangeCount() const { return m_StateChangeCount; }
+
+  static uint64_t MakeSortKey(
+    uint32_t pass, uint32_t pipelineId, uint32_t descriptorSetId, float depth, uint32_t material);
+
+private:
+  struct SortItem
+  {
+    uint64_t m_Key;
+    uint32_t m_DrawIdx;
+  };
+
+  static constexpr uint32_t DepthBits = 24;
+
+  uint32_t GetPipelineId(vk::Pipeline pipeline);
+  uint32_t GetDescriptorSetId(vk::DescriptorSet descriptorSet);
+
+  std::vector<DrawRequest> m_Draws;
+  std::vector<SortItem> m_Items;
+  std::vector<SortItem> m_SortBuffer;
+  std::unordered_map<VkPipeline, uint32_t> m_PipelineIds;
+  std::unordered_map<VkDescriptorSet, uint32_t> m_DescriptorSetIds;
+  bool m_IsSorted;
+  mutable uint32_t m_ExecutedDrawCount;
+  mutable uint32_t m_StateChangeCount;
+};
+} // namespace Core
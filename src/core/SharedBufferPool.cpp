@@ -0,0 +1,95 @@
+#include "SharedBufferPool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <sstream>
+
+namespace Core {
+SharedBufferPool::SharedBufferPool(VulkanRenderer* renderer, vk::DeviceSize chunkSize) :
+  m_Renderer(renderer),
+  m_ChunkSize(chunkSize),
+  m_Chunks(std::array<std::vector<Chunk>, static_cast<size_t>(SharedBufferUsage::Count)>()),
+  m_CriticalSection(std::mutex())
+{}
+
+SharedBufferPool::~SharedBufferPool()
+{
+  for (auto& chunks : m_Chunks) {
+    for (auto& chunk : chunks) {
+      m_Renderer->FreeBuffer(chunk.m_Buffer);
+    }
+    chunks.clear();
+  }
+}
+
+SharedBufferRange SharedBufferPool::Allocate(SharedBufferUsage usage, vk::DeviceSize size, vk::DeviceSize alignment)
+{
+  assert(usage != SharedBufferUsage::Count);
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  std::vector<Chunk>& chunks = m_Chunks[static_cast<size_t>(usage)];
+
+  for (uint32_t chunkIdx = 0; chunkIdx != chunks.size(); ++chunkIdx) {
+    vk::DeviceSize offset = chunks[chunkIdx].m_Ranges.Allocate(size, alignment);
+    if (offset != RangeAllocator::InvalidOffset) {
+      return SharedBufferRange{ chunks[chunkIdx].m_Buffer.m_Handle, offset, size, usage, chunkIdx };
+    }
+  }
+
+  // Oversized requests get a chunk of their own, they are rare enough not to matter for the bind count
+  vk::DeviceSize chunkSize = std::max(m_ChunkSize, size);
+  Chunk chunk;
+  chunk.m_Buffer =
+    m_Renderer->CreateBuffer(chunkSize, GetBufferUsage(usage), { vk::MemoryPropertyFlagBits::eDeviceLocal });
+  chunk.m_Ranges = RangeAllocator(chunkSize);
+
+  std::ostringstream chunkName;
+  chunkName << "Shared buffer chunk (usage " << static_cast<uint32_t>(usage) << ", #" << chunks.size() << ")";
+  m_Renderer->SetDebugName(chunk.m_Buffer, chunkName.str());
+
+  vk::DeviceSize offset = chunk.m_Ranges.Allocate(size, alignment);
+  assert(offset != RangeAllocator::InvalidOffset);
+  chunks.push_back(chunk);
+  return SharedBufferRange{
+    chunk.m_Buffer.m_Handle, offset, size, usage, static_cast<uint32_t>(chunks.size() - 1)
+  };
+}
+
+SharedBufferRange SharedBufferPool::AllocateVertices(uint32_t vertexCount, uint32_t vertexStride)
+{
+  return Allocate(SharedBufferUsage::Vertex, vk::DeviceSize(vertexCount) * vertexStride, vertexStride);
+}
+
+SharedBufferRange SharedBufferPool::AllocateIndices(uint32_t indexCount, vk::IndexType indexType)
+{
+  vk::DeviceSize indexSize = indexType == vk::IndexType::eUint16 ? 2 : 4;
+  return Allocate(SharedBufferUsage::Index, vk::DeviceSize(indexCount) * indexSize, indexSize);
+}
+
+SharedBufferRange SharedBufferPool::AllocateUniform(vk::DeviceSize size)
+{
+  return Allocate(SharedBufferUsage::Uniform, size, m_Renderer->GetMinUniformBufferOffsetAlignment());
+}
+
+void SharedBufferPool::Free(SharedBufferRange const& range)
+{
+  std::lock_guard<std::mutex> lock(m_CriticalSection);
+  std::vector<Chunk>& chunks = m_Chunks[static_cast<size_t>(range.m_Usage)];
+  assert(range.m_ChunkIdx < chunks.size() && chunks[range.m_ChunkIdx].m_Buffer.m_Handle == range.m_Buffer);
+  chunks[range.m_ChunkIdx].m_Ranges.Free(range.m_Offset, range.m_Size);
+}
+
+vk::BufferUsageFlags SharedBufferPool::GetBufferUsage(SharedBufferUsage usage)
+{
+  vk::BufferUsageFlags transferUsage = vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+  switch (usage) {
+  case SharedBufferUsage::Vertex:
+    return transferUsage | vk::BufferUsageFlagBits::eVertexBuffer;
+  case SharedBufferUsage::Index:
+    return transferUsage | vk::BufferUsageFlagBits::eIndexBuffer;
+  case SharedBufferUsage::Uniform:
+    return transferUsage | vk::BufferUsageFlagBits::eUniformBuffer;
+  default:
+    throw std::runtime_error("Unknown shared buffer usage");
+  }
+}
+} // namespace Core
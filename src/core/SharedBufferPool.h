@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "RangeAllocator.h"
+#include "VulkanRenderer.h"
+
+namespace Core {
+
+enum class SharedBufferUsage : uint32_t
+{
+  Vertex,
+  Index,
+  Uniform,
+  Count
+};
+
+struct SharedBufferRange
+{
+  vk::Buffer m_Buffer;
+  vk::DeviceSize m_Offset;
+  vk::DeviceSize m_Size;
+  SharedBufferUsage m_Usage;
+  uint32_t m_ChunkIdx;
+
+  // Index of the first element of the range when the whole buffer is bound at offset 0, for firstVertex/firstIndex
+  inline uint32_t GetFirstElement(vk::DeviceSize stride) const { return static_cast<uint32_t>(m_Offset / stride); }
+};
+
+// A few large device local buffers per usage class, sub-allocated into ranges. Meshes sharing a chunk can be drawn
+// after a single bind by passing their first element to the draw call instead of binding each of them.
+class SharedBufferPool
+{
+public:
+  SharedBufferPool(VulkanRenderer* renderer, vk::DeviceSize chunkSize = DEFAULT_CHUNK_SIZE);
+  SharedBufferPool(SharedBufferPool const& other) = delete;
+  SharedBufferPool& operator=(SharedBufferPool const& other) = delete;
+  ~SharedBufferPool();
+
+  SharedBufferRange Allocate(SharedBufferUsage usage, vk::DeviceSize size, vk::DeviceSize alignment);
+  SharedBufferRange AllocateVertices(uint32_t vertexCount, uint32_t vertexStride);
+  SharedBufferRange AllocateIndices(uint32_t indexCount, vk::IndexType indexType);
+  SharedBufferRange AllocateUniform(vk::DeviceSize size);
+  void Free(SharedBufferRange const& range);
+
+  static constexpr vk::DeviceSize DEFAULT_CHUNK_SIZE = 16 * 1024 * 1024;
+
+private:
+  struct Chunk
+  {
+    BufferData m_Buffer;
+    RangeAllocator m_Ranges;
+  };
+
+  static vk::BufferUsageFlags GetBufferUsage(SharedBufferUsage usage);
+
+  VulkanRenderer* m_Renderer;
+  vk::DeviceSize m_ChunkSize;
+  std::array<std::vector<Chunk>, static_cast<size_t>(SharedBufferUsage::Count)> m_Chunks;
+  std::mutex m_CriticalSection;
+};
+} // namespace Core
@@ -0,0 +1,267 @@
+#include "SpriteBatcher.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <stdexcept>
+
+#include "UploadArena.h"
+
+namespace Core {
+uint32_t Sprite::PackColor(float r, float g, float b, float a)
+{
+  auto toByte = [](float value) {
+    return static_cast<uint32_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+  };
+  return toByte(r) | (toByte(g) << 8) | (toByte(b) << 16) | (toByte(a) << 24);
+}
+
+SpriteBatcher::SpriteBatcher(VulkanRenderer* renderer) :
+  m_Renderer(renderer),
+  m_Pipeline(nullptr),
+  m_Sprites(nullptr),
+  m_InstanceBuffer(nullptr),
+  m_InstanceOffset(0),
+  m_SpriteCount(0),
+  m_Capacity(0),
+  m_Batches()
+{
+  CreatePipeline();
+}
+
+SpriteBatcher::~SpriteBatcher()
+{
+  m_Renderer->GetDevice().destroyPipeline(m_Pipeline);
+}
+
+void SpriteBatcher::Begin(FrameResource const& frameResources, uint32_t maxSpriteCount)
+{
+  m_Batches.clear();
+  m_SpriteCount = 0;
+  m_Capacity = maxSpriteCount;
+  if (maxSpriteCount == 0) {
+    m_Sprites = nullptr;
+    return;
+  }
+
+  UploadAllocation allocation =
+    frameResources.m_UploadArena->AllocateVertices(static_cast<vk::DeviceSize>(maxSpriteCount) * sizeof(Sprite));
+  m_Sprites = reinterpret_cast<Sprite*>(allocation.m_Ptr);
+  m_InstanceBuffer = allocation.m_Buffer;
+  m_InstanceOffset = allocation.m_Offset;
+}
+
+void SpriteBatcher::Add(vk::DescriptorSet descriptorSet, Sprite const& sprite)
+{
+  *Allocate(descriptorSet, 1) = sprite;
+}
+
+Sprite* SpriteBatcher::Allocate(vk::DescriptorSet descriptorSet, uint32_t count)
+{
+  if (count > m_Capacity - m_SpriteCount) { throw std::runtime_error("Sprite batcher is out of instance space"); }
+
+  Sprite* sprites = m_Sprites + m_SpriteCount;
+  AddToBatch(descriptorSet, count);
+  m_SpriteCount += count;
+  return sprites;
+}
+
+void SpriteBatcher::AddToBatch(vk::DescriptorSet descriptorSet, uint32_t count)
+{
+  // The instances are consecutive in the stream, so a run of the same descriptor set is a single draw
+  if (!m_Batches.empty() && m_Batches.back().m_DescriptorSet == descriptorSet) {
+    m_Batches.back().m_SpriteCount += count;
+    return;
+  }
+  m_Batches.push_back(Batch{ descriptorSet, m_SpriteCount, count });
+}
+
+void SpriteBatcher::Record(vk::CommandBuffer commandBuffer) const
+{
+  if (m_SpriteCount == 0) { return; }
+
+  BindInstances(commandBuffer, m_Batches.front().m_DescriptorSet, m_InstanceBuffer, m_InstanceOffset);
+
+  vk::DescriptorSet boundDescriptorSet = m_Batches.front().m_DescriptorSet;
+  for (Batch const& batch : m_Batches) {
+    if (batch.m_DescriptorSet != boundDescriptorSet) {
+      commandBuffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eGraphics, m_Renderer->GetPipelineLayout(), 0, batch.m_DescriptorSet, nullptr);
+      boundDescriptorSet = batch.m_DescriptorSet;
+    }
+    // The quad corners come from the vertex index, the instance rate attributes start at firstInstance
+    commandBuffer.draw(4, batch.m_SpriteCount, 0, batch.m_FirstSprite);
+  }
+}
+
+void SpriteBatcher::BindInstances(vk::CommandBuffer commandBuffer,
+                                  vk::DescriptorSet descriptorSet,
+                                  vk::Buffer instanceBuffer,
+                                  vk::DeviceSize instanceOffset) const
+{
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_Pipeline);
+  commandBuffer.bindDescriptorSets(
+    vk::PipelineBindPoint::eGraphics, m_Renderer->GetPipelineLayout(), 0, descriptorSet, nullptr);
+  commandBuffer.bindVertexBuffers(0, instanceBuffer, instanceOffset);
+}
+
+void SpriteBatcher::CreatePipeline()
+{
+  auto vertexShaderModule = m_Renderer->CreateShaderModule("shaders/sprite.vert.spv");
+  auto fragmentShaderModule = m_Renderer->CreateShaderModule("shaders/sprite.frag.spv");
+
+  auto shaderStages = std::vector<vk::PipelineShaderStageCreateInfo>(
+    { vk::PipelineShaderStageCreateInfo(
+        {},                                   // vk::PipelineShaderStageCreateFlags flags_ = {},
+        { vk::ShaderStageFlagBits::eVertex }, // vk::ShaderStageFlagBits stage_ = vk::ShaderStageFlagBits::eVertex,
+        vertexShaderModule.get(),             // vk::ShaderModule module_ = {},
+        "main",                               // const char* pName_ = {},
+        nullptr                               // const vk::SpecializationInfo* pSpecializationInfo_ = {}
+        ),
+      vk::PipelineShaderStageCreateInfo(
+        {},                                     // vk::PipelineShaderStageCreateFlags flags_ = {},
+        { vk::ShaderStageFlagBits::eFragment }, // vk::ShaderStageFlagBits stage_ = vk::ShaderStageFlagBits::eVertex,
+        fragmentShaderModule.get(),             // vk::ShaderModule module_ = {},
+        "main",                                 // const char* pName_ = {},
+        nullptr                                 // const vk::SpecializationInfo* pSpecializationInfo_ = {}
+        ) });
+
+  // No per vertex data at all, every attribute advances once per sprite
+  auto vertexBindingDescription = vk::VertexInputBindingDescription(
+    0,                             // uint32_t binding_ = {},
+    sizeof(Sprite),                // uint32_t stride_ = {},
+    vk::VertexInputRate::eInstance // vk::VertexInputRate inputRate_ = vk::VertexInputRate::eVertex
+  );
+
+  auto vertexInputAttributes = std::vector<vk::VertexInputAttributeDescription>(
+    { vk::VertexInputAttributeDescription(0,                                   // uint32_t location_ = {},
+                                          vertexBindingDescription.binding,    // uint32_t binding_ = {},
+                                          vk::Format::eR32G32Sfloat,           // vk::Format format_ = {},
+                                          offsetof(Sprite, Sprite::m_Position) // uint32_t offset_ = {}
+                                          ),
+      vk::VertexInputAttributeDescription(1,                                // uint32_t location_ = {},
+                                          vertexBindingDescription.binding, // uint32_t binding_ = {},
+                                          vk::Format::eR32G32Sfloat,        // vk::Format format_ = {},
+                                          offsetof(Sprite, Sprite::m_Size)  // uint32_t offset_ = {}
+                                          ),
+      vk::VertexInputAttributeDescription(2,                                 // uint32_t location_ = {},
+                                          vertexBindingDescription.binding,  // uint32_t binding_ = {},
+                                          vk::Format::eR32G32B32A32Sfloat,   // vk::Format format_ = {},
+                                          offsetof(Sprite, Sprite::m_UvRect) // uint32_t offset_ = {}
+                                          ),
+      vk::VertexInputAttributeDescription(3,                                   // uint32_t location_ = {},
+                                          vertexBindingDescription.binding,    // uint32_t binding_ = {},
+                                          vk::Format::eR32Sfloat,              // vk::Format format_ = {},
+                                          offsetof(Sprite, Sprite::m_Rotation) // uint32_t offset_ = {}
+                                          ),
+      vk::VertexInputAttributeDescription(4,                                // uint32_t location_ = {},
+                                          vertexBindingDescription.binding, // uint32_t binding_ = {},
+                                          vk::Format::eR8G8B8A8Unorm,       // vk::Format format_ = {},
+                                          offsetof(Sprite, Sprite::m_Color) // uint32_t offset_ = {}
+                                          ) });
+
+  auto vertexInputState = vk::PipelineVertexInputStateCreateInfo(
+    {},                        // vk::PipelineVertexInputStateCreateFlags flags_ = {}, reserved
+    1,                         // uint32_t vertexBindingDescriptionCount_ = {},
+    &vertexBindingDescription, // const vk::VertexInputBindingDescription* pVertexBindingDescriptions_ = {},
+    static_cast<uint32_t>(vertexInputAttributes.size()), // uint32_t vertexAttributeDescriptionCount_ = {},
+    vertexInputAttributes.data() // const vk::VertexInputAttributeDescription* pVertexAttributeDescriptions_ = {}
+  );
+
+  auto inputAssemblyState = vk::PipelineInputAssemblyStateCreateInfo(
+    {},                                    // vk::PipelineInputAssemblyStateCreateFlags flags_ = {}, reserved
+    vk::PrimitiveTopology::eTriangleStrip, // vk::PrimitiveTopology topology_ = vk::PrimitiveTopology::ePointList,
+    VK_FALSE                               // vk::Bool32 primitiveRestartEnable_ = {}
+  );
+
+  auto viewPortState =
+    vk::PipelineViewportStateCreateInfo({},      // vk::PipelineViewportStateCreateFlags flags_ = {}, reserved
+                                        1,       // uint32_t viewportCount_ = {},
+                                        nullptr, // const vk::Viewport* pViewports_ = {},
+                                        1,       // uint32_t scissorCount_ = {},
+                                        nullptr  // const vk::Rect2D* pScissors_ = {}
+    );
+
+  // Mirrored sprites come with a negative size, which flips the winding
+  auto rasterizationState = vk::PipelineRasterizationStateCreateInfo(
+    {},                               // vk::PipelineRasterizationStateCreateFlags flags_ = {}, reserved
+    VK_FALSE,                         // vk::Bool32 depthClampEnable_ = {},
+    VK_FALSE,                         // vk::Bool32 rasterizerDiscardEnable_ = {},
+    vk::PolygonMode::eFill,           // vk::PolygonMode polygonMode_ = vk::PolygonMode::eFill,
+    { vk::CullModeFlagBits::eNone },  // vk::CullModeFlags cullMode_ = {},
+    vk::FrontFace::eCounterClockwise, // vk::FrontFace frontFace_ = vk::FrontFace::eCounterClockwise,
+    VK_FALSE,                         // vk::Bool32 depthBiasEnable_ = {},
+    0.0f,                             // float depthBiasConstantFactor_ = {},
+    0.0f,                             // float depthBiasClamp_ = {},
+    1.0f,                             // float depthBiasSlopeFactor_ = {},
+    1.0f                              // float lineWidth_ = {}
+  );
+
+  auto multisampleState = vk::PipelineMultisampleStateCreateInfo(
+    {},                              // vk::PipelineMultisampleStateCreateFlags flags_ = {}, reserved
+    { vk::SampleCountFlagBits::e1 }, // vk::SampleCountFlagBits rasterizationSamples_ = vk::SampleCountFlagBits::e1,
+    VK_FALSE,                        // vk::Bool32 sampleShadingEnable_ = {},
+    1.0f,                            // float minSampleShading_ = {},
+    nullptr,                         // const vk::SampleMask* pSampleMask_ = {},
+    VK_FALSE,                        // vk::Bool32 alphaToCoverageEnable_ = {},
+    VK_FALSE                         // vk::Bool32 alphaToOneEnable_ = {}
+  );
+
+  // Straight alpha, sprites are blended over whatever was drawn before them
+  auto colorBlendAttachmentState = vk::PipelineColorBlendAttachmentState(
+    VK_TRUE,                            // vk::Bool32 blendEnable_ = {},
+    vk::BlendFactor::eSrcAlpha,         // vk::BlendFactor srcColorBlendFactor_ = vk::BlendFactor::eZero,
+    vk::BlendFactor::eOneMinusSrcAlpha, // vk::BlendFactor dstColorBlendFactor_ = vk::BlendFactor::eZero,
+    vk::BlendOp::eAdd,                  // vk::BlendOp colorBlendOp_ = vk::BlendOp::eAdd,
+    vk::BlendFactor::eOne,              // vk::BlendFactor srcAlphaBlendFactor_ = vk::BlendFactor::eZero,
+    vk::BlendFactor::eOneMinusSrcAlpha, // vk::BlendFactor dstAlphaBlendFactor_ = vk::BlendFactor::eZero,
+    vk::BlendOp::eAdd,                  // vk::BlendOp alphaBlendOp_ = vk::BlendOp::eAdd,
+    { vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB
+      | vk::ColorComponentFlagBits::eA } // vk::ColorComponentFlags colorWriteMask_ = {}
+  );
+
+  auto colorBlendState = vk::PipelineColorBlendStateCreateInfo(
+    {},                         // vk::PipelineColorBlendStateCreateFlags flags_ = {}, reserved
+    VK_FALSE,                   // vk::Bool32 logicOpEnable_ = {},
+    vk::LogicOp::eCopy,         // vk::LogicOp logicOp_ = vk::LogicOp::eClear,
+    1,                          // uint32_t attachmentCount_ = {},
+    &colorBlendAttachmentState, // const vk::PipelineColorBlendAttachmentState* pAttachments_ = {},
+    { 0.0f, 0.0f, 0.0f, 0.0f }  // std::array<float,4> const& blendConstants_ = {}
+  );
+
+  auto dynamicStates = std::vector<vk::DynamicState>({ vk::DynamicState::eViewport, vk::DynamicState::eScissor });
+
+  auto dynamicState =
+    vk::PipelineDynamicStateCreateInfo({}, // vk::PipelineDynamicStateCreateFlags flags_ = {}, reserved
+                                       static_cast<uint32_t>(dynamicStates.size()), // uint32_t dynamicStateCount_ = {},
+                                       dynamicStates.data() // const vk::DynamicState* pDynamicStates_ = {}
+    );
+
+  auto pipelineCreateInfo = vk::GraphicsPipelineCreateInfo(
+    {},                                         // vk::PipelineCreateFlags flags_ = {},
+    static_cast<uint32_t>(shaderStages.size()), // uint32_t stageCount_ = {},
+    shaderStages.data(),                        // const vk::PipelineShaderStageCreateInfo* pStages_ = {},
+    &vertexInputState,               // const vk::PipelineVertexInputStateCreateInfo* pVertexInputState_ = {},
+    &inputAssemblyState,             // const vk::PipelineInputAssemblyStateCreateInfo* pInputAssemblyState_ = {},
+    nullptr,                         // const vk::PipelineTessellationStateCreateInfo* pTessellationState_ = {},
+    &viewPortState,                  // const vk::PipelineViewportStateCreateInfo* pViewportState_ = {},
+    &rasterizationState,             // const vk::PipelineRasterizationStateCreateInfo* pRasterizationState_ = {},
+    &multisampleState,               // const vk::PipelineMultisampleStateCreateInfo* pMultisampleState_ = {},
+    nullptr,                         // const vk::PipelineDepthStencilStateCreateInfo* pDepthStencilState_ = {},
+    &colorBlendState,                // const vk::PipelineColorBlendStateCreateInfo* pColorBlendState_ = {},
+    &dynamicState,                   // const vk::PipelineDynamicStateCreateInfo* pDynamicState_ = {},
+    m_Renderer->GetPipelineLayout(), // vk::PipelineLayout layout_ = {},
+    m_Renderer->GetRenderPass(),     // vk::RenderPass renderPass_ = {},
+    0,                               // uint32_t subpass_ = {},
+    nullptr,                         // vk::Pipeline basePipelineHandle_ = {},
+    -1                               // int32_t basePipelineIndex_ = {}
+  );
+
+  auto result = m_Renderer->GetDevice().createGraphicsPipeline(nullptr, pipelineCreateInfo);
+  if (result.result != vk::Result::eSuccess) {
+    throw std::runtime_error("Could not create sprite pipeline " + vk::to_string(result.result));
+  }
+
+  m_Pipeline = result.value;
+}
+} // namespace Core
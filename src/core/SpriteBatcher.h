@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "VulkanRenderer.h"
+
+namespace Core {
+
+// One instance of the sprite stream, read by shaders/sprite.vert as is
+struct Sprite
+{
+  float m_Position[2]; // center
+  float m_Size[2];
+  float m_UvRect[4]; // top left u, v then bottom right u, v
+  float m_Rotation;  // radians, around the center
+  uint32_t m_Color;  // RGBA8 with red in the lowest byte, multiplied with the texture
+
+  static uint32_t PackColor(float r, float g, float b, float a);
+};
+
+// Draws large numbers of textured quads as instances of a single 4 vertex strip. The sprites of a frame are written
+// straight into the frame's upload arena, consecutive sprites sharing a descriptor set end up in the same instanced
+// draw. Sprites are drawn in the order they were added, there is no depth test.
+//
+// The descriptor sets have to match the renderer's layout, a texture at binding 0 and the projection at binding 1. The
+// draws are recorded outside of a running capture, which has no way to refer to the sprite pipeline or the arena.
+class SpriteBatcher
+{
+public:
+  SpriteBatcher(VulkanRenderer* renderer);
+  SpriteBatcher(SpriteBatcher const& other) = delete;
+  SpriteBatcher& operator=(SpriteBatcher const& other) = delete;
+  ~SpriteBatcher();
+
+  // Reserves room for maxSpriteCount sprites in the frame's upload arena and drops the previous frame's batches
+  void Begin(FrameResource const& frameResources, uint32_t maxSpriteCount);
+  void Add(vk::DescriptorSet descriptorSet, Sprite const& sprite);
+  // Room for count sprites to be filled in by the caller, e.g. from several jobs. Valid until the next Begin.
+  Sprite* Allocate(vk::DescriptorSet descriptorSet, uint32_t count);
+  // Inside the renderer's render pass, viewport and scissor are left to the caller
+  void Record(vk::CommandBuffer commandBuffer) const;
+  // Binds the sprite pipeline for instances living in a vertex buffer of their own, e.g. a static field drawn with
+  // indirect draws. The draws are up to the caller, 4 vertices per sprite.
+  void BindInstances(vk::CommandBuffer commandBuffer,
+                     vk::DescriptorSet descriptorSet,
+                     vk::Buffer instanceBuffer,
+                     vk::DeviceSize instanceOffset) const;
+
+  inline uint32_t GetSpriteCount() const { return m_SpriteCount; }
+  inline uint32_t GetBatchCount() const { return static_cast<uint32_t>(m_Batches.size()); }
+
+private:
+  struct Batch
+  {
+    vk::DescriptorSet m_DescriptorSet;
+    uint32_t m_FirstSprite;
+    uint32_t m_SpriteCount;
+  };
+
+  void CreatePipeline();
+  void AddToBatch(vk::DescriptorSet descriptorSet, uint32_t count);
+
+  VulkanRenderer* m_Renderer;
+  vk::Pipeline m_Pipeline;
+  Sprite* m_Sprites;
+  vk::Buffer m_InstanceBuffer;
+  vk::DeviceSize m_InstanceOffset;
+  uint32_t m_SpriteCount;
+  uint32_t m_Capacity;
+  std::vector<Batch> m_Batches;
+};
+} // namespace Core
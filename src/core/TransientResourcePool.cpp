@@ -0,0 +1,259 @@
+#include "TransientResourcePool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <sstream>
+
+#include "utils/Logger.h"
+
+namespace Core {
+bool operator==(TransientImageDesc const& lhs, TransientImageDesc const& rhs)
+{
+  return lhs.m_Width == rhs.m_Width && lhs.m_Height == rhs.m_Height && lhs.m_Format == rhs.m_Format
+         && lhs.m_Usage == rhs.m_Usage && lhs.m_InitialLayout == rhs.m_InitialLayout;
+}
+
+TransientResourcePool::TransientResourcePool(VulkanRenderer* renderer) :
+  m_Renderer(renderer),
+  m_Declarations(std::vector<Declaration>()),
+  m_CompiledDeclarations(std::vector<Declaration>()),
+  m_PlacedImages(std::vector<PlacedImage>()),
+  m_Allocation(MemoryAllocation()),
+  m_AliasedSize(0),
+  m_UnaliasedSize(0)
+{}
+
+TransientResourcePool::~TransientResourcePool()
+{
+  DestroyImages();
+}
+
+TransientImageId TransientResourcePool::DeclareImage(TransientImageDesc const& desc,
+                                                     uint32_t firstPass,
+                                                     uint32_t lastPass)
+{
+  assert(firstPass <= lastPass);
+  m_Declarations.push_back(Declaration{ desc, firstPass, lastPass });
+  return static_cast<TransientImageId>(m_Declarations.size() - 1);
+}
+
+void TransientResourcePool::Compile()
+{
+  bool unchanged = m_Declarations.size() == m_CompiledDeclarations.size()
+                   && std::equal(m_Declarations.cbegin(),
+                                 m_Declarations.cend(),
+                                 m_CompiledDeclarations.cbegin(),
+                                 [](Declaration const& lhs, Declaration const& rhs) {
+                                   return lhs.m_Desc == rhs.m_Desc && lhs.m_FirstPass == rhs.m_FirstPass
+                                          && lhs.m_LastPass == rhs.m_LastPass;
+                                 });
+  if (unchanged) { return; }
+
+  // The pool belongs to a single frame resource whose fence has already been waited on, nothing uses the old images
+  DestroyImages();
+  m_CompiledDeclarations = m_Declarations;
+  if (m_CompiledDeclarations.empty()) { return; }
+
+  vk::Device device = m_Renderer->GetDevice();
+  bool attachmentsOnly = true;
+  vk::MemoryRequirements combinedRequirements = vk::MemoryRequirements(0, 1, ~0u);
+
+  m_PlacedImages.resize(m_CompiledDeclarations.size());
+  for (uint32_t idx = 0; idx != m_CompiledDeclarations.size(); ++idx) {
+    TransientImageDesc const& desc = m_CompiledDeclarations[idx].m_Desc;
+    vk::ImageUsageFlags usage = desc.m_Usage;
+    if (IsAttachmentOnly(usage)) {
+      usage |= vk::ImageUsageFlagBits::eTransientAttachment;
+    } else {
+      attachmentsOnly = false;
+    }
+
+    auto imageCreateInfo = vk::ImageCreateInfo(
+      {},                                           // vk::ImageCreateFlags flags_ = {},
+      vk::ImageType::e2D,                           // vk::ImageType imageType_ = vk::ImageType::e1D,
+      desc.m_Format,                                // vk::Format format_ = vk::Format::eUndefined,
+      vk::Extent3D(desc.m_Width, desc.m_Height, 1), // vk::Extent3D extent_ = {},
+      1,                                            // uint32_t mipLevels_ = {},
+      1,                                            // uint32_t arrayLayers_ = {},
+      vk::SampleCountFlagBits::e1,                  // vk::SampleCountFlagBits samples_ = vk::SampleCountFlagBits::e1,
+      vk::ImageTiling::eOptimal,                    // vk::ImageTiling tiling_ = vk::ImageTiling::eOptimal,
+      usage,                                        // vk::ImageUsageFlags usage_ = {},
+      vk::SharingMode::eExclusive,                  // vk::SharingMode sharingMode_ = vk::SharingMode::eExclusive,
+      0,                                            // uint32_t queueFamilyIndexCount_ = {},
+      nullptr,                                      // const uint32_t* pQueueFamilyIndices_ = {},
+      vk::ImageLayout::eUndefined                   // vk::ImageLayout initialLayout_ = vk::ImageLayout::eUndefined
+    );
+
+    PlacedImage& placedImage = m_PlacedImages[idx];
+    placedImage.m_Image = ImageData();
+    placedImage.m_Framebuffer = nullptr;
+    placedImage.m_FramebufferRenderPass = nullptr;
+    placedImage.m_Image.m_Handle = device.createImage(imageCreateInfo);
+    placedImage.m_Image.m_Width = desc.m_Width;
+    placedImage.m_Image.m_Height = desc.m_Height;
+    placedImage.m_Image.m_Format = desc.m_Format;
+    placedImage.m_Image.m_Usage = usage;
+
+    vk::MemoryRequirements requirements = device.getImageMemoryRequirements(placedImage.m_Image.m_Handle);
+    placedImage.m_Size = (requirements.size + requirements.alignment - 1) & ~(requirements.alignment - 1);
+    combinedRequirements.alignment = std::max(combinedRequirements.alignment, requirements.alignment);
+    combinedRequirements.memoryTypeBits &= requirements.memoryTypeBits;
+  }
+
+  // Greedy placement, largest first: every image goes to the lowest offset that does not collide with an already
+  // placed image whose lifetime overlaps its own
+  std::vector<uint32_t> placementOrder(m_PlacedImages.size());
+  std::iota(placementOrder.begin(), placementOrder.end(), 0);
+  std::sort(placementOrder.begin(), placementOrder.end(), [this](uint32_t lhs, uint32_t rhs) {
+    return m_PlacedImages[lhs].m_Size > m_PlacedImages[rhs].m_Size;
+  });
+
+  m_AliasedSize = 0;
+  m_UnaliasedSize = 0;
+  for (uint32_t orderIdx = 0; orderIdx != placementOrder.size(); ++orderIdx) {
+    uint32_t idx = placementOrder[orderIdx];
+    Declaration const& declaration = m_CompiledDeclarations[idx];
+
+    std::vector<uint32_t> conflicts;
+    for (uint32_t placedIdx = 0; placedIdx != orderIdx; ++placedIdx) {
+      Declaration const& other = m_CompiledDeclarations[placementOrder[placedIdx]];
+      if (declaration.m_FirstPass <= other.m_LastPass && other.m_FirstPass <= declaration.m_LastPass) {
+        conflicts.push_back(placementOrder[placedIdx]);
+      }
+    }
+    std::sort(conflicts.begin(), conflicts.end(), [this](uint32_t lhs, uint32_t rhs) {
+      return m_PlacedImages[lhs].m_Offset < m_PlacedImages[rhs].m_Offset;
+    });
+
+    vk::DeviceSize offset = 0;
+    for (uint32_t conflictIdx : conflicts) {
+      PlacedImage const& conflict = m_PlacedImages[conflictIdx];
+      if (offset + m_PlacedImages[idx].m_Size <= conflict.m_Offset) { break; }
+      offset = std::max(offset, conflict.m_Offset + conflict.m_Size);
+      offset = (offset + combinedRequirements.alignment - 1) & ~(combinedRequirements.alignment - 1);
+    }
+
+    m_PlacedImages[idx].m_Offset = offset;
+    m_AliasedSize = std::max(m_AliasedSize, offset + m_PlacedImages[idx].m_Size);
+    m_UnaliasedSize += m_PlacedImages[idx].m_Size;
+  }
+
+  combinedRequirements.size = m_AliasedSize;
+  if (attachmentsOnly) {
+    m_Allocation = m_Renderer->AllocateMemory(combinedRequirements,
+                                          { vk::MemoryPropertyFlagBits::eDeviceLocal
+                                            | vk::MemoryPropertyFlagBits::eLazilyAllocated },
+                                          MemoryResourceKind::Image);
+  }
+  if (!m_Allocation.m_Memory) {
+    m_Allocation = m_Renderer->AllocateMemory(
+      combinedRequirements, { vk::MemoryPropertyFlagBits::eDeviceLocal }, MemoryResourceKind::Image);
+  }
+  if (!m_Allocation.m_Memory) { throw std::runtime_error("Could not allocate device memory for transient images"); }
+
+  for (uint32_t idx = 0; idx != m_PlacedImages.size(); ++idx) {
+    ImageData& image = m_PlacedImages[idx].m_Image;
+    image.m_Memory = m_Allocation.m_Memory;
+    device.bindImageMemory(image.m_Handle, m_Allocation.m_Memory, m_Allocation.m_Offset + m_PlacedImages[idx].m_Offset);
+
+    auto imageViewCreateInfo = vk::ImageViewCreateInfo(
+      {},                     // vk::ImageViewCreateFlags flags_ = {},
+      image.m_Handle,         // vk::Image image_ = {},
+      vk::ImageViewType::e2D, // vk::ImageViewType viewType_ = vk::ImageViewType::e1D,
+      image.m_Format,         // vk::Format format_ = vk::Format::eUndefined,
+      vk::ComponentMapping(vk::ComponentSwizzle::eIdentity,
+                           vk::ComponentSwizzle::eIdentity,
+                           vk::ComponentSwizzle::eIdentity,
+                           vk::ComponentSwizzle::eIdentity), // vk::ComponentMapping components_ = {},
+      vk::ImageSubresourceRange(GetAspectFlags(image.m_Format), 0, 1, 0, 1) // vk::ImageSubresourceRange
+                                                                              // subresourceRange_ = {}
+    );
+    image.m_View = device.createImageView(imageViewCreateInfo);
+  }
+
+  std::ostringstream debugOutput;
+  debugOutput << m_PlacedImages.size() << " transient image(s) placed into " << m_AliasedSize << " bytes instead of "
+              << m_UnaliasedSize << " bytes" << (attachmentsOnly ? ", lazily allocated if supported" : "");
+  Utils::Logger::Get().LogDebugEx(
+    "Transient images compiled", "Renderer", __FILE__, __func__, __LINE__, debugOutput.str());
+}
+
+void TransientResourcePool::Reset()
+{
+  m_Declarations.clear();
+}
+
+ImageData const& TransientResourcePool::GetImage(TransientImageId id) const
+{
+  assert(id < m_PlacedImages.size());
+  return m_PlacedImages[id].m_Image;
+}
+
+vk::Framebuffer TransientResourcePool::GetFramebuffer(TransientImageId id, vk::RenderPass renderPass)
+{
+  assert(id < m_PlacedImages.size());
+  PlacedImage& placedImage = m_PlacedImages[id];
+  if (placedImage.m_Framebuffer) {
+    // Compatible render passes could share it, but the renderer only has a single one anyway
+    assert(placedImage.m_FramebufferRenderPass == renderPass);
+    return placedImage.m_Framebuffer;
+  }
+
+  auto framebufferCreateInfo =
+    vk::FramebufferCreateInfo({},                           // vk::FramebufferCreateFlags flags_ = {},
+                              renderPass,                   // vk::RenderPass renderPass_ = {},
+                              1,                            // uint32_t attachmentCount_ = {},
+                              &placedImage.m_Image.m_View,  // const vk::ImageView* pAttachments_ = {},
+                              placedImage.m_Image.m_Width,  // uint32_t width_ = {},
+                              placedImage.m_Image.m_Height, // uint32_t height_ = {},
+                              1                             // uint32_t layers_ = {}
+    );
+  placedImage.m_Framebuffer = m_Renderer->GetDevice().createFramebuffer(framebufferCreateInfo);
+  placedImage.m_FramebufferRenderPass = renderPass;
+  return placedImage.m_Framebuffer;
+}
+
+bool TransientResourcePool::IsAttachmentOnly(vk::ImageUsageFlags usage)
+{
+  vk::ImageUsageFlags const attachmentUsage = vk::ImageUsageFlagBits::eColorAttachment
+                                              | vk::ImageUsageFlagBits::eDepthStencilAttachment
+                                              | vk::ImageUsageFlagBits::eInputAttachment;
+  return (usage & ~attachmentUsage) == vk::ImageUsageFlags();
+}
+
+vk::ImageAspectFlags TransientResourcePool::GetAspectFlags(vk::Format format)
+{
+  switch (format) {
+  case vk::Format::eD16Unorm:
+  case vk::Format::eX8D24UnormPack32:
+  case vk::Format::eD32Sfloat:
+    return vk::ImageAspectFlagBits::eDepth;
+  case vk::Format::eD16UnormS8Uint:
+  case vk::Format::eD24UnormS8Uint:
+  case vk::Format::eD32SfloatS8Uint:
+    return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+  case vk::Format::eS8Uint:
+    return vk::ImageAspectFlagBits::eStencil;
+  default:
+    return vk::ImageAspectFlagBits::eColor;
+  }
+}
+
+void TransientResourcePool::DestroyImages()
+{
+  vk::Device device = m_Renderer->GetDevice();
+  for (auto& placedImage : m_PlacedImages) {
+    if (placedImage.m_Framebuffer) { device.destroyFramebuffer(placedImage.m_Framebuffer); }
+    if (placedImage.m_Image.m_View) { device.destroyImageView(placedImage.m_Image.m_View); }
+    if (placedImage.m_Image.m_Handle) { device.destroyImage(placedImage.m_Image.m_Handle); }
+  }
+  m_PlacedImages.clear();
+  m_CompiledDeclarations.clear();
+
+  m_Renderer->FreeMemory(m_Allocation);
+  m_Allocation = MemoryAllocation();
+  m_AliasedSize = 0;
+  m_UnaliasedSize = 0;
+}
+} // namespace Core
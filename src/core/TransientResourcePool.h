@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "VulkanRenderer.h"
+
+namespace Core {
+
+struct TransientImageDesc
+{
+  uint32_t m_Width;
+  uint32_t m_Height;
+  vk::Format m_Format;
+  vk::ImageUsageFlags m_Usage;
+  // Layout the image is expected in when its first pass begins, the previous contents are always discarded
+  vk::ImageLayout m_InitialLayout;
+};
+
+bool operator==(TransientImageDesc const& lhs, TransientImageDesc const& rhs);
+
+typedef uint32_t TransientImageId;
+
+// Per frame pool of images that only live between two passes of the frame. The passes declare their intermediate
+// images every frame together with the index of the first and last pass using them, Compile() then places images with
+// non-overlapping lifetimes onto the same memory range. Declarations that match the previous frame reuse the images
+// created back then.
+//
+// Images that are only ever used as attachments get eTransientAttachment usage and lazily allocated memory where the
+// device supports it, so tilers never have to back them with real memory at all.
+class TransientResourcePool
+{
+public:
+  TransientResourcePool(VulkanRenderer* renderer);
+  TransientResourcePool(TransientResourcePool const& other) = delete;
+  TransientResourcePool& operator=(TransientResourcePool const& other) = delete;
+  ~TransientResourcePool();
+
+  TransientImageId DeclareImage(TransientImageDesc const& desc, uint32_t firstPass, uint32_t lastPass);
+  void Compile();
+  void Reset();
+
+  ImageData const& GetImage(TransientImageId id) const;
+  // Framebuffer with the image as its only attachment, created on first use and destroyed together with the image, so
+  // it survives as long as the declarations stay the same
+  vk::Framebuffer GetFramebuffer(TransientImageId id, vk::RenderPass renderPass);
+  inline vk::DeviceSize GetAliasedSize() const { return m_AliasedSize; }
+  inline vk::DeviceSize GetUnaliasedSize() const { return m_UnaliasedSize; }
+
+  static vk::ImageAspectFlags GetAspectFlags(vk::Format format);
+
+private:
+  struct Declaration
+  {
+    TransientImageDesc m_Desc;
+    uint32_t m_FirstPass;
+    uint32_t m_LastPass;
+  };
+
+  struct PlacedImage
+  {
+    ImageData m_Image;
+    vk::DeviceSize m_Offset;
+    vk::DeviceSize m_Size;
+    vk::Framebuffer m_Framebuffer;
+    vk::RenderPass m_FramebufferRenderPass;
+  };
+
+  static bool IsAttachmentOnly(vk::ImageUsageFlags usage);
+  void DestroyImages();
+
+  VulkanRenderer* m_Renderer;
+  std::vector<Declaration> m_Declarations;
+  std::vector<Declaration> m_CompiledDeclarations;
+  std::vector<PlacedImage> m_PlacedImages;
+  MemoryAllocation m_Allocation;
+  vk::DeviceSize m_AliasedSize;
+  vk::DeviceSize m_UnaliasedSize;
+};
+} // namespace Core
@@ -0,0 +1,64 @@
+#include "UploadArena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace Core {
+UploadArena::UploadArena(VulkanRenderer* renderer, vk::DeviceSize capacity) :
+  m_Renderer(renderer),
+  m_Buffer(BufferData()),
+  m_MappedPtr(nullptr),
+  m_Capacity(capacity),
+  m_BytesInUse(0),
+  m_UniformAlignment(renderer->GetMinUniformBufferOffsetAlignment())
+{
+  m_Buffer = m_Renderer->CreateBuffer(m_Capacity,
+                                      { vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eVertexBuffer
+                                        | vk::BufferUsageFlagBits::eIndexBuffer
+                                        | vk::BufferUsageFlagBits::eIndirectBuffer },
+                                      { vk::MemoryPropertyFlagBits::eHostVisible
+                                        | vk::MemoryPropertyFlagBits::eHostCoherent });
+  m_Renderer->SetDebugName(m_Buffer, "Upload arena");
+
+  // Coherent memory is made available to the device by the queue submission itself, so no flushes are needed. The
+  // block is persistently mapped by the memory allocator.
+  m_MappedPtr = reinterpret_cast<uint8_t*>(m_Buffer.m_Allocation.m_MappedPtr);
+}
+
+UploadArena::~UploadArena()
+{
+  m_MappedPtr = nullptr;
+  m_Renderer->FreeBuffer(m_Buffer);
+}
+
+UploadAllocation UploadArena::Allocate(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+  assert((alignment & (alignment - 1)) == 0 && alignment != 0);
+  vk::DeviceSize alignedOffset = (m_BytesInUse + alignment - 1) & ~(alignment - 1);
+  if (alignedOffset + size > m_Capacity) { throw std::runtime_error("Upload arena is out of memory"); }
+
+  m_BytesInUse = alignedOffset + size;
+  return UploadAllocation{ m_MappedPtr + alignedOffset, m_Buffer.m_Handle, alignedOffset, size };
+}
+
+UploadAllocation UploadArena::AllocateUniform(vk::DeviceSize size)
+{
+  return Allocate(size, m_UniformAlignment);
+}
+
+UploadAllocation UploadArena::AllocateVertices(vk::DeviceSize size)
+{
+  return Allocate(size, VERTEX_ALIGNMENT);
+}
+
+UploadAllocation UploadArena::AllocateIndirect(vk::DeviceSize size)
+{
+  return Allocate(size, INDIRECT_ALIGNMENT);
+}
+
+void UploadArena::Reset()
+{
+  m_BytesInUse = 0;
+}
+} // namespace Core
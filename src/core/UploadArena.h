@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include "VulkanRenderer.h"
+
+namespace Core {
+
+struct UploadAllocation
+{
+  void* m_Ptr;
+  vk::Buffer m_Buffer;
+  vk::DeviceSize m_Offset;
+  vk::DeviceSize m_Size;
+};
+
+// Persistently mapped, host visible linear allocator owned by a single frame resource. Allocations are only valid until
+// the arena is reset, which happens when the owning frame's fence has signaled and the GPU is done reading them.
+class UploadArena
+{
+public:
+  UploadArena(VulkanRenderer* renderer, vk::DeviceSize capacity);
+  UploadArena(UploadArena const& other) = delete;
+  UploadArena& operator=(UploadArena const& other) = delete;
+  ~UploadArena();
+
+  UploadAllocation Allocate(vk::DeviceSize size, vk::DeviceSize alignment);
+  UploadAllocation AllocateUniform(vk::DeviceSize size);
+  UploadAllocation AllocateVertices(vk::DeviceSize size);
+  UploadAllocation AllocateIndirect(vk::DeviceSize size);
+  void Reset();
+
+  inline vk::Buffer GetBuffer() const { return m_Buffer.m_Handle; }
+  inline vk::DeviceSize GetCapacity() const { return m_Capacity; }
+  inline vk::DeviceSize GetBytesInUse() const { return m_BytesInUse; }
+
+private:
+  static constexpr vk::DeviceSize VERTEX_ALIGNMENT = 16;
+  static constexpr vk::DeviceSize INDIRECT_ALIGNMENT = 4;
+
+  VulkanRenderer* m_Renderer;
+  BufferData m_Buffer;
+  uint8_t* m_MappedPtr;
+  vk::DeviceSize m_Capacity;
+  vk::DeviceSize m_BytesInUse;
+  vk::DeviceSize m_UniformAlignment;
+};
+} // namespace Core
@@ -2,10 +2,20 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <sstream>
 #include <vector>
 
+#include "CommandStreamRecorder.h"
+#include "FrameCommandAllocator.h"
+#include "RenderGraph.h"
+#include "SharedBufferPool.h"
+#include "TransientResourcePool.h"
+#include "UploadArena.h"
 #include "VulkanFunctions.h"
 #include "os/Common.h"
 #include "os/Window.h"
@@ -21,19 +31,25 @@ VulkanParameters::VulkanParameters() :
   m_Device(nullptr),
   m_GraphicsQueue(nullptr),
   m_TransferQueue(nullptr),
+  m_ComputeQueue(nullptr),
   m_GraphicsQueueFamilyIdx(std::numeric_limits<QueueFamilyIdx>::max()),
   m_TransferQueueFamilyIdx(std::numeric_limits<QueueFamilyIdx>::max()),
+  m_ComputeQueueFamilyIdx(std::numeric_limits<QueueFamilyIdx>::max()),
   m_PresentSurface(nullptr),
   m_SurfaceCapabilities(vk::SurfaceCapabilitiesKHR()),
   m_Swapchain(Swapchain()),
-  m_VsyncEnabled(false),
+  m_PresentMode(vk::PresentModeKHR::eFifo),
   m_RenderPass(nullptr),
   m_Pipeline(nullptr),
   m_PipelineLayout(nullptr),
   m_TimestampPeriod(0),
+  m_PipelineStatisticsSupported(false),
+  m_MultiDrawIndirectSupported(false),
+  m_DrawIndirectCountSupported(false),
+  m_DrawIndirectFirstInstanceSupported(false),
   m_DescriptorSetLayout(nullptr),
   m_DescriptorPool(nullptr),
-  m_DescriptorSet(nullptr)
+  m_DescriptorSets(std::vector<vk::DescriptorSet>())
 {}
 
 VulkanRenderer::VulkanRenderer(bool vsyncEnabled, uint32_t frameResourcesCount) :
@@ -41,13 +57,31 @@ VulkanRenderer::VulkanRenderer(bool vsyncEnabled, uint32_t frameResourcesCount)
   m_CanRender(false),
   m_IsRunning(true),
   m_WindowParameters(Os::WindowParameters()),
+  m_IsHeadless(false),
+  m_HeadlessExtent(vk::Extent2D()),
   m_CurrentResourceIdx(0),
+  m_FrameCounter(0),
+  m_CompletedFrameCount(0),
   m_FrameResourcesCount(frameResourcesCount),
   m_FrameStat(FrameStat()),
   m_GraphicsQueueSubmitCriticalSection(std::mutex()),
-  m_TransferQueueSubmitCriticalSection(std::mutex())
+  m_TransferQueueSubmitCriticalSection(std::mutex()),
+  m_SharedBufferPool(nullptr),
+  m_CommandStreamRecorder(nullptr),
+  m_ResourceTableCriticalSection(std::mutex()),
+  m_RegisteredBuffers(std::vector<RegisteredBuffer>()),
+  m_RegisteredImages(std::vector<RegisteredImage>()),
+  m_ResourceGeneration(0),
+  m_ImageDescriptorSampler(nullptr),
+  m_ImageDescriptorImage(ImageHandle()),
+  m_ImageDescriptorVersion(0),
+  m_DefragmentationBudgetInMs(0.0),
+  m_FramePacingCriticalSection(std::mutex()),
+  m_FramePacing(FramePacing()),
+  m_FramePacingChanged(false)
 {
-  m_VulkanParameters.m_VsyncEnabled = vsyncEnabled;
+  m_VulkanParameters.m_PresentMode = vsyncEnabled ? vk::PresentModeKHR::eMailbox : vk::PresentModeKHR::eImmediate;
+  m_FramePacing = FramePacing{ m_FrameResourcesCount, m_VulkanParameters.m_PresentMode, 0.0 };
 }
 
 void VulkanRenderer::Free()
@@ -71,6 +105,10 @@ void VulkanRenderer::Free()
       FreeFrameResource(m_FrameResources[i]);
     }
 
+    for (uint32_t i = 0; i != m_RetiredResources.size(); ++i) {
+      FreeRetiredResources(i);
+    }
+
     if (m_VulkanParameters.m_PipelineLayout) {
       m_VulkanParameters.m_Device.destroyPipelineLayout(m_VulkanParameters.m_PipelineLayout);
     }
@@ -82,18 +120,16 @@ void VulkanRenderer::Free()
       m_VulkanParameters.m_RenderPass = nullptr;
     }
 
-    for (auto& imageView : m_VulkanParameters.m_Swapchain.m_ImageViews) {
-      m_VulkanParameters.m_Device.destroyImageView(imageView);
-    }
-
-    if (m_VulkanParameters.m_Swapchain.m_Handle) {
-      m_VulkanParameters.m_Device.destroySwapchainKHR(m_VulkanParameters.m_Swapchain.m_Handle);
-    }
+    FreeRetiredSwapchains(true);
+    DestroySwapchain(m_VulkanParameters.m_Swapchain);
 
+    m_SharedBufferPool.reset();
+    m_MemoryAllocator.Destroy();
     m_VulkanParameters.m_Device.destroy();
     m_VulkanParameters.m_Device = nullptr;
     m_VulkanParameters.m_GraphicsQueue = nullptr;
     m_VulkanParameters.m_TransferQueue = nullptr;
+    m_VulkanParameters.m_ComputeQueue = nullptr;
   }
 
   if (m_VulkanParameters.m_PresentSurface) {
@@ -148,12 +184,14 @@ bool VulkanRenderer::Initialize(Os::WindowParameters windowParameters)
   debugOutput.str(std::string());
   debugOutput.clear();
 
-  std::vector<char const*> const requiredExtensions = { VK_KHR_SURFACE_EXTENSION_NAME,
-                                                        VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
+  std::vector<char const*> requiredExtensions = { VK_KHR_SURFACE_EXTENSION_NAME, VK_EXT_DEBUG_UTILS_EXTENSION_NAME };
+  if (m_IsHeadless) {
+    requiredExtensions.push_back(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME);
+  } else {
 #ifdef VK_USE_PLATFORM_WIN32_KHR
-                                                        VK_KHR_WIN32_SURFACE_EXTENSION_NAME
+    requiredExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 #endif
-  };
+  }
 
   if (!RequiredInstanceExtensionsAvailable(requiredExtensions)) {
     throw std::runtime_error("Required instance extensions are not available");
@@ -183,27 +221,51 @@ bool VulkanRenderer::Initialize(Os::WindowParameters windowParameters)
 
   if (!CreateDevice()) { return false; }
 
+  m_MemoryAllocator.Initialize(m_VulkanParameters.m_Device, m_VulkanParameters.m_PhysicalDevice);
+
   if (!CreateGraphicsQueue()) { return false; }
 
   if (!CreateTransferQueue()) { return false; }
 
+  if (!CreateComputeQueue()) { return false; }
+
   if (!CreateSwapchain()) { return false; }
 
   if (!CreateDescriptorSetLayout()) { return false; }
 
   if (!CreateDescriptorPool()) { return false; }
 
-  if (!AllocateDescriptorSet()) { return false; }
+  if (!AllocateDescriptorSets()) { return false; }
 
   if (!CreateRenderPass()) { return false; }
 
+  if (!CreateSwapchainFramebuffers()) { return false; }
+
   if (!CreatePipeline()) { return false; }
 
   if (!CreateQueryPool()) { return false; }
 
+  m_SharedBufferPool = std::make_unique<SharedBufferPool>(this);
+
   return true;
 }
 
+bool VulkanRenderer::InitializeHeadless(vk::Extent2D extent)
+{
+  m_IsHeadless = true;
+  m_HeadlessExtent = extent;
+
+  // Nothing waits for a display, let the frames through as fast as possible. Falls back to FIFO where the surface
+  // does not support it, which headless surfaces do not throttle either.
+  m_VulkanParameters.m_PresentMode = vk::PresentModeKHR::eImmediate;
+  {
+    std::lock_guard<std::mutex> lock(m_FramePacingCriticalSection);
+    m_FramePacing.m_PresentMode = m_VulkanParameters.m_PresentMode;
+  }
+
+  return Initialize(Os::WindowParameters());
+}
+
 uint32_t VulkanRenderer::GetVulkanImplementationVersion() const
 {
   return vk::enumerateInstanceVersion();
@@ -266,6 +328,14 @@ bool VulkanRenderer::CreateInstance(std::vector<char const*> const& requiredExte
 
 bool VulkanRenderer::CreatePresentationSurface()
 {
+  if (m_IsHeadless) {
+    auto surfaceCreateInfo = vk::HeadlessSurfaceCreateInfoEXT({} // vk::HeadlessSurfaceCreateFlagsEXT flags_ = {}
+    );
+
+    m_VulkanParameters.m_PresentSurface = m_VulkanParameters.m_Instance.createHeadlessSurfaceEXT(surfaceCreateInfo);
+    return true;
+  }
+
 #ifdef VK_USE_PLATFORM_WIN32_KHR
   auto surfaceCreateInfo = vk::Win32SurfaceCreateInfoKHR({}, // vk::Win32SurfaceCreateFlagsKHR flags_ = {}, reserved
                                                          m_WindowParameters.m_Instance, // HINSTANCE hinstance_ = {},
@@ -328,6 +398,7 @@ bool VulkanRenderer::CreateDevice()
 
   bool presentQueueFound = false;
   bool transferQueueFound = false;
+  bool computeQueueFound = false;
   std::ostringstream debugOutput;
 
   for (decltype(physicalDevices)::size_type deviceIdx = 0; deviceIdx != physicalDevices.size(); ++deviceIdx) {
@@ -442,6 +513,13 @@ bool VulkanRenderer::CreateDevice()
           m_VulkanParameters.m_TransferQueueFamilyIdx = static_cast<VulkanParameters::QueueFamilyIdx>(queueFamilyIdx);
           transferQueueFound = true;
         }
+
+        // A family without graphics is scheduled independently, its work can overlap the graphics queue
+        if ((currentQueueFlags & vk::QueueFlagBits::eCompute) && !(currentQueueFlags & vk::QueueFlagBits::eGraphics)
+            && !computeQueueFound) {
+          m_VulkanParameters.m_ComputeQueueFamilyIdx = static_cast<VulkanParameters::QueueFamilyIdx>(queueFamilyIdx);
+          computeQueueFound = true;
+        }
       }
     }
   }
@@ -452,19 +530,57 @@ bool VulkanRenderer::CreateDevice()
     m_VulkanParameters.m_TransferQueueFamilyIdx = m_VulkanParameters.m_GraphicsQueueFamilyIdx;
   }
 
+  // Graphics families always support compute
+  if (presentQueueFound && !computeQueueFound) {
+    m_VulkanParameters.m_ComputeQueueFamilyIdx = m_VulkanParameters.m_GraphicsQueueFamilyIdx;
+  }
+
+  // Pipeline statistics are optional, the frame stats simply go without them where the device lacks support. The
+  // query spans the whole frame, so secondary command buffers executed inside it need the queries to be inherited.
+  vk::PhysicalDeviceFeatures supportedFeatures = m_VulkanParameters.m_PhysicalDevice.getFeatures();
+  vk::PhysicalDeviceFeatures enabledFeatures = vk::PhysicalDeviceFeatures();
+  m_VulkanParameters.m_PipelineStatisticsSupported =
+    supportedFeatures.pipelineStatisticsQuery == VK_TRUE && supportedFeatures.inheritedQueries == VK_TRUE;
+  enabledFeatures.pipelineStatisticsQuery = m_VulkanParameters.m_PipelineStatisticsSupported;
+  enabledFeatures.inheritedQueries = m_VulkanParameters.m_PipelineStatisticsSupported;
+
+  // All of them are optional for GPU driven draws, which fall back to one indirect draw per command without them.
+  // Without drawIndirectFirstInstance the commands have to start at instance 0. The 1.2 features may only be queried
+  // and chained on a 1.2 device.
+  m_VulkanParameters.m_MultiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE;
+  enabledFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+  m_VulkanParameters.m_DrawIndirectFirstInstanceSupported = supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
+  enabledFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+  bool isVulkan12Device = m_VulkanParameters.m_PhysicalDevice.getProperties().apiVersion >= VK_API_VERSION_1_2;
+  auto enabledVulkan12Features = vk::PhysicalDeviceVulkan12Features();
+  if (isVulkan12Device) {
+    auto supportedFeatureChain =
+      m_VulkanParameters.m_PhysicalDevice
+        .getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+    enabledVulkan12Features.drawIndirectCount =
+      supportedFeatureChain.get<vk::PhysicalDeviceVulkan12Features>().drawIndirectCount;
+  }
+  m_VulkanParameters.m_DrawIndirectCountSupported = enabledVulkan12Features.drawIndirectCount == VK_TRUE;
+
   std::vector<float> const queuePriorities = { 1.0f };
 
-  auto queueCreateInfos = std::vector<vk::DeviceQueueCreateInfo>(
-    { vk::DeviceQueueCreateInfo({},                                          // vk::DeviceQueueCreateFlags flags_ = {},
-                                m_VulkanParameters.m_GraphicsQueueFamilyIdx, // uint32_t queueFamilyIndex_ = {},
-                                static_cast<uint32_t>(queuePriorities.size()), // uint32_t queueCount_ = {},
-                                queuePriorities.data()                         // const float* pQueuePriorities_ = {}
-                                ),
-      vk::DeviceQueueCreateInfo({},                                          // vk::DeviceQueueCreateFlags flags_ = {},
-                                m_VulkanParameters.m_TransferQueueFamilyIdx, // uint32_t queueFamilyIndex_ = {},
+  // A family may only be listed once, the fallbacks above share the graphics family
+  auto queueCreateInfos = std::vector<vk::DeviceQueueCreateInfo>();
+  for (VulkanParameters::QueueFamilyIdx queueFamilyIdx : { m_VulkanParameters.m_GraphicsQueueFamilyIdx,
+                                                           m_VulkanParameters.m_TransferQueueFamilyIdx,
+                                                           m_VulkanParameters.m_ComputeQueueFamilyIdx }) {
+    auto sameFamily = [queueFamilyIdx](vk::DeviceQueueCreateInfo const& queueCreateInfo) {
+      return queueCreateInfo.queueFamilyIndex == queueFamilyIdx;
+    };
+    if (std::any_of(queueCreateInfos.cbegin(), queueCreateInfos.cend(), sameFamily)) { continue; }
+
+    queueCreateInfos.push_back(
+      vk::DeviceQueueCreateInfo({},             // vk::DeviceQueueCreateFlags flags_ = {},
+                                queueFamilyIdx, // uint32_t queueFamilyIndex_ = {},
                                 static_cast<uint32_t>(queuePriorities.size()), // uint32_t queueCount_ = {},
-                                queuePriorities.data()                         // const float* pQueuePriorities_ = {}
-                                ) });
+                                queuePriorities.data() // const float* pQueuePriorities_ = {}
+                                ));
+  }
 
   auto deviceCreateInfo = vk::DeviceCreateInfo(
     {},                                                     // vk::DeviceCreateFlags flags_ = {}, reserved
@@ -474,8 +590,9 @@ bool VulkanRenderer::CreateDevice()
     nullptr,                                                // const char* const* ppEnabledLayerNames_ = {},
     static_cast<uint32_t>(requiredDeviceExtensions.size()), // uint32_t enabledExtensionCount_ = {},
     requiredDeviceExtensions.data(),                        // const char* const* ppEnabledExtensionNames_ = {},
-    nullptr                                                 // const vk::PhysicalDeviceFeatures* pEnabledFeatures_ = {}
+    &enabledFeatures                                        // const vk::PhysicalDeviceFeatures* pEnabledFeatures_ = {}
   );
+  if (isVulkan12Device) { deviceCreateInfo.setPNext(&enabledVulkan12Features); }
 
   m_VulkanParameters.m_Device = m_VulkanParameters.m_PhysicalDevice.createDevice(deviceCreateInfo);
   VULKAN_HPP_DEFAULT_DISPATCHER.init(m_VulkanParameters.m_Device);
@@ -505,19 +622,15 @@ vk::PresentModeKHR VulkanRenderer::GetSwapchainPresentMode(
            != supportedPresentationModes.cend();
   };
 
-  if (m_VulkanParameters.m_VsyncEnabled && presentModeSupported(vk::PresentModeKHR::eMailbox)) {
-    return vk::PresentModeKHR::eMailbox;
-  }
+  if (presentModeSupported(m_VulkanParameters.m_PresentMode)) { return m_VulkanParameters.m_PresentMode; }
 
-  if (m_VulkanParameters.m_VsyncEnabled && presentModeSupported(vk::PresentModeKHR::eFifo)) {
-    return vk::PresentModeKHR::eFifo;
-  }
-
-  if (!m_VulkanParameters.m_VsyncEnabled && presentModeSupported(vk::PresentModeKHR::eImmediate)) {
-    return vk::PresentModeKHR::eImmediate;
+  // Immediate stays non-blocking with mailbox, everything else ends up on FIFO, which every device supports
+  if (m_VulkanParameters.m_PresentMode == vk::PresentModeKHR::eImmediate
+      && presentModeSupported(vk::PresentModeKHR::eMailbox)) {
+    return vk::PresentModeKHR::eMailbox;
   }
 
-  return supportedPresentationModes[0];
+  return vk::PresentModeKHR::eFifo;
 }
 
 uint32_t VulkanRenderer::GetSwapchainImageCount() const
@@ -557,6 +670,9 @@ vk::SurfaceFormatKHR VulkanRenderer::GetSwapchainFormat(
 
 vk::Extent2D VulkanRenderer::GetSwapchainExtent() const
 {
+  // Headless surfaces report no current extent, the swapchain size is up to us
+  if (m_IsHeadless) { return m_HeadlessExtent; }
+
   RECT currentRect;
   GetClientRect(m_WindowParameters.m_Handle, &currentRect);
   return vk::Extent2D(static_cast<uint32_t>(currentRect.right - currentRect.left),
@@ -713,6 +829,23 @@ bool VulkanRenderer::CreateTransferQueue()
   return true;
 }
 
+vk::QueryPipelineStatisticFlags VulkanRenderer::GetPipelineStatisticFlags() const
+{
+  if (!m_VulkanParameters.m_PipelineStatisticsSupported) { return {}; }
+
+  return vk::QueryPipelineStatisticFlagBits::eInputAssemblyVertices
+         | vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations
+         | vk::QueryPipelineStatisticFlagBits::eClippingPrimitives
+         | vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+}
+
+bool VulkanRenderer::CreateComputeQueue()
+{
+  m_VulkanParameters.m_ComputeQueue =
+    m_VulkanParameters.m_Device.getQueue(m_VulkanParameters.m_ComputeQueueFamilyIdx, 0);
+  return true;
+}
+
 vk::CommandPool VulkanRenderer::CreateGraphicsCommandPool()
 {
   auto commandPoolCreateInfo = vk::CommandPoolCreateInfo(
@@ -735,6 +868,17 @@ vk::CommandPool VulkanRenderer::CreateTransferCommandPool()
   return m_VulkanParameters.m_Device.createCommandPool(commandPoolCreateInfo);
 }
 
+vk::CommandPool VulkanRenderer::CreateComputeCommandPool()
+{
+  auto commandPoolCreateInfo = vk::CommandPoolCreateInfo(
+    { vk::CommandPoolCreateFlagBits::eResetCommandBuffer
+      | vk::CommandPoolCreateFlagBits::eTransient }, // vk::CommandPoolCreateFlags flags_ = {},
+    m_VulkanParameters.m_ComputeQueueFamilyIdx       // uint32_t queueFamilyIndex_ = {}
+  );
+
+  return m_VulkanParameters.m_Device.createCommandPool(commandPoolCreateInfo);
+}
+
 vk::CommandBuffer VulkanRenderer::AllocateCommandBuffer(vk::CommandPool commandPool)
 {
   auto allocateInfo = vk::CommandBufferAllocateInfo(
@@ -748,12 +892,10 @@ vk::CommandBuffer VulkanRenderer::AllocateCommandBuffer(vk::CommandPool commandP
 
 void VulkanRenderer::FreeFrameResource(FrameResource& frameResource)
 {
-  if (frameResource.m_UniformBuffer.m_Memory) {
-    m_VulkanParameters.m_Device.freeMemory(frameResource.m_UniformBuffer.m_Memory);
-  }
-  if (frameResource.m_UniformBuffer.m_Handle) {
-    m_VulkanParameters.m_Device.destroyBuffer(frameResource.m_UniformBuffer.m_Handle);
-  }
+  frameResource.m_UploadArena.reset();
+  frameResource.m_CommandAllocator.reset();
+  frameResource.m_RenderGraph.reset();
+  frameResource.m_TransientResourcePool.reset();
   if (frameResource.m_Fence) { m_VulkanParameters.m_Device.destroyFence(frameResource.m_Fence); }
   if (frameResource.m_PresentToDrawSemaphore) {
     m_VulkanParameters.m_Device.destroySemaphore(frameResource.m_PresentToDrawSemaphore);
@@ -761,8 +903,16 @@ void VulkanRenderer::FreeFrameResource(FrameResource& frameResource)
   if (frameResource.m_DrawToPresentSemaphore) {
     m_VulkanParameters.m_Device.destroySemaphore(frameResource.m_DrawToPresentSemaphore);
   }
-  if (frameResource.m_Framebuffer) { m_VulkanParameters.m_Device.destroyFramebuffer(frameResource.m_Framebuffer); }
+  if (frameResource.m_ComputeToDrawSemaphore) {
+    m_VulkanParameters.m_Device.destroySemaphore(frameResource.m_ComputeToDrawSemaphore);
+  }
+  // The framebuffer belongs to the swapchain's framebuffer cache, the descriptor set to the renderer's pool
+  frameResource.m_Framebuffer = nullptr;
+  frameResource.m_DescriptorSet = nullptr;
   if (frameResource.m_QueryPool) { m_VulkanParameters.m_Device.destroyQueryPool(frameResource.m_QueryPool); }
+  if (frameResource.m_PipelineStatisticsQueryPool) {
+    m_VulkanParameters.m_Device.destroyQueryPool(frameResource.m_PipelineStatisticsQueryPool);
+  }
 }
 
 bool VulkanRenderer::CreateQueryPool()
@@ -783,6 +933,7 @@ bool VulkanRenderer::CreateSemaphores(FrameResource& frameResource)
   auto semaphoreCreateInfo = vk::SemaphoreCreateInfo({});
   frameResource.m_PresentToDrawSemaphore = m_VulkanParameters.m_Device.createSemaphore(semaphoreCreateInfo);
   frameResource.m_DrawToPresentSemaphore = m_VulkanParameters.m_Device.createSemaphore(semaphoreCreateInfo);
+  frameResource.m_ComputeToDrawSemaphore = m_VulkanParameters.m_Device.createSemaphore(semaphoreCreateInfo);
   return true;
 }
 
@@ -793,13 +944,73 @@ bool VulkanRenderer::CreateFence(FrameResource& frameResource)
   return true;
 }
 
+void VulkanRenderer::SetFramePacing(FramePacing const& framePacing)
+{
+  std::lock_guard<std::mutex> lock(m_FramePacingCriticalSection);
+  m_FramePacing = framePacing;
+  m_FramePacing.m_FramesInFlight = std::clamp(framePacing.m_FramesInFlight, 1u, MAX_FRAMES_IN_FLIGHT);
+  m_FramePacingChanged = true;
+}
+
+FramePacing VulkanRenderer::GetFramePacing()
+{
+  std::lock_guard<std::mutex> lock(m_FramePacingCriticalSection);
+  return m_FramePacing;
+}
+
+bool VulkanRenderer::ApplyFramePacing()
+{
+  FramePacing framePacing;
+  {
+    std::lock_guard<std::mutex> lock(m_FramePacingCriticalSection);
+    if (!m_FramePacingChanged) { return false; }
+    framePacing = m_FramePacing;
+    m_FramePacingChanged = false;
+  }
+
+  bool framesInFlightChanged = framePacing.m_FramesInFlight != m_FrameResourcesCount;
+  bool presentModeChanged = framePacing.m_PresentMode != m_VulkanParameters.m_PresentMode;
+  if (!framesInFlightChanged && !presentModeChanged) { return false; }
+
+  // A settings switch is rare enough to afford draining the device, the frame resources are rebuilt from scratch
+  m_VulkanParameters.m_Device.waitIdle();
+  if (framesInFlightChanged) {
+    for (uint32_t i = 0; i != m_FrameResources.size(); ++i) {
+      FreeFrameResource(m_FrameResources[i]);
+      FreeRetiredResources(i);
+    }
+    m_FrameResourcesCount = framePacing.m_FramesInFlight;
+    m_CurrentResourceIdx = 0;
+    InitializeFrameResources();
+  }
+
+  if (presentModeChanged) {
+    m_VulkanParameters.m_PresentMode = framePacing.m_PresentMode;
+    RecreateSwapchain();
+  }
+
+  std::ostringstream debugOutput;
+  debugOutput << "Frames in flight: " << m_FrameResourcesCount
+              << ", requested present mode: " << vk::to_string(m_VulkanParameters.m_PresentMode)
+              << ", frame limit: " << framePacing.m_FrameLimitInMs << " ms";
+  Utils::Logger::Get().LogDebugEx("Frame pacing changed", "Renderer", __FILE__, __func__, __LINE__, debugOutput.str());
+  return true;
+}
+
 void VulkanRenderer::InitializeFrameResources()
 {
   m_FrameResources.clear();
   m_FrameResources.resize(m_FrameResourcesCount);
+  m_RetiredResources.clear();
+  m_RetiredResources.resize(m_FrameResourcesCount);
 
   for (uint32_t i = 0; i != m_FrameResources.size(); ++i) {
     m_FrameResources[i].m_FrameIdx = i;
+    m_FrameResources[i].m_FrameNumber = FrameResource::InvalidFrameNumber;
+    // Written in full before the frame's first draw, the texture when the frame is acquired
+    m_FrameResources[i].m_DescriptorSet = m_VulkanParameters.m_DescriptorSets[i];
+    m_FrameResources[i].m_ImageDescriptorVersion = 0;
+    m_FrameResources[i].m_ImageDescriptorResourceGeneration = 0;
     if (!CreateSemaphores(m_FrameResources[i])) {
       throw std::runtime_error("Could not create semaphores for render resource #" + i);
     }
@@ -811,42 +1022,85 @@ void VulkanRenderer::InitializeFrameResources()
     auto queryPoolCreateInfo =
       vk::QueryPoolCreateInfo({},                        // vk::QueryPoolCreateFlags flags_ = {}, reserved
                               vk::QueryType::eTimestamp, // vk::QueryType queryType_ = vk::QueryType::eOcclusion,
-                              2,                         // uint32_t queryCount_ = {},
-                              {}                         // vk::QueryPipelineStatisticFlags pipelineStatistics_ = {}
+                              2 + 2 * FrameStat::MaxTimedPasses, // uint32_t queryCount_ = {},
+                              {} // vk::QueryPipelineStatisticFlags pipelineStatistics_ = {}
       );
 
     m_FrameResources[i].m_QueryPool = m_VulkanParameters.m_Device.createQueryPool(queryPoolCreateInfo);
+    m_FrameResources[i].m_PassCount = 0;
+    m_FrameResources[i].m_ElidedCommandCount = 0;
+
+    if (m_VulkanParameters.m_PipelineStatisticsSupported) {
+      // The results are written in the order of the flag bits, ReadFrameStat relies on it
+      auto statisticsQueryPoolCreateInfo = vk::QueryPoolCreateInfo(
+        {},                                 // vk::QueryPoolCreateFlags flags_ = {}, reserved
+        vk::QueryType::ePipelineStatistics, // vk::QueryType queryType_ = vk::QueryType::eOcclusion,
+        1,                                  // uint32_t queryCount_ = {},
+        GetPipelineStatisticFlags()         // vk::QueryPipelineStatisticFlags pipelineStatistics_ = {}
+      );
+
+      m_FrameResources[i].m_PipelineStatisticsQueryPool =
+        m_VulkanParameters.m_Device.createQueryPool(statisticsQueryPoolCreateInfo);
+    }
 
-    vk::DeviceSize uniformBufferSize = 8 * 1024 * 1024;
-    m_FrameResources[i].m_UniformBuffer =
-      CreateBuffer(uniformBufferSize,
-                   { vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eUniformBuffer },
-                   { vk::MemoryPropertyFlagBits::eDeviceLocal });
+    m_FrameResources[i].m_UploadArena = std::make_shared<UploadArena>(this, UPLOAD_ARENA_SIZE);
+    m_FrameResources[i].m_CommandAllocator = std::make_shared<FrameCommandAllocator>(this);
+    m_FrameResources[i].m_TransientResourcePool = std::make_shared<TransientResourcePool>(this);
+    m_FrameResources[i].m_RenderGraph =
+      std::make_shared<RenderGraph>(this, m_FrameResources[i].m_TransientResourcePool.get());
   }
 }
 
 std::tuple<vk::Result, FrameResource> VulkanRenderer::AcquireNextFrameResources()
 {
   uint32_t currentResourceIdx = (InterlockedIncrement(&m_CurrentResourceIdx) - 1) % m_FrameResourcesCount;
+  auto fenceWaitStart = std::chrono::steady_clock::now();
   auto result = m_VulkanParameters.m_Device.waitForFences(
     m_FrameResources[currentResourceIdx].m_Fence, VK_FALSE, std::numeric_limits<uint64_t>::max());
+  auto fenceWaitEnd = std::chrono::steady_clock::now();
   if (result != vk::Result::eSuccess) {
     Utils::Logger::Get().LogErrorEx(
       "The wait on acquiring the next frame fence timed out", "Renderer", __FILE__, __func__, __LINE__);
     return { result, FrameResource() };
   }
 
+  // The GPU is done with everything this frame resource wrote last time, its timestamps are available without waiting
+  // and its upload arena and command buffers can be reused. Frames complete in submission order, so every older frame
+  // is done as well.
+  if (m_FrameResources[currentResourceIdx].m_FrameNumber != FrameResource::InvalidFrameNumber) {
+    m_CompletedFrameCount = std::max(m_CompletedFrameCount, m_FrameResources[currentResourceIdx].m_FrameNumber + 1);
+  }
+  FreeRetiredSwapchains(false);
+  ReadFrameStat(m_FrameResources[currentResourceIdx]);
+  m_FrameResources[currentResourceIdx].m_UploadArena->Reset();
+  m_FrameResources[currentResourceIdx].m_CommandAllocator->Reset();
+  m_FrameResources[currentResourceIdx].m_TransientResourcePool->Reset();
+  FreeRetiredResources(currentResourceIdx);
+  UpdateImageDescriptor(m_FrameResources[currentResourceIdx]);
+
+  auto acquireStart = std::chrono::steady_clock::now();
   vk::ResultValue acquireResult =
     m_VulkanParameters.m_Device.acquireNextImageKHR(m_VulkanParameters.m_Swapchain.m_Handle,
                                                     std::numeric_limits<uint64_t>::max(),
                                                     m_FrameResources[currentResourceIdx].m_PresentToDrawSemaphore,
                                                     nullptr);
+  auto acquireEnd = std::chrono::steady_clock::now();
+
+  // The previous timings of this resource were handed over to its FrameStat in ReadFrameStat above
+  m_FrameResources[currentResourceIdx].m_CpuTimings = CpuFrameTimings();
+  m_FrameResources[currentResourceIdx].m_CpuTimings.m_FenceWaitInMs =
+    std::chrono::duration<double, std::milli>(fenceWaitEnd - fenceWaitStart).count();
+  m_FrameResources[currentResourceIdx].m_CpuTimings.m_AcquireInMs =
+    std::chrono::duration<double, std::milli>(acquireEnd - acquireStart).count();
 
   if (acquireResult.result != vk::Result::eSuccess && acquireResult.result != vk::Result::eSuboptimalKHR) {
     return { acquireResult.result, FrameResource() };
   }
 
+  m_FrameResources[currentResourceIdx].m_FrameNumber = m_FrameCounter++;
   m_FrameResources[currentResourceIdx].m_SwapchainImage.m_ImageIdx = acquireResult.value;
+  m_FrameResources[currentResourceIdx].m_SwapchainImage.m_Image =
+    m_VulkanParameters.m_Swapchain.m_Images[acquireResult.value];
   m_FrameResources[currentResourceIdx].m_SwapchainImage.m_ImageView =
     m_VulkanParameters.m_Swapchain.m_ImageViews[acquireResult.value];
   m_FrameResources[currentResourceIdx].m_SwapchainImage.m_ImageWidth =
@@ -854,23 +1108,25 @@ std::tuple<vk::Result, FrameResource> VulkanRenderer::AcquireNextFrameResources(
   m_FrameResources[currentResourceIdx].m_SwapchainImage.m_ImageHeight =
     m_VulkanParameters.m_Swapchain.m_ImageExtent.height;
 
-  if (m_FrameResources[currentResourceIdx].m_Framebuffer) {
-    m_VulkanParameters.m_Device.destroyFramebuffer(m_FrameResources[currentResourceIdx].m_Framebuffer);
-    m_FrameResources[currentResourceIdx].m_Framebuffer = nullptr;
-  }
-
-  auto framebufferCreateInfo = vk::FramebufferCreateInfo(
-    {},                                                                // vk::FramebufferCreateFlags flags_ = {},
-    m_VulkanParameters.m_RenderPass,                                   // vk::RenderPass renderPass_ = {},
-    1,                                                                 // uint32_t attachmentCount_ = {},
-    &m_VulkanParameters.m_Swapchain.m_ImageViews[acquireResult.value], // const vk::ImageView* pAttachments_ = {},
-    m_VulkanParameters.m_Swapchain.m_ImageExtent.width,                // uint32_t width_ = {},
-    m_VulkanParameters.m_Swapchain.m_ImageExtent.height,               // uint32_t height_ = {},
-    1                                                                  // uint32_t layers_ = {}
-  );
-
   m_FrameResources[currentResourceIdx].m_Framebuffer =
-    m_VulkanParameters.m_Device.createFramebuffer(framebufferCreateInfo);
+    m_VulkanParameters.m_Swapchain.m_Framebuffers[acquireResult.value];
+
+  // The contents of the acquired image are discarded, it only has to wait for the acquire semaphore, which the frame's
+  // submission waits on at the color attachment output stage
+  RenderGraph& renderGraph = *m_FrameResources[currentResourceIdx].m_RenderGraph;
+  renderGraph.Reset();
+  RenderGraphResourceId swapchainResourceId =
+    renderGraph.ImportImage("Swapchain image",
+                            m_FrameResources[currentResourceIdx].m_SwapchainImage.m_Image,
+                            vk::ImageAspectFlagBits::eColor,
+                            vk::ImageLayout::eUndefined,
+                            vk::PipelineStageFlagBits::eColorAttachmentOutput);
+  renderGraph.SetFinalAccess(swapchainResourceId, RenderGraphAccess::Present);
+  m_FrameResources[currentResourceIdx].m_SwapchainImage.m_GraphResourceId = swapchainResourceId;
+
+  if (m_CommandStreamRecorder) {
+    m_CommandStreamRecorder->RecordBeginFrame(m_VulkanParameters.m_Swapchain.m_ImageExtent);
+  }
 
   return { acquireResult.result, m_FrameResources[currentResourceIdx] };
 }
@@ -887,20 +1143,59 @@ vk::Result VulkanRenderer::PresentFrame(FrameResource& frameResources)
     );
 
   auto presentResult = m_VulkanParameters.m_GraphicsQueue.presentKHR(presentInfo);
-
-  // Frame time data
-  frameResources.m_FrameStat.m_BeginFrameTimestamp = 0;
-  frameResources.m_FrameStat.m_EndFrameTimestamp = 0;
-  m_VulkanParameters.m_Device.getQueryPoolResults(frameResources.m_QueryPool,
-                                                  0,
-                                                  2,
-                                                  2 * sizeof(uint64_t),
-                                                  &frameResources.m_FrameStat,
-                                                  sizeof(uint64_t),
-                                                  { vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait });
   return presentResult;
 }
 
+void VulkanRenderer::ReadFrameStat(FrameResource& frameResource)
+{
+  frameResource.m_FrameStat = FrameStat();
+  if (frameResource.m_FrameNumber == FrameResource::InvalidFrameNumber) { return; }
+
+  // Only called after the frame's fence has signaled, so the results are never waited on. Only the queries that were
+  // written are read, the unused pass slots would never become available.
+  std::array<uint64_t, 2 + 2 * FrameStat::MaxTimedPasses> timestamps = {};
+  uint32_t timestampCount = 2 + 2 * frameResource.m_PassCount;
+  vk::Result result = m_VulkanParameters.m_Device.getQueryPoolResults(frameResource.m_QueryPool,
+                                                                      0,
+                                                                      timestampCount,
+                                                                      timestampCount * sizeof(uint64_t),
+                                                                      timestamps.data(),
+                                                                      sizeof(uint64_t),
+                                                                      { vk::QueryResultFlagBits::e64 });
+
+  frameResource.m_FrameStat.m_BeginFrameTimestamp = timestamps[0];
+  frameResource.m_FrameStat.m_EndFrameTimestamp = timestamps[1];
+  for (uint32_t passIdx = 0; passIdx != frameResource.m_PassCount; ++passIdx) {
+    frameResource.m_FrameStat.m_Passes[passIdx] = PassTimestamps{
+      frameResource.m_PassNames[passIdx], timestamps[2 + 2 * passIdx], timestamps[3 + 2 * passIdx]
+    };
+  }
+  frameResource.m_FrameStat.m_PassCount = frameResource.m_PassCount;
+
+  if (frameResource.m_PipelineStatisticsQueryPool) {
+    std::array<uint64_t, 4> statistics = {};
+    vk::Result statisticsResult =
+      m_VulkanParameters.m_Device.getQueryPoolResults(frameResource.m_PipelineStatisticsQueryPool,
+                                                      0,
+                                                      1,
+                                                      sizeof(statistics),
+                                                      statistics.data(),
+                                                      sizeof(statistics),
+                                                      { vk::QueryResultFlagBits::e64 });
+    frameResource.m_FrameStat.m_PipelineStatistics =
+      PipelineStatistics{ statistics[0], statistics[1], statistics[2], statistics[3] };
+    frameResource.m_FrameStat.m_HasPipelineStatistics = statisticsResult == vk::Result::eSuccess;
+  }
+
+  frameResource.m_FrameStat.m_FrameNumber = frameResource.m_FrameNumber;
+  frameResource.m_FrameStat.m_CpuTimings = frameResource.m_CpuTimings;
+  frameResource.m_FrameStat.m_ElidedCommandCount = frameResource.m_ElidedCommandCount;
+  frameResource.m_FrameStat.m_IsValid = result == vk::Result::eSuccess;
+  frameResource.m_FrameNumber = FrameResource::InvalidFrameNumber;
+  frameResource.m_PassCount = 0;
+  frameResource.m_ElidedCommandCount = 0;
+}
+
 double VulkanRenderer::GetFrameTimeInMs(FrameStat const& frameStat)
 {
   double frameTimeInMs = static_cast<double>(frameStat.m_EndFrameTimestamp - frameStat.m_BeginFrameTimestamp)
@@ -908,69 +1203,69 @@ double VulkanRenderer::GetFrameTimeInMs(FrameStat const& frameStat)
   return frameTimeInMs;
 }
 
-void VulkanRenderer::BeginFrame(FrameResource& frameResources, vk::CommandBuffer commandBuffer)
+double VulkanRenderer::GetPassTimeInMs(PassTimestamps const& passTimestamps)
 {
-  commandBuffer.begin(vk::CommandBufferBeginInfo({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit }, nullptr));
-  commandBuffer.resetQueryPool(frameResources.m_QueryPool, 0, 2);
-  commandBuffer.writeTimestamp({ vk::PipelineStageFlagBits::eBottomOfPipe }, frameResources.m_QueryPool, 0);
+  return static_cast<double>(passTimestamps.m_EndTimestamp - passTimestamps.m_BeginTimestamp)
+         * static_cast<double>(m_VulkanParameters.m_TimestampPeriod) / 1'000'000.0;
+}
 
-  auto subresourceRange =
-    vk::ImageSubresourceRange({ vk::ImageAspectFlagBits::eColor }, // vk::ImageAspectFlags aspectMask_ = {},
-                              0,                                   // uint32_t baseMipLevel_ = {},
-                              1,                                   // uint32_t levelCount_ = {},
-                              0,                                   // uint32_t baseArrayLayer_ = {},
-                              1                                    // uint32_t layerCount_ = {}
-    );
+uint32_t VulkanRenderer::BeginTimedPass(FrameResource const& frameResources,
+                                        vk::CommandBuffer commandBuffer,
+                                        char const* name)
+{
+  // The application works on a copy of the frame resource, the pass bookkeeping lives in the renderer's own
+  FrameResource& frameResource = m_FrameResources[frameResources.m_FrameIdx];
+  if (frameResource.m_PassCount == FrameStat::MaxTimedPasses) { return FrameStat::MaxTimedPasses; }
+
+  uint32_t passIdx = frameResource.m_PassCount++;
+  frameResource.m_PassNames[passIdx] = name;
+  commandBuffer.writeTimestamp({ vk::PipelineStageFlagBits::eTopOfPipe }, frameResource.m_QueryPool, 2 + 2 * passIdx);
+  return passIdx;
+}
 
-  auto fromPresentToDrawBarrier = vk::ImageMemoryBarrier(
-    { vk::AccessFlagBits::eMemoryRead },           // vk::AccessFlags srcAccessMask_ = {},
-    { vk::AccessFlagBits::eColorAttachmentWrite }, // vk::AccessFlags dstAccessMask_ = {},
-    vk::ImageLayout::eUndefined,                   // vk::ImageLayout oldLayout_ = vk::ImageLayout::eUndefined,
-    vk::ImageLayout::ePresentSrcKHR,               // vk::ImageLayout newLayout_ = vk::ImageLayout::eUndefined,
-    m_VulkanParameters.m_GraphicsQueueFamilyIdx,   // uint32_t srcQueueFamilyIndex_ = {},
-    m_VulkanParameters.m_GraphicsQueueFamilyIdx,   // uint32_t dstQueueFamilyIndex_ = {},
-    m_VulkanParameters.m_Swapchain.m_Images[frameResources.m_SwapchainImage.m_ImageIdx], // vk::Image image_ = {},
-    subresourceRange // vk::ImageSubresourceRange subresourceRange_ = {}
-  );
+void VulkanRenderer::EndTimedPass(FrameResource const& frameResources,
+                                  vk::CommandBuffer commandBuffer,
+                                  uint32_t passIdx)
+{
+  if (passIdx >= FrameStat::MaxTimedPasses) { return; }
+  commandBuffer.writeTimestamp(
+    { vk::PipelineStageFlagBits::eBottomOfPipe }, frameResources.m_QueryPool, 3 + 2 * passIdx);
+}
 
-  commandBuffer.pipelineBarrier({ vk::PipelineStageFlagBits::eColorAttachmentOutput },
-                                { vk::PipelineStageFlagBits::eColorAttachmentOutput },
-                                {},
-                                nullptr,
-                                nullptr,
-                                fromPresentToDrawBarrier);
+void VulkanRenderer::SetCpuFrameTimings(FrameResource const& frameResources, CpuFrameTimings const& cpuTimings)
+{
+  m_FrameResources[frameResources.m_FrameIdx].m_CpuTimings = cpuTimings;
 }
 
-void VulkanRenderer::EndFrame(FrameResource& frameResources, vk::CommandBuffer commandBuffer)
+void VulkanRenderer::AddElidedCommandCount(FrameResource const& frameResources, uint32_t elidedCommandCount)
 {
-  auto subresourceRange =
-    vk::ImageSubresourceRange({ vk::ImageAspectFlagBits::eColor }, // vk::ImageAspectFlags aspectMask_ = {},
-                              0,                                   // uint32_t baseMipLevel_ = {},
-                              1,                                   // uint32_t levelCount_ = {},
-                              0,                                   // uint32_t baseArrayLayer_ = {},
-                              1                                    // uint32_t layerCount_ = {}
-    );
+  m_FrameResources[frameResources.m_FrameIdx].m_ElidedCommandCount += elidedCommandCount;
+}
 
-  auto fromDrawToPresentBarrier = vk::ImageMemoryBarrier(
-    { vk::AccessFlagBits::eColorAttachmentWrite }, // vk::AccessFlags srcAccessMask_ = {},
-    { vk::AccessFlagBits::eMemoryRead },           // vk::AccessFlags dstAccessMask_ = {},
-    vk::ImageLayout::ePresentSrcKHR,               // vk::ImageLayout oldLayout_ = vk::ImageLayout::eUndefined,
-    vk::ImageLayout::ePresentSrcKHR,               // vk::ImageLayout newLayout_ = vk::ImageLayout::eUndefined,
-    m_VulkanParameters.m_GraphicsQueueFamilyIdx,   // uint32_t srcQueueFamilyIndex_ = {},
-    m_VulkanParameters.m_GraphicsQueueFamilyIdx,   // uint32_t dstQueueFamilyIndex_ = {},
-    m_VulkanParameters.m_Swapchain.m_Images[frameResources.m_SwapchainImage.m_ImageIdx], // vk::Image image_ = {},
-    subresourceRange // vk::ImageSubresourceRange subresourceRange_ = {}
-  );
+void VulkanRenderer::BeginFrame(FrameResource& frameResources, vk::CommandBuffer commandBuffer)
+{
+  commandBuffer.begin(vk::CommandBufferBeginInfo({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit }, nullptr));
+  commandBuffer.resetQueryPool(frameResources.m_QueryPool, 0, 2 + 2 * FrameStat::MaxTimedPasses);
+  commandBuffer.writeTimestamp({ vk::PipelineStageFlagBits::eBottomOfPipe }, frameResources.m_QueryPool, 0);
+  if (frameResources.m_PipelineStatisticsQueryPool) {
+    commandBuffer.resetQueryPool(frameResources.m_PipelineStatisticsQueryPool, 0, 1);
+    commandBuffer.beginQuery(frameResources.m_PipelineStatisticsQueryPool, 0, {});
+  }
+}
 
-  commandBuffer.pipelineBarrier({ vk::PipelineStageFlagBits::eColorAttachmentOutput },
-                                { vk::PipelineStageFlagBits::eBottomOfPipe },
-                                {},
-                                nullptr,
-                                nullptr,
-                                fromDrawToPresentBarrier);
+void VulkanRenderer::EndFrame(FrameResource& frameResources, vk::CommandBuffer commandBuffer)
+{
+  // The swapchain image transitions and every barrier between the passes come from the render graph
+  frameResources.m_RenderGraph->Compile();
+  frameResources.m_RenderGraph->Execute(frameResources, commandBuffer);
 
+  if (frameResources.m_PipelineStatisticsQueryPool) {
+    commandBuffer.endQuery(frameResources.m_PipelineStatisticsQueryPool, 0);
+  }
   commandBuffer.writeTimestamp({ vk::PipelineStageFlagBits::eBottomOfPipe }, frameResources.m_QueryPool, 1);
   commandBuffer.end();
+
+  if (m_CommandStreamRecorder) { m_CommandStreamRecorder->RecordEndFrame(); }
 }
 
 bool VulkanRenderer::CreateDescriptorSetLayout()
@@ -1007,22 +1302,23 @@ bool VulkanRenderer::CreateDescriptorSetLayout()
 
 bool VulkanRenderer::CreateDescriptorPool()
 {
+  // A set for every frame resource there can be, the frame pacing may change their number at any time
   auto poolSizes = std::vector<vk::DescriptorPoolSize>(
     { // Combined sampler and image
       vk::DescriptorPoolSize(
         vk::DescriptorType::eCombinedImageSampler, // vk::DescriptorType type_ = vk::DescriptorType::eSampler,
-        1                                          // uint32_t descriptorCount_ = {}
+        MAX_FRAMES_IN_FLIGHT                       // uint32_t descriptorCount_ = {}
         ),
 
       // Uniform buffer
       vk::DescriptorPoolSize(
         vk::DescriptorType::eUniformBuffer, // vk::DescriptorType type_ = vk::DescriptorType::eSampler,
-        1                                   // uint32_t descriptorCount_ = {}
+        MAX_FRAMES_IN_FLIGHT                // uint32_t descriptorCount_ = {}
         ) });
 
   auto descriptorPoolCreateInfo =
     vk::DescriptorPoolCreateInfo({},                                      // vk::DescriptorPoolCreateFlags flags_ = {},
-                                 1,                                       // uint32_t maxSets_ = {},
+                                 MAX_FRAMES_IN_FLIGHT,                    // uint32_t maxSets_ = {},
                                  static_cast<uint32_t>(poolSizes.size()), // uint32_t poolSizeCount_ = {},
                                  poolSizes.data() // const vk::DescriptorPoolSize* pPoolSizes_ = {}
     );
@@ -1031,32 +1327,32 @@ bool VulkanRenderer::CreateDescriptorPool()
   return true;
 }
 
-bool VulkanRenderer::AllocateDescriptorSet()
+bool VulkanRenderer::AllocateDescriptorSets()
 {
+  auto setLayouts =
+    std::vector<vk::DescriptorSetLayout>(MAX_FRAMES_IN_FLIGHT, m_VulkanParameters.m_DescriptorSetLayout);
   auto descriptorSetAllocateInfo = vk::DescriptorSetAllocateInfo(
     m_VulkanParameters.m_DescriptorPool,      // vk::DescriptorPool descriptorPool_ = {},
-    1,                                        // uint32_t descriptorSetCount_ = {},
-    &m_VulkanParameters.m_DescriptorSetLayout // const vk::DescriptorSetLayout* pSetLayouts_ = {}
+    static_cast<uint32_t>(setLayouts.size()), // uint32_t descriptorSetCount_ = {},
+    setLayouts.data()                         // const vk::DescriptorSetLayout* pSetLayouts_ = {}
   );
 
-  std::vector<vk::DescriptorSet> descriptorSets =
-    m_VulkanParameters.m_Device.allocateDescriptorSets(descriptorSetAllocateInfo);
-  m_VulkanParameters.m_DescriptorSet = descriptorSets[0];
+  m_VulkanParameters.m_DescriptorSets = m_VulkanParameters.m_Device.allocateDescriptorSets(descriptorSetAllocateInfo);
   return true;
 }
 
 bool VulkanRenderer::CreateRenderPass()
 {
   auto attachments = std::vector<vk::AttachmentDescription>({ vk::AttachmentDescription(
-    {},                                      // vk::AttachmentDescriptionFlags flags_ = {},
-    m_VulkanParameters.m_Swapchain.m_Format, // vk::Format format_ = vk::Format::eUndefined,
-    vk::SampleCountFlagBits::e1,             // vk::SampleCountFlagBits samples_ = vk::SampleCountFlagBits::e1,
-    vk::AttachmentLoadOp::eClear,            // vk::AttachmentLoadOp loadOp_ = vk::AttachmentLoadOp::eLoad,
-    vk::AttachmentStoreOp::eStore,           // vk::AttachmentStoreOp storeOp_ = vk::AttachmentStoreOp::eStore,
-    vk::AttachmentLoadOp::eDontCare,         // vk::AttachmentLoadOp stencilLoadOp_ = vk::AttachmentLoadOp::eLoad,
-    vk::AttachmentStoreOp::eDontCare,        // vk::AttachmentStoreOp stencilStoreOp_ = vk::AttachmentStoreOp::eStore,
-    vk::ImageLayout::ePresentSrcKHR,         // vk::ImageLayout initialLayout_ = vk::ImageLayout::eUndefined,
-    vk::ImageLayout::ePresentSrcKHR          // vk::ImageLayout finalLayout_ = vk::ImageLayout::eUndefined
+    {},                                       // vk::AttachmentDescriptionFlags flags_ = {},
+    m_VulkanParameters.m_Swapchain.m_Format,  // vk::Format format_ = vk::Format::eUndefined,
+    vk::SampleCountFlagBits::e1,              // vk::SampleCountFlagBits samples_ = vk::SampleCountFlagBits::e1,
+    vk::AttachmentLoadOp::eClear,             // vk::AttachmentLoadOp loadOp_ = vk::AttachmentLoadOp::eLoad,
+    vk::AttachmentStoreOp::eStore,            // vk::AttachmentStoreOp storeOp_ = vk::AttachmentStoreOp::eStore,
+    vk::AttachmentLoadOp::eDontCare,          // vk::AttachmentLoadOp stencilLoadOp_ = vk::AttachmentLoadOp::eLoad,
+    vk::AttachmentStoreOp::eDontCare,         // vk::AttachmentStoreOp stencilStoreOp_ = vk::AttachmentStoreOp::eStore,
+    vk::ImageLayout::eColorAttachmentOptimal, // vk::ImageLayout initialLayout_ = vk::ImageLayout::eUndefined,
+    vk::ImageLayout::eColorAttachmentOptimal  // vk::ImageLayout finalLayout_ = vk::ImageLayout::eUndefined
     ) });
 
   auto colorAttachments = std::vector<vk::AttachmentReference>({ vk::AttachmentReference(
@@ -1269,24 +1565,43 @@ vk::PipelineLayout VulkanRenderer::CreatePipelineLayout()
 
 bool VulkanRenderer::RecreateSwapchain()
 {
-  m_VulkanParameters.m_Device.waitIdle();
-
-  for (auto& imageView : m_VulkanParameters.m_Swapchain.m_ImageViews) {
-    m_VulkanParameters.m_Device.destroyImageView(imageView);
-  }
-
-  if (m_VulkanParameters.m_Swapchain.m_Handle) {
-    m_VulkanParameters.m_Device.destroySwapchainKHR(m_VulkanParameters.m_Swapchain.m_Handle);
-    m_VulkanParameters.m_Swapchain.m_Handle = nullptr;
+  // A zero sized swapchain is invalid, keep the current one until the window is restored. The application parks the
+  // render thread in the meantime instead of retrying in a loop.
+  vk::Extent2D windowExtent = GetSwapchainExtent();
+  if (windowExtent.width == 0 || windowExtent.height == 0) { return false; }
+
+  // No device wait here: frames in flight finish against the old swapchain, which is only destroyed once the last
+  // frame acquired from it has completed. The old handle is passed to CreateSwapchain as oldSwapchain. It is retired
+  // before anything is created, so the old handles are destroyed however the creation below leaves this function.
+  m_RetiredSwapchains.push_back(RetiredSwapchain{ m_VulkanParameters.m_Swapchain, m_FrameCounter });
+  m_VulkanParameters.m_Swapchain.m_ImageViews.clear();
+  m_VulkanParameters.m_Swapchain.m_Framebuffers.clear();
+
+  try {
+    return CreateSwapchain() && CreateSwapchainFramebuffers();
+  } catch (...) {
+    // The retired entry owns the old handle now, do not leave it behind to be destroyed a second time
+    if (m_VulkanParameters.m_Swapchain.m_Handle == m_RetiredSwapchains.back().m_Swapchain.m_Handle) {
+      m_VulkanParameters.m_Swapchain.m_Handle = nullptr;
+    }
+    throw;
   }
-
-  if (!CreateSwapchain()) { return false; }
-  return true;
 }
 
 BufferData VulkanRenderer::CreateBuffer(vk::DeviceSize size,
                                         vk::BufferUsageFlags usage,
                                         vk::MemoryPropertyFlags requiredProperties)
+{
+  BufferData buffer = AllocateBuffer(size, usage, requiredProperties, MemoryAllocationOptions());
+  if (!buffer.m_Handle) { throw std::runtime_error("Could not allocate device memory for a buffer"); }
+  if (m_CommandStreamRecorder) { m_CommandStreamRecorder->RecordCreateBuffer(buffer); }
+  return buffer;
+}
+
+BufferData VulkanRenderer::AllocateBuffer(vk::DeviceSize size,
+                                          vk::BufferUsageFlags usage,
+                                          vk::MemoryPropertyFlags requiredProperties,
+                                          MemoryAllocationOptions const& options)
 {
   auto bufferCreateInfo =
     vk::BufferCreateInfo({},                          // vk::BufferCreateFlags flags_ = {},
@@ -1299,23 +1614,20 @@ BufferData VulkanRenderer::CreateBuffer(vk::DeviceSize size,
 
   BufferData buffer;
   buffer.m_Handle = m_VulkanParameters.m_Device.createBuffer(bufferCreateInfo);
+  buffer.m_Size = size;
+  buffer.m_Usage = usage;
+  buffer.m_MemoryProperties = requiredProperties;
 
   vk::MemoryRequirements memoryRequirements = m_VulkanParameters.m_Device.getBufferMemoryRequirements(buffer.m_Handle);
-  vk::PhysicalDeviceMemoryProperties memoryProperties = m_VulkanParameters.m_PhysicalDevice.getMemoryProperties();
-  for (uint32_t i = 0; i != memoryProperties.memoryTypeCount; ++i) {
-    if (memoryRequirements.memoryTypeBits & (1 << i)
-        && (memoryProperties.memoryTypes[i].propertyFlags & requiredProperties)) {
-      auto allocateInfo = vk::MemoryAllocateInfo(memoryRequirements.size, // vk::DeviceSize allocationSize_ = {},
-                                                 i                        // uint32_t memoryTypeIndex_ = {}
-      );
-
-      buffer.m_Size = memoryRequirements.size;
-      buffer.m_Memory = m_VulkanParameters.m_Device.allocateMemory(allocateInfo);
-      break;
-    }
+  buffer.m_Allocation =
+    m_MemoryAllocator.Allocate(memoryRequirements, requiredProperties, MemoryResourceKind::Buffer, options);
+  if (!buffer.m_Allocation.m_Memory) {
+    m_VulkanParameters.m_Device.destroyBuffer(buffer.m_Handle);
+    return BufferData();
   }
 
-  m_VulkanParameters.m_Device.bindBufferMemory(buffer.m_Handle, buffer.m_Memory, 0);
+  buffer.m_Memory = buffer.m_Allocation.m_Memory;
+  m_VulkanParameters.m_Device.bindBufferMemory(buffer.m_Handle, buffer.m_Memory, buffer.m_Allocation.m_Offset);
   return buffer;
 }
 
@@ -1331,11 +1643,30 @@ void VulkanRenderer::SubmitToTransferQueue(vk::SubmitInfo& submitInfo, vk::Fence
   m_VulkanParameters.m_TransferQueue.submit(submitInfo, fence);
 }
 
+void VulkanRenderer::SubmitToComputeQueue(vk::SubmitInfo& submitInfo, vk::Fence fence)
+{
+  // Without a dedicated family the compute queue is the graphics queue, which has to go through the same lock
+  if (!IsAsyncComputeAvailable()) {
+    SubmitToGraphicsQueue(submitInfo, fence);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_ComputeQueueSubmitCriticalSection);
+  m_VulkanParameters.m_ComputeQueue.submit(submitInfo, fence);
+}
+
 void VulkanRenderer::FreeBuffer(BufferData& buffer)
 {
+  if (m_CommandStreamRecorder) { m_CommandStreamRecorder->RecordFreeBuffer(buffer); }
   m_VulkanParameters.m_Device.waitIdle();
-  if (buffer.m_Memory) { m_VulkanParameters.m_Device.freeMemory(buffer.m_Memory); }
+  DestroyBuffer(buffer);
+}
+
+void VulkanRenderer::DestroyBuffer(BufferData& buffer)
+{
   if (buffer.m_Handle) { m_VulkanParameters.m_Device.destroyBuffer(buffer.m_Handle); }
+  m_MemoryAllocator.Free(buffer.m_Allocation);
+  buffer = BufferData();
 }
 
 bool VulkanRenderer::CreateFramebuffer(vk::Framebuffer& framebuffer, vk::ImageView& imageView)
@@ -1359,6 +1690,51 @@ bool VulkanRenderer::CreateFramebuffer(vk::Framebuffer& framebuffer, vk::ImageVi
   return true;
 }
 
+bool VulkanRenderer::CreateSwapchainFramebuffers()
+{
+  Swapchain& swapchain = m_VulkanParameters.m_Swapchain;
+  swapchain.m_Framebuffers = std::vector<vk::Framebuffer>(swapchain.m_ImageViews.size());
+  for (uint32_t idx = 0; idx != swapchain.m_ImageViews.size(); ++idx) {
+    if (!CreateFramebuffer(swapchain.m_Framebuffers[idx], swapchain.m_ImageViews[idx])) {
+      Utils::Logger::Get().LogCriticalEx(
+        "Could not create the swapchain framebuffers", "Renderer", __FILE__, __func__, __LINE__);
+      return false;
+    }
+  }
+  return true;
+}
+
+void VulkanRenderer::DestroySwapchain(Swapchain& swapchain)
+{
+  for (auto& framebuffer : swapchain.m_Framebuffers) {
+    if (framebuffer) { m_VulkanParameters.m_Device.destroyFramebuffer(framebuffer); }
+  }
+  swapchain.m_Framebuffers.clear();
+
+  for (auto& imageView : swapchain.m_ImageViews) {
+    m_VulkanParameters.m_Device.destroyImageView(imageView);
+  }
+  swapchain.m_ImageViews.clear();
+
+  if (swapchain.m_Handle) {
+    m_VulkanParameters.m_Device.destroySwapchainKHR(swapchain.m_Handle);
+    swapchain.m_Handle = nullptr;
+  }
+}
+
+void VulkanRenderer::FreeRetiredSwapchains(bool force)
+{
+  auto it = m_RetiredSwapchains.begin();
+  while (it != m_RetiredSwapchains.end()) {
+    if (force || it->m_FrameCount <= m_CompletedFrameCount) {
+      DestroySwapchain(it->m_Swapchain);
+      it = m_RetiredSwapchains.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 void VulkanRenderer::CopyToLocalBuffer(std::shared_ptr<CopyToLocalBufferJob> transferJob,
                                        vk::CommandBuffer graphicsCommandBuffer,
                                        vk::CommandBuffer transferCommandBuffer,
@@ -1562,16 +1938,35 @@ vk::DeviceSize VulkanRenderer::GetNonCoherentAtomSize() const
   return properties.properties.limits.nonCoherentAtomSize;
 }
 
+vk::DeviceSize VulkanRenderer::GetMinUniformBufferOffsetAlignment() const
+{
+  vk::PhysicalDeviceProperties2 properties = m_VulkanParameters.m_PhysicalDevice.getProperties2();
+  return properties.properties.limits.minUniformBufferOffsetAlignment;
+}
+
 ImageData VulkanRenderer::CreateImage(uint32_t width,
                                       uint32_t height,
                                       vk::ImageUsageFlags usage,
                                       vk::MemoryPropertyFlags requiredProperties)
 {
-  vk::Format imageFormat = vk::Format::eR8G8B8A8Unorm;
+  ImageData image = AllocateImage(
+    width, height, vk::Format::eR8G8B8A8Unorm, usage, requiredProperties, MemoryAllocationOptions());
+  if (!image.m_Handle) { throw std::runtime_error("Could not allocate device memory for an image"); }
+  if (m_CommandStreamRecorder) { m_CommandStreamRecorder->RecordCreateImage(image); }
+  return image;
+}
+
+ImageData VulkanRenderer::AllocateImage(uint32_t width,
+                                        uint32_t height,
+                                        vk::Format format,
+                                        vk::ImageUsageFlags usage,
+                                        vk::MemoryPropertyFlags requiredProperties,
+                                        MemoryAllocationOptions const& options)
+{
   auto imageCreateInfo =
     vk::ImageCreateInfo({},                             // vk::ImageCreateFlags flags_ = {},
                         vk::ImageType::e2D,             // vk::ImageType imageType_ = vk::ImageType::e1D,
-                        imageFormat,                    // vk::Format format_ = vk::Format::eUndefined,
+                        format,                         // vk::Format format_ = vk::Format::eUndefined,
                         vk::Extent3D(width, height, 1), // vk::Extent3D extent_ = {},
                         1,                              // uint32_t mipLevels_ = {},
                         1,                              // uint32_t arrayLayers_ = {},
@@ -1588,28 +1983,26 @@ ImageData VulkanRenderer::CreateImage(uint32_t width,
   image.m_Handle = m_VulkanParameters.m_Device.createImage(imageCreateInfo);
   image.m_Width = width;
   image.m_Height = height;
+  image.m_Format = format;
+  image.m_Usage = usage;
+  image.m_MemoryProperties = requiredProperties;
 
   vk::MemoryRequirements memoryRequirements = m_VulkanParameters.m_Device.getImageMemoryRequirements(image.m_Handle);
-  vk::PhysicalDeviceMemoryProperties memoryProperties = m_VulkanParameters.m_PhysicalDevice.getMemoryProperties();
-  for (uint32_t i = 0; i != memoryProperties.memoryTypeCount; ++i) {
-    if (memoryRequirements.memoryTypeBits & (1 << i)
-        && (memoryProperties.memoryTypes[i].propertyFlags & requiredProperties)) {
-      auto allocateInfo = vk::MemoryAllocateInfo(memoryRequirements.size, // vk::DeviceSize allocationSize_ = {},
-                                                 i                        // uint32_t memoryTypeIndex_ = {}
-      );
-
-      image.m_Memory = m_VulkanParameters.m_Device.allocateMemory(allocateInfo);
-      break;
-    }
+  image.m_Allocation =
+    m_MemoryAllocator.Allocate(memoryRequirements, requiredProperties, MemoryResourceKind::Image, options);
+  if (!image.m_Allocation.m_Memory) {
+    m_VulkanParameters.m_Device.destroyImage(image.m_Handle);
+    return ImageData();
   }
 
-  m_VulkanParameters.m_Device.bindImageMemory(image.m_Handle, image.m_Memory, vk::DeviceSize(0));
+  image.m_Memory = image.m_Allocation.m_Memory;
+  m_VulkanParameters.m_Device.bindImageMemory(image.m_Handle, image.m_Memory, image.m_Allocation.m_Offset);
 
   auto imageViewCreateInfo = vk::ImageViewCreateInfo(
     {},                     // vk::ImageViewCreateFlags flags_ = {},
     image.m_Handle,         // vk::Image image_ = {},
     vk::ImageViewType::e2D, // vk::ImageViewType viewType_ = vk::ImageViewType::e1D,
-    imageFormat,            // vk::Format format_ = vk::Format::eUndefined,
+    format,                 // vk::Format format_ = vk::Format::eUndefined,
     vk::ComponentMapping(vk::ComponentSwizzle::eIdentity,
                          vk::ComponentSwizzle::eIdentity,
                          vk::ComponentSwizzle::eIdentity,
@@ -1623,9 +2016,493 @@ ImageData VulkanRenderer::CreateImage(uint32_t width,
 
 void VulkanRenderer::FreeImage(ImageData& imageData)
 {
+  if (m_CommandStreamRecorder) { m_CommandStreamRecorder->RecordFreeImage(imageData); }
   m_VulkanParameters.m_Device.waitIdle();
-  if (imageData.m_Memory) { m_VulkanParameters.m_Device.freeMemory(imageData.m_Memory); }
-  if (imageData.m_Handle) { m_VulkanParameters.m_Device.destroyImage(imageData.m_Handle); }
+  DestroyImage(imageData);
+}
+
+void VulkanRenderer::DestroyImage(ImageData& image)
+{
+  if (image.m_View) { m_VulkanParameters.m_Device.destroyImageView(image.m_View); }
+  if (image.m_Handle) { m_VulkanParameters.m_Device.destroyImage(image.m_Handle); }
+  m_MemoryAllocator.Free(image.m_Allocation);
+  image = ImageData();
+}
+
+MemoryAllocation VulkanRenderer::AllocateMemory(vk::MemoryRequirements const& requirements,
+                                                vk::MemoryPropertyFlags requiredProperties,
+                                                MemoryResourceKind kind)
+{
+  return m_MemoryAllocator.Allocate(requirements, requiredProperties, kind);
+}
+
+void VulkanRenderer::FreeMemory(MemoryAllocation const& allocation)
+{
+  m_MemoryAllocator.Free(allocation);
+}
+
+void VulkanRenderer::SetDebugName(BufferData const& buffer, std::string const& name)
+{
+  auto nameInfo = vk::DebugUtilsObjectNameInfoEXT(
+    vk::ObjectType::eBuffer,                          // vk::ObjectType objectType_ = vk::ObjectType::eUnknown,
+    uint64_t(static_cast<VkBuffer>(buffer.m_Handle)), // uint64_t objectHandle_ = {},
+    name.c_str()                                      // const char* pObjectName_ = {}
+  );
+  m_VulkanParameters.m_Device.setDebugUtilsObjectNameEXT(nameInfo);
+  m_MemoryAllocator.SetAllocationName(buffer.m_Allocation, name);
+}
+
+void VulkanRenderer::SetDebugName(ImageData const& image, std::string const& name)
+{
+  auto nameInfo = vk::DebugUtilsObjectNameInfoEXT(
+    vk::ObjectType::eImage,                         // vk::ObjectType objectType_ = vk::ObjectType::eUnknown,
+    uint64_t(static_cast<VkImage>(image.m_Handle)), // uint64_t objectHandle_ = {},
+    name.c_str()                                    // const char* pObjectName_ = {}
+  );
+  m_VulkanParameters.m_Device.setDebugUtilsObjectNameEXT(nameInfo);
+  m_MemoryAllocator.SetAllocationName(image.m_Allocation, name);
+}
+
+static std::string EscapeJsonString(std::string const& value)
+{
+  std::ostringstream escaped;
+  for (char character : value) {
+    switch (character) {
+    case '"':
+      escaped << "\\\"";
+      break;
+    case '\\':
+      escaped << "\\\\";
+      break;
+    case '\n':
+      escaped << "\\n";
+      break;
+    default:
+      if (static_cast<unsigned char>(character) < 0x20) {
+        escaped << "\\u00" << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(character) << std::dec;
+      } else {
+        escaped << character;
+      }
+    }
+  }
+  return escaped.str();
+}
+
+std::filesystem::path VulkanRenderer::DumpMemoryStats(uint32_t topAllocationCount)
+{
+  MemoryStatistics statistics = m_MemoryAllocator.GetStatistics();
+
+  std::ostringstream json;
+  json << "{\n  \"heaps\": [";
+  for (uint32_t heapIdx = 0; heapIdx != statistics.m_Heaps.size(); ++heapIdx) {
+    vk::MemoryHeap const& heap = statistics.m_Heaps[heapIdx];
+    json << (heapIdx == 0 ? "\n" : ",\n") << "    {\n"
+         << "      \"index\": " << heapIdx << ",\n"
+         << "      \"size\": " << heap.size << ",\n"
+         << "      \"flags\": \"" << vk::to_string(heap.flags) << "\",\n"
+         << "      \"memoryTypes\": [";
+
+    bool firstType = true;
+    for (MemoryTypeStatistics const& typeStatistics : statistics.m_MemoryTypes) {
+      if (typeStatistics.m_HeapIdx != heapIdx) { continue; }
+
+      json << (firstType ? "\n" : ",\n") << "        {\n"
+           << "          \"index\": " << typeStatistics.m_MemoryTypeIdx << ",\n"
+           << "          \"flags\": \"" << vk::to_string(typeStatistics.m_PropertyFlags) << "\",\n"
+           << "          \"blockCount\": " << typeStatistics.m_BlockCount << ",\n"
+           << "          \"allocatedBytes\": " << typeStatistics.m_AllocatedBytes << ",\n"
+           << "          \"usedBytes\": " << typeStatistics.m_UsedBytes << ",\n"
+           << "          \"largestFreeRange\": " << typeStatistics.m_LargestFreeRange << ",\n"
+           << "          \"allocationCount\": " << typeStatistics.m_AllocationCount << ",\n"
+           << "          \"sizeHistogram\": [";
+      for (uint32_t bucketIdx = 0; bucketIdx != MEMORY_SIZE_HISTOGRAM_BUCKET_COUNT; ++bucketIdx) {
+        json << (bucketIdx == 0 ? "" : ", ") << "{ \"maxBytes\": ";
+        if (bucketIdx == MEMORY_SIZE_HISTOGRAM_BUCKET_COUNT - 1) {
+          json << "null";
+        } else {
+          json << (vk::DeviceSize(1024) << bucketIdx);
+        }
+        json << ", \"count\": " << typeStatistics.m_SizeHistogram[bucketIdx] << " }";
+      }
+      json << "]\n        }";
+      firstType = false;
+    }
+    json << (firstType ? "]" : "\n      ]") << "\n    }";
+  }
+
+  json << "\n  ],\n  \"topAllocations\": [";
+  uint32_t allocationCount = std::min(topAllocationCount, static_cast<uint32_t>(statistics.m_Allocations.size()));
+  for (uint32_t idx = 0; idx != allocationCount; ++idx) {
+    MemoryAllocationRecord const& record = statistics.m_Allocations[idx];
+    json << (idx == 0 ? "\n" : ",\n") << "    { \"name\": \"" << EscapeJsonString(record.m_Name)
+         << "\", \"size\": " << record.m_Size << ", \"memoryType\": " << record.m_MemoryTypeIdx
+         << ", \"block\": " << record.m_BlockId << ", \"offset\": " << record.m_Offset << " }";
+  }
+  json << (allocationCount == 0 ? "]" : "\n  ]") << "\n}\n";
+
+  auto timestamp =
+    std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  std::filesystem::path path =
+    Os::GetExecutableDirectory() / ("logs/memory_stats_" + std::to_string(timestamp) + ".json");
+
+  std::ofstream file(path.c_str(), std::ios::trunc | std::ios::out);
+  if (!file.is_open()) { throw std::runtime_error("Could not open file " + path.string()); }
+  file << json.str();
+  file.close();
+
+  Utils::Logger::Get().LogInfoEx("Memory statistics written", "Renderer", __FILE__, __func__, __LINE__, path.string());
+  return path;
+}
+
+BufferHandle VulkanRenderer::RegisterBuffer(BufferData const& buffer)
+{
+  vk::BufferUsageFlags const requiredUsage =
+    vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+  if ((buffer.m_Usage & requiredUsage) != requiredUsage) {
+    throw std::runtime_error("Only buffers with transfer source and destination usage can be registered");
+  }
+
+  std::lock_guard<std::mutex> lock(m_ResourceTableCriticalSection);
+  for (uint32_t idx = 0; idx != m_RegisteredBuffers.size(); ++idx) {
+    if (!m_RegisteredBuffers[idx].m_InUse) {
+      m_RegisteredBuffers[idx] = RegisteredBuffer{ buffer, true };
+      return BufferHandle{ idx };
+    }
+  }
+
+  m_RegisteredBuffers.push_back(RegisteredBuffer{ buffer, true });
+  return BufferHandle{ static_cast<uint32_t>(m_RegisteredBuffers.size() - 1) };
+}
+
+BufferData VulkanRenderer::GetBuffer(BufferHandle handle)
+{
+  std::lock_guard<std::mutex> lock(m_ResourceTableCriticalSection);
+  assert(handle.m_Idx < m_RegisteredBuffers.size() && m_RegisteredBuffers[handle.m_Idx].m_InUse);
+  return m_RegisteredBuffers[handle.m_Idx].m_Data;
+}
+
+void VulkanRenderer::ReleaseBuffer(BufferHandle handle)
+{
+  BufferData buffer;
+  {
+    std::lock_guard<std::mutex> lock(m_ResourceTableCriticalSection);
+    assert(handle.m_Idx < m_RegisteredBuffers.size() && m_RegisteredBuffers[handle.m_Idx].m_InUse);
+    buffer = m_RegisteredBuffers[handle.m_Idx].m_Data;
+    m_RegisteredBuffers[handle.m_Idx].m_InUse = false;
+  }
+  FreeBuffer(buffer);
+}
+
+ImageHandle VulkanRenderer::RegisterImage(ImageData const& image, vk::ImageLayout layout)
+{
+  vk::ImageUsageFlags const requiredUsage =
+    vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+  if ((image.m_Usage & requiredUsage) != requiredUsage) {
+    throw std::runtime_error("Only images with transfer source and destination usage can be registered");
+  }
+
+  std::lock_guard<std::mutex> lock(m_ResourceTableCriticalSection);
+  for (uint32_t idx = 0; idx != m_RegisteredImages.size(); ++idx) {
+    if (!m_RegisteredImages[idx].m_InUse) {
+      m_RegisteredImages[idx] = RegisteredImage{ image, layout, true };
+      return ImageHandle{ idx };
+    }
+  }
+
+  m_RegisteredImages.push_back(RegisteredImage{ image, layout, true });
+  return ImageHandle{ static_cast<uint32_t>(m_RegisteredImages.size() - 1) };
+}
+
+ImageData VulkanRenderer::GetImage(ImageHandle handle)
+{
+  std::lock_guard<std::mutex> lock(m_ResourceTableCriticalSection);
+  assert(handle.m_Idx < m_RegisteredImages.size() && m_RegisteredImages[handle.m_Idx].m_InUse);
+  return m_RegisteredImages[handle.m_Idx].m_Data;
+}
+
+void VulkanRenderer::ReleaseImage(ImageHandle handle)
+{
+  ImageData image;
+  {
+    std::lock_guard<std::mutex> lock(m_ResourceTableCriticalSection);
+    assert(handle.m_Idx < m_RegisteredImages.size() && m_RegisteredImages[handle.m_Idx].m_InUse);
+    image = m_RegisteredImages[handle.m_Idx].m_Data;
+    m_RegisteredImages[handle.m_Idx].m_InUse = false;
+  }
+  FreeImage(image);
+}
+
+void VulkanRenderer::FreeRetiredResources(uint32_t frameIdx)
+{
+  for (auto& buffer : m_RetiredResources[frameIdx].m_Buffers) {
+    DestroyBuffer(buffer);
+  }
+  for (auto& image : m_RetiredResources[frameIdx].m_Images) {
+    DestroyImage(image);
+  }
+  m_RetiredResources[frameIdx].m_Buffers.clear();
+  m_RetiredResources[frameIdx].m_Images.clear();
+}
+
+void VulkanRenderer::Defragment(FrameResource const& frameResources, vk::CommandBuffer commandBuffer)
+{
+  if (m_DefragmentationBudgetInMs <= 0.0) { return; }
+
+  uint32_t sourceBlockId = m_MemoryAllocator.FindDefragmentationCandidate(DEFRAGMENTATION_MAX_OCCUPANCY);
+  if (sourceBlockId == MemoryAllocation::InvalidBlockId) { return; }
+
+  auto startTime = std::chrono::steady_clock::now();
+  auto budgetExceeded = [&]() {
+    std::chrono::duration<double, std::milli> elapsedTime = std::chrono::steady_clock::now() - startTime;
+    return elapsedTime.count() >= m_DefragmentationBudgetInMs;
+  };
+
+  // Moves only go into the free space of the other blocks, creating a new block would defeat the purpose
+  MemoryAllocationOptions allocationOptions;
+  allocationOptions.m_ExcludedBlockId = sourceBlockId;
+  allocationOptions.m_AllowNewBlock = false;
+
+  std::lock_guard<std::mutex> lock(m_ResourceTableCriticalSection);
+  std::vector<std::pair<RegisteredBuffer*, BufferData>> bufferMoves;
+  for (auto& registeredBuffer : m_RegisteredBuffers) {
+    if (budgetExceeded()) { break; }
+    if (!registeredBuffer.m_InUse || registeredBuffer.m_Data.m_Allocation.m_BlockId != sourceBlockId) { continue; }
+
+    BufferData destination = AllocateBuffer(registeredBuffer.m_Data.m_Size,
+                                            registeredBuffer.m_Data.m_Usage,
+                                            registeredBuffer.m_Data.m_MemoryProperties,
+                                            allocationOptions);
+    if (!destination.m_Handle) { break; }
+    bufferMoves.emplace_back(&registeredBuffer, destination);
+  }
+
+  std::vector<std::pair<RegisteredImage*, ImageData>> imageMoves;
+  for (auto& registeredImage : m_RegisteredImages) {
+    if (budgetExceeded()) { break; }
+    if (!registeredImage.m_InUse || registeredImage.m_Data.m_Allocation.m_BlockId != sourceBlockId) { continue; }
+
+    ImageData destination = AllocateImage(registeredImage.m_Data.m_Width,
+                                          registeredImage.m_Data.m_Height,
+                                          registeredImage.m_Data.m_Format,
+                                          registeredImage.m_Data.m_Usage,
+                                          registeredImage.m_Data.m_MemoryProperties,
+                                          allocationOptions);
+    if (!destination.m_Handle) { break; }
+    imageMoves.emplace_back(&registeredImage, destination);
+  }
+
+  if (bufferMoves.empty() && imageMoves.empty()) { return; }
+
+  auto subresourceRange =
+    vk::ImageSubresourceRange({ vk::ImageAspectFlagBits::eColor }, // vk::ImageAspectFlags aspectMask_ = {},
+                              0,                                   // uint32_t baseMipLevel_ = {},
+                              1,                                   // uint32_t levelCount_ = {},
+                              0,                                   // uint32_t baseArrayLayer_ = {},
+                              1                                    // uint32_t layerCount_ = {}
+    );
+
+  std::vector<vk::ImageMemoryBarrier> preCopyBarriers;
+  std::vector<vk::ImageMemoryBarrier> postCopyBarriers;
+  for (auto const& [registeredImage, destination] : imageMoves) {
+    preCopyBarriers.push_back(vk::ImageMemoryBarrier({},                                   // srcAccessMask_
+                                                     { vk::AccessFlagBits::eTransferRead }, // dstAccessMask_
+                                                     registeredImage->m_Layout,             // oldLayout_
+                                                     vk::ImageLayout::eTransferSrcOptimal,  // newLayout_
+                                                     VK_QUEUE_FAMILY_IGNORED, // srcQueueFamilyIndex_
+                                                     VK_QUEUE_FAMILY_IGNORED, // dstQueueFamilyIndex_
+                                                     registeredImage->m_Data.m_Handle, // image_
+                                                     subresourceRange                  // subresourceRange_
+                                                     ));
+    preCopyBarriers.push_back(vk::ImageMemoryBarrier({},                                    // srcAccessMask_
+                                                     { vk::AccessFlagBits::eTransferWrite }, // dstAccessMask_
+                                                     vk::ImageLayout::eUndefined,            // oldLayout_
+                                                     vk::ImageLayout::eTransferDstOptimal,   // newLayout_
+                                                     VK_QUEUE_FAMILY_IGNORED, // srcQueueFamilyIndex_
+                                                     VK_QUEUE_FAMILY_IGNORED, // dstQueueFamilyIndex_
+                                                     destination.m_Handle,    // image_
+                                                     subresourceRange         // subresourceRange_
+                                                     ));
+
+    // The source image goes back to its original layout, the current frame still samples it through the old view
+    postCopyBarriers.push_back(vk::ImageMemoryBarrier({},                                  // srcAccessMask_
+                                                      { vk::AccessFlagBits::eMemoryRead }, // dstAccessMask_
+                                                      vk::ImageLayout::eTransferSrcOptimal, // oldLayout_
+                                                      registeredImage->m_Layout,            // newLayout_
+                                                      VK_QUEUE_FAMILY_IGNORED,              // srcQueueFamilyIndex_
+                                                      VK_QUEUE_FAMILY_IGNORED,              // dstQueueFamilyIndex_
+                                                      registeredImage->m_Data.m_Handle,     // image_
+                                                      subresourceRange                      // subresourceRange_
+                                                      ));
+    postCopyBarriers.push_back(vk::ImageMemoryBarrier({ vk::AccessFlagBits::eTransferWrite }, // srcAccessMask_
+                                                      { vk::AccessFlagBits::eMemoryRead },    // dstAccessMask_
+                                                      vk::ImageLayout::eTransferDstOptimal,   // oldLayout_
+                                                      registeredImage->m_Layout,              // newLayout_
+                                                      VK_QUEUE_FAMILY_IGNORED, // srcQueueFamilyIndex_
+                                                      VK_QUEUE_FAMILY_IGNORED, // dstQueueFamilyIndex_
+                                                      destination.m_Handle,    // image_
+                                                      subresourceRange         // subresourceRange_
+                                                      ));
+  }
+
+  commandBuffer.pipelineBarrier({ vk::PipelineStageFlagBits::eAllCommands },
+                                { vk::PipelineStageFlagBits::eTransfer },
+                                {},
+                                vk::MemoryBarrier({ vk::AccessFlagBits::eMemoryWrite }, // srcAccessMask_
+                                                  { vk::AccessFlagBits::eTransferRead } // dstAccessMask_
+                                                  ),
+                                nullptr,
+                                preCopyBarriers);
+
+  for (auto const& [registeredBuffer, destination] : bufferMoves) {
+    commandBuffer.copyBuffer(registeredBuffer->m_Data.m_Handle,
+                             destination.m_Handle,
+                             vk::BufferCopy(0,                               // vk::DeviceSize srcOffset_ = {},
+                                            0,                               // vk::DeviceSize dstOffset_ = {},
+                                            registeredBuffer->m_Data.m_Size // vk::DeviceSize size_ = {}
+                                            ));
+  }
+
+  for (auto const& [registeredImage, destination] : imageMoves) {
+    auto subresourceLayers = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, // aspectMask_
+                                                        0,                               // mipLevel_
+                                                        0,                               // baseArrayLayer_
+                                                        1                                // layerCount_
+    );
+    auto region = vk::ImageCopy(subresourceLayers,     // vk::ImageSubresourceLayers srcSubresource_ = {},
+                                vk::Offset3D(0, 0, 0), // vk::Offset3D srcOffset_ = {},
+                                subresourceLayers,     // vk::ImageSubresourceLayers dstSubresource_ = {},
+                                vk::Offset3D(0, 0, 0), // vk::Offset3D dstOffset_ = {},
+                                vk::Extent3D(destination.m_Width, destination.m_Height, 1) // vk::Extent3D extent_ = {}
+    );
+    commandBuffer.copyImage(registeredImage->m_Data.m_Handle,
+                            vk::ImageLayout::eTransferSrcOptimal,
+                            destination.m_Handle,
+                            vk::ImageLayout::eTransferDstOptimal,
+                            region);
+  }
+
+  commandBuffer.pipelineBarrier({ vk::PipelineStageFlagBits::eTransfer },
+                                { vk::PipelineStageFlagBits::eAllCommands },
+                                {},
+                                vk::MemoryBarrier({ vk::AccessFlagBits::eTransferWrite }, // srcAccessMask_
+                                                  { vk::AccessFlagBits::eMemoryRead }     // dstAccessMask_
+                                                  ),
+                                nullptr,
+                                postCopyBarriers);
+
+  // The old resources are referenced by this frame at the latest, they can go once its fence signals
+  for (auto& [registeredBuffer, destination] : bufferMoves) {
+    std::string name = m_MemoryAllocator.GetAllocationName(registeredBuffer->m_Data.m_Allocation);
+    if (!name.empty()) { SetDebugName(destination, name); }
+    m_RetiredResources[frameResources.m_FrameIdx].m_Buffers.push_back(registeredBuffer->m_Data);
+    if (m_CommandStreamRecorder) {
+      m_CommandStreamRecorder->RecordMoveBuffer(registeredBuffer->m_Data.m_Handle, destination.m_Handle);
+    }
+    registeredBuffer->m_Data = destination;
+  }
+  for (auto& [registeredImage, destination] : imageMoves) {
+    std::string name = m_MemoryAllocator.GetAllocationName(registeredImage->m_Data.m_Allocation);
+    if (!name.empty()) { SetDebugName(destination, name); }
+    m_RetiredResources[frameResources.m_FrameIdx].m_Images.push_back(registeredImage->m_Data);
+    if (m_CommandStreamRecorder) {
+      m_CommandStreamRecorder->RecordMoveImage(registeredImage->m_Data.m_Handle, destination.m_Handle);
+    }
+    registeredImage->m_Data = destination;
+  }
+  ++m_ResourceGeneration;
+
+  std::ostringstream debugOutput;
+  debugOutput << "Moved " << bufferMoves.size() << " buffer(s) and " << imageMoves.size()
+              << " image(s) out of memory block #" << sourceBlockId;
+  Utils::Logger::Get().LogDebugEx("Defragmentation", "Renderer", __FILE__, __func__, __LINE__, debugOutput.str());
+}
+
+void VulkanRenderer::WriteImageDescriptor(vk::Sampler sampler, ImageHandle image, FrameResource const* frameResources)
+{
+  m_ImageDescriptorSampler = sampler;
+  m_ImageDescriptorImage = image;
+  ++m_ImageDescriptorVersion;
+  if (frameResources) { UpdateImageDescriptor(m_FrameResources[frameResources->m_FrameIdx]); }
+  if (m_CommandStreamRecorder) { m_CommandStreamRecorder->RecordWriteImageDescriptor(GetImage(image).m_Handle); }
+}
+
+void VulkanRenderer::UpdateImageDescriptor(FrameResource& frameResource)
+{
+  if (m_ImageDescriptorVersion == 0
+      || (frameResource.m_ImageDescriptorVersion == m_ImageDescriptorVersion
+          && frameResource.m_ImageDescriptorResourceGeneration == m_ResourceGeneration)) {
+    return;
+  }
+
+  ImageData imageData = GetImage(m_ImageDescriptorImage);
+  auto imageInfo = vk::DescriptorImageInfo(
+    m_ImageDescriptorSampler,               // vk::Sampler sampler_ = {},
+    imageData.m_View,                       // vk::ImageView imageView_ = {},
+    vk::ImageLayout::eShaderReadOnlyOptimal // vk::ImageLayout imageLayout_ = vk::ImageLayout::eUndefined
+  );
+
+  vk::WriteDescriptorSet imageAndSamplerDescriptorWrite =
+    vk::WriteDescriptorSet(frameResource.m_DescriptorSet,              // vk::DescriptorSet dstSet_ = {},
+                           0,                                         // uint32_t dstBinding_ = {},
+                           0,                                         // uint32_t dstArrayElement_ = {},
+                           1,                                         // uint32_t descriptorCount_ = {},
+                           vk::DescriptorType::eCombinedImageSampler, // vk::DescriptorType descriptorType_ =
+                                                                      // vk::DescriptorType::eSampler,
+                           &imageInfo, // const vk::DescriptorImageInfo* pImageInfo_ = {},
+                           nullptr,    // const vk::DescriptorBufferInfo* pBufferInfo_ = {},
+                           nullptr     // const vk::BufferView* pTexelBufferView_ = {}
+    );
+  m_VulkanParameters.m_Device.updateDescriptorSets(imageAndSamplerDescriptorWrite, nullptr);
+  frameResource.m_ImageDescriptorVersion = m_ImageDescriptorVersion;
+  frameResource.m_ImageDescriptorResourceGeneration = m_ResourceGeneration;
+}
+
+void VulkanRenderer::WriteUniformDescriptor(FrameResource const& frameResources,
+                                            void const* data,
+                                            vk::DeviceSize size)
+{
+  UploadAllocation uniformAllocation = frameResources.m_UploadArena->AllocateUniform(size);
+  memcpy(uniformAllocation.m_Ptr, data, size);
+
+  auto uniformBufferInfo = vk::DescriptorBufferInfo(uniformAllocation.m_Buffer, // vk::Buffer buffer_ = {},
+                                                    uniformAllocation.m_Offset, // vk::DeviceSize offset_ = {},
+                                                    uniformAllocation.m_Size    // vk::DeviceSize range_ = {}
+  );
+
+  auto uniformBufferDescriptorWrite = vk::WriteDescriptorSet(
+    frameResources.m_DescriptorSet,     // vk::DescriptorSet dstSet_ = {},
+    1,                                  // uint32_t dstBinding_ = {},
+    0,                                  // uint32_t dstArrayElement_ = {},
+    1,                                  // uint32_t descriptorCount_ = {},
+    vk::DescriptorType::eUniformBuffer, // vk::DescriptorType descriptorType_ = vk::DescriptorType::eSampler,
+    nullptr,                            // const vk::DescriptorImageInfo* pImageInfo_ = {},
+    &uniformBufferInfo,                 // const vk::DescriptorBufferInfo* pBufferInfo_ = {},
+    nullptr                             // const vk::BufferView* pTexelBufferView_ = {}
+  );
+  m_VulkanParameters.m_Device.updateDescriptorSets(uniformBufferDescriptorWrite, nullptr);
+  if (m_CommandStreamRecorder) { m_CommandStreamRecorder->RecordWriteUniformDescriptor(data, size); }
+}
+
+bool VulkanRenderer::StartCapture(std::filesystem::path const& path)
+{
+  auto recorder = std::make_unique<CommandStreamRecorder>();
+  if (!recorder->Open(path)) {
+    Utils::Logger::Get().LogErrorEx(
+      "Could not open the capture file", "Renderer", __FILE__, __func__, __LINE__, path.string());
+    return false;
+  }
+  m_CommandStreamRecorder = std::move(recorder);
+  return true;
+}
+
+void VulkanRenderer::StopCapture()
+{
+  if (!m_CommandStreamRecorder) { return; }
+
+  std::ostringstream debugOutput;
+  debugOutput << m_CommandStreamRecorder->GetFrameCount() << " frame(s) captured";
+  Utils::Logger::Get().LogInfoEx("Capture stopped", "Renderer", __FILE__, __func__, __LINE__, debugOutput.str());
+  m_CommandStreamRecorder.reset();
 }
 
 } // namespace Core
@@ -1,29 +1,86 @@
 #pragma once
 
+#include <array>
+#include <filesystem>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 
 #include "CopyToLocalBufferJob.h"
 #include "CopyToLocalImageJob.h"
+#include "MemoryAllocator.h"
 #include "os/Typedefs.h"
 #include "os/Window.h"
 
 namespace Core {
+class CommandStreamRecorder;
+class FrameCommandAllocator;
+class RenderGraph;
+class SharedBufferPool;
+class TransientResourcePool;
+class UploadArena;
+
+typedef uint32_t RenderGraphResourceId;
+
+// Wall clock time the render thread spent in each phase of RenderCore
+struct CpuFrameTimings
+{
+  double m_FenceWaitInMs;
+  double m_AcquireInMs;
+  double m_PreRenderInMs;
+  double m_RecordInMs; // BeginFrame, Render and EndFrame
+  double m_SubmitInMs;
+  double m_PresentInMs;
+};
+
+// Counters of the whole frame, only filled in when the device supports pipelineStatisticsQuery. Fragment invocations
+// over the pixel count give the overdraw, vertex invocations over the input vertices the post-transform cache misses.
+struct PipelineStatistics
+{
+  uint64_t m_InputAssemblyVertices;
+  uint64_t m_VertexShaderInvocations;
+  uint64_t m_ClippingPrimitives;
+  uint64_t m_FragmentShaderInvocations;
+};
+
+struct PassTimestamps
+{
+  char const* m_Name; // not copied, has to outlive the frame stats, string literals are fine
+  uint64_t m_BeginTimestamp;
+  uint64_t m_EndTimestamp;
+};
 
 struct FrameStat
 {
+  static constexpr uint32_t MaxTimedPasses = 16;
+
   uint64_t m_BeginFrameTimestamp;
   uint64_t m_EndFrameTimestamp;
+  std::array<PassTimestamps, MaxTimedPasses> m_Passes;
+  uint32_t m_PassCount;
+  PipelineStatistics m_PipelineStatistics;
+  bool m_HasPipelineStatistics;
+  // The timestamps are read back once the fence of the frame that wrote them has signaled, so they belong to an older
+  // frame than the one being recorded
+  uint64_t m_FrameNumber;
+  // Recorded for the same frame as the timestamps, so CPU and GPU time of a slow frame can be compared directly
+  CpuFrameTimings m_CpuTimings;
+  // Binds and dynamic state that RecordingCommandBuffer dropped because they were already set
+  uint32_t m_ElidedCommandCount;
+  bool m_IsValid;
 };
 
 struct SwapchainImage
 {
   uint32_t m_ImageIdx;
+  vk::Image m_Image;
   vk::ImageView m_ImageView;
   uint32_t m_ImageWidth;
   uint32_t m_ImageHeight;
+  RenderGraphResourceId m_GraphResourceId; // imported into the frame's render graph, presented at the end of it
 };
 
 struct ImageData
@@ -33,6 +90,10 @@ struct ImageData
   uint32_t m_Height;
   vk::DeviceMemory m_Memory;
   vk::ImageView m_View;
+  vk::Format m_Format;
+  vk::ImageUsageFlags m_Usage;
+  vk::MemoryPropertyFlags m_MemoryProperties;
+  MemoryAllocation m_Allocation;
 };
 
 struct BufferData
@@ -40,20 +101,51 @@ struct BufferData
   vk::DeviceSize m_Size;
   vk::DeviceMemory m_Memory;
   vk::Buffer m_Handle;
+  vk::BufferUsageFlags m_Usage;
+  vk::MemoryPropertyFlags m_MemoryProperties;
+  MemoryAllocation m_Allocation;
+};
+
+// Indirection over BufferData/ImageData for resources that the renderer is allowed to move around in device memory.
+// Users have to look the resource up every frame instead of caching its handles.
+struct BufferHandle
+{
+  uint32_t m_Idx;
+};
+
+struct ImageHandle
+{
+  uint32_t m_Idx;
 };
 
 struct FrameResource
 {
+  static constexpr uint64_t InvalidFrameNumber = std::numeric_limits<uint64_t>::max();
+
   uint32_t m_FrameIdx;
+  uint64_t m_FrameNumber;
   vk::Fence m_Fence;
   vk::Framebuffer m_Framebuffer;
   vk::Semaphore m_PresentToDrawSemaphore;
   vk::Semaphore m_DrawToPresentSemaphore;
+  vk::Semaphore m_ComputeToDrawSemaphore; // signaled by the frame's async compute work, if it has any
   vk::CommandBuffer m_CommandBuffer;
-  vk::QueryPool m_QueryPool;
+  vk::QueryPool m_QueryPool; // frame begin and end, then a begin and end pair per timed pass
+  vk::QueryPool m_PipelineStatisticsQueryPool;
+  std::array<char const*, FrameStat::MaxTimedPasses> m_PassNames;
+  uint32_t m_PassCount;
+  uint32_t m_ElidedCommandCount;
   SwapchainImage m_SwapchainImage;
   FrameStat m_FrameStat;
-  BufferData m_UniformBuffer;
+  CpuFrameTimings m_CpuTimings;
+  std::shared_ptr<UploadArena> m_UploadArena;
+  std::shared_ptr<FrameCommandAllocator> m_CommandAllocator;
+  std::shared_ptr<TransientResourcePool> m_TransientResourcePool;
+  std::shared_ptr<RenderGraph> m_RenderGraph;
+  // Only written while the frame is not in flight, the texture binding is brought up to date when it is acquired
+  vk::DescriptorSet m_DescriptorSet;
+  uint64_t m_ImageDescriptorVersion;
+  uint64_t m_ImageDescriptorResourceGeneration;
 };
 
 struct Swapchain
@@ -62,9 +154,22 @@ struct Swapchain
   vk::Format m_Format;
   std::vector<vk::Image> m_Images;
   std::vector<vk::ImageView> m_ImageViews;
+  std::vector<vk::Framebuffer> m_Framebuffers; // one per image view, only rebuilt with the swapchain
   vk::Extent2D m_ImageExtent;
 };
 
+// Latency oriented pacing keeps few frames in flight with a present mode that does not block on the display, throughput
+// oriented pacing queues more frames and presents in FIFO order so the GPU never runs dry.
+struct FramePacing
+{
+  uint32_t m_FramesInFlight;
+  vk::PresentModeKHR m_PresentMode;
+  double m_FrameLimitInMs; // CPU side frame limiter, 0 disables it
+
+  static FramePacing LowLatency() { return FramePacing{ 1, vk::PresentModeKHR::eMailbox, 0.0 }; }
+  static FramePacing Throughput() { return FramePacing{ 3, vk::PresentModeKHR::eFifo, 0.0 }; }
+};
+
 struct VertexData
 {
   float m_Position[4];
@@ -79,26 +184,35 @@ struct VulkanParameters
   vk::Device m_Device;
   vk::Queue m_GraphicsQueue;
   vk::Queue m_TransferQueue;
+  vk::Queue m_ComputeQueue; // the graphics queue where the device has no compute family without graphics
   QueueFamilyIdx m_GraphicsQueueFamilyIdx;
   QueueFamilyIdx m_TransferQueueFamilyIdx;
+  QueueFamilyIdx m_ComputeQueueFamilyIdx;
   vk::SurfaceKHR m_PresentSurface;
   vk::SurfaceCapabilitiesKHR m_SurfaceCapabilities;
   Swapchain m_Swapchain;
-  bool m_VsyncEnabled;
+  vk::PresentModeKHR m_PresentMode; // requested, the swapchain falls back to a supported one
   vk::RenderPass m_RenderPass;
   vk::Pipeline m_Pipeline;
   vk::PipelineLayout m_PipelineLayout;
   vk::QueryPool m_QueryPool;
   float m_TimestampPeriod;
+  bool m_PipelineStatisticsSupported;
+  bool m_MultiDrawIndirectSupported;
+  bool m_DrawIndirectCountSupported;
+  bool m_DrawIndirectFirstInstanceSupported;
   vk::DescriptorSetLayout m_DescriptorSetLayout;
   vk::DescriptorPool m_DescriptorPool;
-  vk::DescriptorSet m_DescriptorSet;
+  std::vector<vk::DescriptorSet> m_DescriptorSets; // one per possible frame resource
   VulkanParameters();
 };
 
 class VulkanRenderer
 {
 public:
+  // Upper bound of the frame pacing's frames in flight, per frame resources are sized for it
+  static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+
   VulkanRenderer(bool vsyncEnabled = false, uint32_t frameResourcesCount = 3);
   VulkanRenderer(VulkanRenderer const& other) = default;
   VulkanRenderer(VulkanRenderer&& other) = default;
@@ -108,7 +222,16 @@ public:
 
   [[nodiscard]] bool CanRender() const { return m_CanRender; }
 
+  // Safe to call from any thread, the new settings are picked up by the render thread in ApplyFramePacing
+  void SetFramePacing(FramePacing const& framePacing);
+  [[nodiscard]] FramePacing GetFramePacing();
+  bool ApplyFramePacing();
+
   bool Initialize(Os::WindowParameters windowParameters);
+  // Presents to a VK_EXT_headless_surface of a fixed extent instead of a window, everything past the surface creation
+  // runs the same code path, so it can be used to measure throughput on machines without a display
+  bool InitializeHeadless(vk::Extent2D extent);
+  [[nodiscard]] bool IsHeadless() const { return m_IsHeadless; }
   BufferData CreateBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags requiredProperties);
   void FreeBuffer(BufferData& vertexBuffer);
   ImageData CreateImage(uint32_t width,
@@ -118,16 +241,67 @@ public:
 
   void FreeImage(ImageData& imageData);
 
+  // Raw memory for users that create and bind their resources themselves, e.g. to alias several of them
+  MemoryAllocation AllocateMemory(vk::MemoryRequirements const& requirements,
+                                  vk::MemoryPropertyFlags requiredProperties,
+                                  MemoryResourceKind kind);
+  void FreeMemory(MemoryAllocation const& allocation);
+
+  // Names show up in validation messages, capture tools and the memory statistics dump
+  void SetDebugName(BufferData const& buffer, std::string const& name);
+  void SetDebugName(ImageData const& image, std::string const& name);
+
+  // Writes per heap and memory type usage plus the largest allocations as JSON into the log directory
+  std::filesystem::path DumpMemoryStats(uint32_t topAllocationCount = 32);
+
+  BufferHandle RegisterBuffer(BufferData const& buffer);
+  [[nodiscard]] BufferData GetBuffer(BufferHandle handle);
+  void ReleaseBuffer(BufferHandle handle);
+  ImageHandle RegisterImage(ImageData const& image, vk::ImageLayout layout);
+  [[nodiscard]] ImageData GetImage(ImageHandle handle);
+  void ReleaseImage(ImageHandle handle);
+  [[nodiscard]] uint64_t GetResourceGeneration() const { return m_ResourceGeneration; }
+
+  void SetDefragmentationBudget(double budgetInMs) { m_DefragmentationBudgetInMs = budgetInMs; }
+  void Defragment(FrameResource const& frameResources, vk::CommandBuffer commandBuffer);
+
   void SubmitToGraphicsQueue(vk::SubmitInfo& submitInfo, vk::Fence fence);
   void SubmitToTransferQueue(vk::SubmitInfo& submitInfo, vk::Fence fence);
+  // Work submitted here can overlap the graphics queue, it has to be ordered against it with semaphores. Resources
+  // shared between the two need queue family ownership transfers unless the families match or they are concurrent.
+  void SubmitToComputeQueue(vk::SubmitInfo& submitInfo, vk::Fence fence);
+  // Whether the compute queue comes from its own family, otherwise compute submissions end up on the graphics queue
+  inline bool IsAsyncComputeAvailable() const
+  {
+    return m_VulkanParameters.m_ComputeQueueFamilyIdx != m_VulkanParameters.m_GraphicsQueueFamilyIdx;
+  }
+  inline uint32_t GetGraphicsQueueFamilyIdx() const { return m_VulkanParameters.m_GraphicsQueueFamilyIdx; }
+  inline uint32_t GetComputeQueueFamilyIdx() const { return m_VulkanParameters.m_ComputeQueueFamilyIdx; }
+  // Indirect draws with more than one command, and with the command count read from a buffer as well
+  inline bool IsMultiDrawIndirectSupported() const { return m_VulkanParameters.m_MultiDrawIndirectSupported; }
+  inline bool IsDrawIndirectCountSupported() const { return m_VulkanParameters.m_DrawIndirectCountSupported; }
+  // Indirect commands with a first instance other than 0
+  inline bool IsDrawIndirectFirstInstanceSupported() const
+  {
+    return m_VulkanParameters.m_DrawIndirectFirstInstanceSupported;
+  }
 
   inline vk::RenderPass GetRenderPass() const { return m_VulkanParameters.m_RenderPass; }
+  inline vk::Format GetSwapchainImageFormat() const { return m_VulkanParameters.m_Swapchain.m_Format; }
   inline vk::Pipeline GetPipeline() const { return m_VulkanParameters.m_Pipeline; }
   inline vk::Device GetDevice() const { return m_VulkanParameters.m_Device; }
+  inline vk::PhysicalDevice GetPhysicalDevice() const { return m_VulkanParameters.m_PhysicalDevice; }
+  // Reads the SPIR-V from a file relative to the working directory
+  vk::UniqueShaderModule CreateShaderModule(char const* filename);
   vk::DeviceSize GetNonCoherentAtomSize() const;
+  vk::DeviceSize GetMinUniformBufferOffsetAlignment() const;
+  // Statistics counted by the frame's query, nothing without device support. Secondary command buffers executed
+  // inside the frame have to inherit them.
+  vk::QueryPipelineStatisticFlags GetPipelineStatisticFlags() const;
 
   vk::CommandPool CreateGraphicsCommandPool();
   vk::CommandPool CreateTransferCommandPool();
+  vk::CommandPool CreateComputeCommandPool();
   vk::CommandBuffer VulkanRenderer::AllocateCommandBuffer(vk::CommandPool commandPool);
   void VulkanRenderer::InitializeFrameResources();
   std::tuple<vk::Result, FrameResource> AcquireNextFrameResources();
@@ -137,6 +311,17 @@ public:
   vk::Result VulkanRenderer::PresentFrame(FrameResource& frameResources);
   bool RecreateSwapchain();
   double GetFrameTimeInMs(FrameStat const& frameStat);
+  double GetPassTimeInMs(PassTimestamps const& passTimestamps);
+  // Brackets a pass with timestamps that come back in the frame's FrameStat. Passes must not nest, the ones over
+  // FrameStat::MaxTimedPasses are not timed.
+  uint32_t BeginTimedPass(FrameResource const& frameResources, vk::CommandBuffer commandBuffer, char const* name);
+  void EndTimedPass(FrameResource const& frameResources, vk::CommandBuffer commandBuffer, uint32_t passIdx);
+  // Stores the timings of the phases recorded by the application, they come back in the frame's FrameStat once the
+  // GPU has finished it. The fence wait and acquire times are already filled in by AcquireNextFrameResources.
+  void SetCpuFrameTimings(FrameResource const& frameResources, CpuFrameTimings const& cpuTimings);
+  // Adds to the count that comes back in the frame's FrameStat, e.g. RecordingCommandBuffer::GetElidedCommandCount at
+  // the end of a pass
+  void AddElidedCommandCount(FrameResource const& frameResources, uint32_t elidedCommandCount);
   void CopyToLocalBuffer(std::shared_ptr<Core::CopyToLocalBufferJob> transferJob,
                          vk::CommandBuffer graphicsCommandBuffer,
                          vk::CommandBuffer transferCommandBuffer,
@@ -149,11 +334,30 @@ public:
                         vk::Buffer sourceBuffer,
                         vk::DeviceSize sourceOffset);
 
-  vk::DescriptorSet GetDescriptorSet() { return m_VulkanParameters.m_DescriptorSet; }
+  // Every frame resource has a set of its own, so writing it never touches a set used by a frame still in flight
+  inline vk::DescriptorSet GetDescriptorSet(FrameResource const& frameResources) const
+  {
+    return frameResources.m_DescriptorSet;
+  }
+  // Combined image sampler at binding 0 and the uniform buffer at binding 1, copied into the frame's upload arena.
+  // Both are part of a running capture, unlike descriptor writes done directly on the device.
+  //
+  // The image goes into the set of the given frame right away, the other sets are rewritten as their frames are
+  // acquired. Moves of the image by the defragmenter are picked up the same way, there is no need to write it again.
+  void WriteImageDescriptor(vk::Sampler sampler, ImageHandle image, FrameResource const* frameResources = nullptr);
+  void WriteUniformDescriptor(FrameResource const& frameResources, void const* data, vk::DeviceSize size);
+  SharedBufferPool* GetSharedBufferPool() { return m_SharedBufferPool.get(); }
   vk::PipelineLayout GetPipelineLayout() { return m_VulkanParameters.m_PipelineLayout; }
 
   [[nodiscard]] vk::Extent2D GetSwapchainExtent() const;
 
+  // Serializes resource creation, uploads, descriptor writes, frame boundaries and the commands recorded through a
+  // RecordingCommandBuffer into a file that CommandStreamPlayer replays. Not to be started or stopped while rendering.
+  bool StartCapture(std::filesystem::path const& path);
+  void StopCapture();
+  // Null while no capture is running
+  CommandStreamRecorder* GetCommandStreamRecorder() { return m_CommandStreamRecorder.get(); }
+
 private:
   void Free();
 
@@ -184,8 +388,8 @@ private:
 
   bool CreateGraphicsQueue();
   bool CreateTransferQueue();
+  bool CreateComputeQueue();
 
-  vk::UniqueShaderModule CreateShaderModule(char const* filename);
   vk::PipelineLayout CreatePipelineLayout();
 
   bool CreateSwapchain();
@@ -193,7 +397,8 @@ private:
 
   bool CreateDescriptorSetLayout();
   bool CreateDescriptorPool();
-  bool AllocateDescriptorSet();
+  bool AllocateDescriptorSets();
+  void UpdateImageDescriptor(FrameResource& frameResource);
 
   bool CreateRenderPass();
   bool CreatePipeline();
@@ -206,8 +411,58 @@ private:
   bool CreateQueryPool();
 
   bool CreateFramebuffer(vk::Framebuffer& framebuffer, vk::ImageView& imageView);
+  bool CreateSwapchainFramebuffers();
+  void DestroySwapchain(Swapchain& swapchain);
+  void FreeRetiredSwapchains(bool force);
+
+  BufferData AllocateBuffer(vk::DeviceSize size,
+                            vk::BufferUsageFlags usage,
+                            vk::MemoryPropertyFlags requiredProperties,
+                            MemoryAllocationOptions const& options);
+  ImageData AllocateImage(uint32_t width,
+                          uint32_t height,
+                          vk::Format format,
+                          vk::ImageUsageFlags usage,
+                          vk::MemoryPropertyFlags requiredProperties,
+                          MemoryAllocationOptions const& options);
+  void DestroyBuffer(BufferData& buffer);
+  void DestroyImage(ImageData& image);
+  void FreeRetiredResources(uint32_t frameIdx);
+  void ReadFrameStat(FrameResource& frameResource);
+
+  struct RegisteredBuffer
+  {
+    BufferData m_Data;
+    bool m_InUse;
+  };
+
+  struct RegisteredImage
+  {
+    ImageData m_Data;
+    vk::ImageLayout m_Layout;
+    bool m_InUse;
+  };
+
+  struct RetiredResources
+  {
+    std::vector<BufferData> m_Buffers;
+    std::vector<ImageData> m_Images;
+  };
 
   std::vector<FrameResource> m_FrameResources;
+  std::vector<RetiredResources> m_RetiredResources;
+
+  struct RetiredSwapchain
+  {
+    Swapchain m_Swapchain;
+    uint64_t m_FrameCount; // frames numbered below this may still render into or present the swapchain
+  };
+
+  std::vector<RetiredSwapchain> m_RetiredSwapchains;
+
+  // Holds the uniforms and the sprite instance stream, a 40 byte instance puts 100k sprites at 4 MB
+  static constexpr vk::DeviceSize UPLOAD_ARENA_SIZE = 16 * 1024 * 1024;
+  static constexpr float DEFRAGMENTATION_MAX_OCCUPANCY = 0.5f;
 
 protected:
   vk::DynamicLoader m_DynamicLoader;
@@ -218,9 +473,28 @@ protected:
 private:
   uint32_t m_FrameResourcesCount;
   Os::WindowParameters m_WindowParameters;
+  bool m_IsHeadless;
+  vk::Extent2D m_HeadlessExtent;
   volatile uint32_t m_CurrentResourceIdx;
+  uint64_t m_FrameCounter;
+  uint64_t m_CompletedFrameCount;
   FrameStat m_FrameStat;
   std::mutex m_GraphicsQueueSubmitCriticalSection;
   std::mutex m_TransferQueueSubmitCriticalSection;
+  std::mutex m_ComputeQueueSubmitCriticalSection;
+  MemoryAllocator m_MemoryAllocator;
+  std::unique_ptr<SharedBufferPool> m_SharedBufferPool;
+  std::unique_ptr<CommandStreamRecorder> m_CommandStreamRecorder;
+  std::mutex m_ResourceTableCriticalSection;
+  std::vector<RegisteredBuffer> m_RegisteredBuffers;
+  std::vector<RegisteredImage> m_RegisteredImages;
+  uint64_t m_ResourceGeneration;
+  vk::Sampler m_ImageDescriptorSampler;
+  ImageHandle m_ImageDescriptorImage;
+  uint64_t m_ImageDescriptorVersion; // bumped by every WriteImageDescriptor, 0 before the first one
+  double m_DefragmentationBudgetInMs;
+  std::mutex m_FramePacingCriticalSection;
+  FramePacing m_FramePacing;
+  bool m_FramePacingChanged;
 };
 } // namespace Core
@@ -1,7 +1,16 @@
 #include "core/Application.h"
+#include "core/CommandStreamPlayer.h"
+#include "core/CommandStreamRecorder.h"
 #include "core/CopyToLocalBufferJob.h"
 #include "core/CopyToLocalImageJob.h"
+#include "core/CpuCuller.h"
+#include "core/DynamicResolution.h"
+#include "core/GpuCuller.h"
 #include "core/Mat4.h"
+#include "core/RenderGraph.h"
+#include "core/RenderQueue.h"
+#include "core/SharedBufferPool.h"
+#include "core/SpriteBatcher.h"
 #include "core/Transition.h"
 #include "core/VulkanFunctions.h"
 #include "core/VulkanRenderer.h"
@@ -10,14 +19,20 @@
 #include "utils/ConsoleLogger.h"
 #include "utils/FileLogger.h"
 #include "utils/Logger.h"
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
 #include <filesystem>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <random>
 #include <sstream>
 #include <thread>
 #include <vector>
@@ -33,7 +48,18 @@ public:
     return Core::Mat4::GetOrthographic(-halfWidth, halfWidth, -halfHeight, halfHeight, -1.0f, 1.0f);
   }
 
-  SampleApp() : Core::Application(), m_Transition(Core::Transition())
+  SampleApp() :
+    Core::Application(),
+    m_Transition(Core::Transition()),
+    m_DynamicResolution(Core::DynamicResolution()),
+    m_IsDynamicResolutionRequested(m_DynamicResolution.IsEnabled()),
+    m_IsDynamicResolutionSupported(false),
+    m_RenderQueue(),
+    m_SpriteBatcher(),
+    m_IsSpriteDemoEnabled(false),
+    m_GpuCuller(),
+    m_SpriteField(Core::BufferData()),
+    m_IsCullingDemoEnabled(false)
   {
     std::filesystem::path debugLog = Os::GetExecutableDirectory() / "logs/everything.log";
     std::filesystem::path keyboardLog = Os::GetExecutableDirectory() / "logs/keyboard.log";
@@ -55,9 +81,16 @@ public:
 
   virtual ~SampleApp() {}
 
-  bool Initialize()
+  // A non-zero headless frame count renders that many frames without a window and exits, a non-empty capture path
+  // records the session for ReplayApp
+  bool Initialize(uint64_t headlessFrameCount, std::filesystem::path const& capturePath)
   {
-    Application::Initialize(L"Hello Vulkan!", 1280, 720);
+    if (headlessFrameCount > 0) {
+      if (!Application::InitializeHeadless(1280, 720, headlessFrameCount)) { return false; }
+    } else {
+      Application::Initialize(L"Hello Vulkan!", 1280, 720);
+    }
+    if (!capturePath.empty() && !Renderer()->StartCapture(capturePath)) { return false; }
     GetWindow()->SetOnCharacterReceived([this](Os::Window* window, uint32_t codePoint, Core::ModifierKeys modifiers) {
       OnCharacterReceived(window, codePoint, modifiers);
     });
@@ -76,6 +109,8 @@ public:
     QueryPerformanceCounter(&m_StartTime);
     QueryPerformanceFrequency(&m_Frequency);
 
+    Renderer()->SetDefragmentationBudget(0.5);
+
     return true;
   }
 
@@ -106,6 +141,45 @@ public:
     debugMessage << "Keycode " << std::showbase << std::hex << static_cast<int>(keyCode) << " " << Core::enum_to_string(action)
                  << ", modifiers: " << Core::enum_to_string(modifiers) << ", repeatCount: " << std::dec << repeatCount;
     Utils::Logger::Get().LogDebug(debugMessage.str(), "Keyboard");
+
+    if (action != Core::KeypressAction::Pressed) { return; }
+
+    Core::FramePacing framePacing = Renderer()->GetFramePacing();
+    switch (keyCode) {
+    case VK_F1:
+      Renderer()->SetFramePacing(Core::FramePacing::LowLatency());
+      break;
+    case VK_F2:
+      Renderer()->SetFramePacing(Core::FramePacing::Throughput());
+      break;
+    case VK_F3:
+      framePacing.m_FrameLimitInMs = framePacing.m_FrameLimitInMs > 0.0 ? 0.0 : 1000.0 / 60.0;
+      Renderer()->SetFramePacing(framePacing);
+      break;
+    case VK_F4:
+      framePacing.m_PresentMode = vk::PresentModeKHR::eFifoRelaxed;
+      Renderer()->SetFramePacing(framePacing);
+      break;
+    case VK_F5:
+      // Only the window thread writes the request, the render thread applies it at the start of its next frame
+      m_IsDynamicResolutionRequested = !m_IsDynamicResolutionRequested;
+      break;
+    case VK_F6:
+      m_IsSpriteDemoEnabled = !m_IsSpriteDemoEnabled;
+      break;
+    case VK_F7:
+      m_IsCullingDemoEnabled = !m_IsCullingDemoEnabled;
+      break;
+    case VK_F12:
+      // Runs on the window thread, a failed dump must not take the application down
+      try {
+        Renderer()->DumpMemoryStats();
+      } catch (std::exception const& e) {
+        Utils::Logger::Get().LogErrorEx(
+          "Could not dump the memory statistics", "Renderer", __FILE__, __func__, __LINE__, e.what());
+      }
+      break;
+    }
   }
 
   void InitializeRenderer() override
@@ -117,10 +191,8 @@ public:
       Core::VertexData{ { 256.0f, -256.0f, 0.0f, 1.0f }, { 1.0f, 0.0f } }   // top right
     };
 
-    m_VertexBuffer =
-      Renderer()->CreateBuffer(static_cast<uint32_t>(m_Vertices.size()) * sizeof(Core::VertexData),
-                               { vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer },
-                               { vk::MemoryPropertyFlagBits::eDeviceLocal });
+    m_VertexRange = Renderer()->GetSharedBufferPool()->AllocateVertices(static_cast<uint32_t>(m_Vertices.size()),
+                                                                         sizeof(Core::VertexData));
 
     // create sampler
     auto samplerCreateInfo = vk::SamplerCreateInfo(
@@ -148,8 +220,8 @@ public:
       new Core::CopyToLocalBufferJob(Renderer(),
                                      m_Vertices.data(),
                                      static_cast<uint32_t>(m_Vertices.size() * sizeof(Core::VertexData)),
-                                     m_VertexBuffer.m_Handle,
-                                     vk::DeviceSize(0),
+                                     m_VertexRange.m_Buffer,
+                                     m_VertexRange.m_Offset,
                                      { vk::AccessFlagBits::eVertexAttributeRead },
                                      { vk::PipelineStageFlagBits::eVertexInput },
                                      nullptr));
@@ -161,82 +233,125 @@ public:
     uint32_t textureWidth, textureHeight;
     std::vector<char> textureData = Os::LoadTextureData("assets/Avatar_cat.png", textureWidth, textureHeight);
 
-    m_Texture = Renderer()->CreateImage(textureWidth,
-                                        textureHeight,
-                                        { vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst },
-                                        { vk::MemoryPropertyFlagBits::eDeviceLocal });
+    Core::ImageData texture = Renderer()->CreateImage(textureWidth,
+                                                      textureHeight,
+                                                      { vk::ImageUsageFlagBits::eSampled
+                                                        | vk::ImageUsageFlagBits::eTransferSrc
+                                                        | vk::ImageUsageFlagBits::eTransferDst },
+                                                      { vk::MemoryPropertyFlagBits::eDeviceLocal });
+    Renderer()->SetDebugName(texture, "Avatar_cat texture");
 
     auto textureCopyJob =
       std::shared_ptr<Core::CopyToLocalJob>(new Core::CopyToLocalImageJob(Renderer(),
                                                                           textureData.data(),
                                                                           textureData.size(),
-                                                                          m_Texture.m_Width,
-                                                                          m_Texture.m_Height,
-                                                                          m_Texture.m_Handle,
+                                                                          texture.m_Width,
+                                                                          texture.m_Height,
+                                                                          texture.m_Handle,
                                                                           vk::ImageLayout::eShaderReadOnlyOptimal,
                                                                           vk::AccessFlagBits::eShaderRead,
                                                                           vk::PipelineStageFlagBits::eFragmentShader,
                                                                           nullptr));
     AddToTransferQueue(textureCopyJob);
     textureCopyJob->WaitComplete();
+    m_TextureHandle = Renderer()->RegisterImage(texture, vk::ImageLayout::eShaderReadOnlyOptimal);
 
-    auto imageInfo = vk::DescriptorImageInfo(
-      m_Sampler,                              // vk::Sampler sampler_ = {},
-      m_Texture.m_View,                       // vk::ImageView imageView_ = {},
-      vk::ImageLayout::eShaderReadOnlyOptimal // vk::ImageLayout imageLayout_ = vk::ImageLayout::eUndefined
-    );
+    // Follows the texture around when the defragmenter moves it
+    Renderer()->WriteImageDescriptor(m_Sampler, m_TextureHandle);
 
-    vk::WriteDescriptorSet imageAndSamplerDescriptorWrite =
-      vk::WriteDescriptorSet(Renderer()->GetDescriptorSet(),            // vk::DescriptorSet dstSet_ = {},
-                             0,                                         // uint32_t dstBinding_ = {},
-                             0,                                         // uint32_t dstArrayElement_ = {},
-                             1,                                         // uint32_t descriptorCount_ = {},
-                             vk::DescriptorType::eCombinedImageSampler, // vk::DescriptorType descriptorType_ =
-                                                                        // vk::DescriptorType::eSampler,
-                             &imageInfo, // const vk::DescriptorImageInfo* pImageInfo_ = {},
-                             nullptr,    // const vk::DescriptorBufferInfo* pBufferInfo_ = {},
-                             nullptr     // const vk::BufferView* pTexelBufferView_ = {}
-      );
-    Renderer()->GetDevice().updateDescriptorSets(imageAndSamplerDescriptorWrite, nullptr);
+    m_SpriteBatcher = std::make_unique<Core::SpriteBatcher>(Renderer());
+    CreateSpriteField();
+    m_IsDynamicResolutionSupported =
+      Core::DynamicResolution::IsSupported(*Renderer(), Renderer()->GetSwapchainImageFormat());
   }
 
-  void PreRender(Core::FrameResource const& frameResources) override
+  // A static field of sprites much larger than the window, split into square chunks that are culled on the GPU. The
+  // sprites of a chunk are consecutive instances, so a visible chunk is a single indirect draw.
+  void CreateSpriteField()
   {
-    Core::Mat4 uniformData = GetUniformData();
-    auto uniformTransfer = std::shared_ptr<Core::CopyToLocalBufferJob>(
+    uint32_t const chunksPerSide = FieldSpritesPerSide / FieldChunkSide;
+    uint32_t const spritesPerChunk = FieldChunkSide * FieldChunkSide;
+    float const fieldOrigin = -static_cast<float>(FieldSpritesPerSide) * FieldSpacing / 2.0f;
+    float const chunkExtent = static_cast<float>(FieldChunkSide) * FieldSpacing;
+
+    std::vector<Core::Sprite> sprites;
+    std::vector<Core::CullObject> objects;
+    sprites.reserve(FieldSpritesPerSide * FieldSpritesPerSide);
+    objects.reserve(chunksPerSide * chunksPerSide);
+    for (uint32_t chunkY = 0; chunkY != chunksPerSide; ++chunkY) {
+      for (uint32_t chunkX = 0; chunkX != chunksPerSide; ++chunkX) {
+        float chunkLeft = fieldOrigin + static_cast<float>(chunkX) * chunkExtent;
+        float chunkTop = fieldOrigin + static_cast<float>(chunkY) * chunkExtent;
+        // Half the chunk's diagonal plus room for the corners of rotated sprites
+        objects.push_back(Core::CullObject{ { chunkLeft + chunkExtent / 2.0f, chunkTop + chunkExtent / 2.0f, 0.0f },
+                                            chunkExtent * 0.7072f + FieldSpacing,
+                                            4,
+                                            spritesPerChunk,
+                                            0,
+                                            static_cast<uint32_t>(sprites.size()) });
+
+        for (uint32_t spriteIdx = 0; spriteIdx != spritesPerChunk; ++spriteIdx) {
+          float x = chunkLeft + (static_cast<float>(spriteIdx % FieldChunkSide) + 0.5f) * FieldSpacing;
+          float y = chunkTop + (static_cast<float>(spriteIdx / FieldChunkSide) + 0.5f) * FieldSpacing;
+          float u = (x - fieldOrigin) / (-2.0f * fieldOrigin);
+          float v = (y - fieldOrigin) / (-2.0f * fieldOrigin);
+          sprites.push_back(Core::Sprite{ { x, y },
+                                          { FieldSpacing - 2.0f, FieldSpacing - 2.0f },
+                                          { 0.0f, 0.0f, 1.0f, 1.0f },
+                                          (u + v) * 6.2831853f,
+                                          Core::Sprite::PackColor(u, v, 1.0f - u, 1.0f) });
+        }
+      }
+    }
+
+    m_SpriteField = Renderer()->CreateBuffer(
+      sprites.size() * sizeof(Core::Sprite),
+      { vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst },
+      { vk::MemoryPropertyFlagBits::eDeviceLocal });
+    Renderer()->SetDebugName(m_SpriteField, "Sprite field");
+    m_GpuCuller = std::make_unique<Core::GpuCuller>(Renderer(), static_cast<uint32_t>(objects.size()));
+
+    auto spriteCopyJob = std::shared_ptr<Core::CopyToLocalJob>(
+      new Core::CopyToLocalBufferJob(Renderer(),
+                                     sprites.data(),
+                                     sprites.size() * sizeof(Core::Sprite),
+                                     m_SpriteField.m_Handle,
+                                     0,
+                                     { vk::AccessFlagBits::eVertexAttributeRead },
+                                     { vk::PipelineStageFlagBits::eVertexInput },
+                                     nullptr));
+    auto objectCopyJob = std::shared_ptr<Core::CopyToLocalJob>(
       new Core::CopyToLocalBufferJob(Renderer(),
-                                     reinterpret_cast<void*>(uniformData.GetData()),
-                                     Core::Mat4::GetSize(),
-                                     frameResources.m_UniformBuffer.m_Handle,
-                                     vk::DeviceSize(0),
+                                     objects.data(),
+                                     objects.size() * sizeof(Core::CullObject),
+                                     m_GpuCuller->GetObjectBuffer(),
+                                     0,
                                      { vk::AccessFlagBits::eShaderRead },
-                                     { vk::PipelineStageFlagBits::eVertexShader },
+                                     { vk::PipelineStageFlagBits::eComputeShader },
                                      nullptr));
+    AddToTransferQueue(spriteCopyJob);
+    AddToTransferQueue(objectCopyJob);
+    spriteCopyJob->WaitComplete();
+    objectCopyJob->WaitComplete();
+  }
 
-    AddToTransferQueue(uniformTransfer);
-    uniformTransfer->WaitComplete();
-
-    auto uniformBufferInfo =
-      vk::DescriptorBufferInfo(frameResources.m_UniformBuffer.m_Handle, // vk::Buffer buffer_ = {},
-                               vk::DeviceSize(0),                       // vk::DeviceSize offset_ = {},
-                               Core::Mat4::GetSize()                    // vk::DeviceSize range_ = {}
-      );
-
-    auto uniformBufferDescriptorWrite = vk::WriteDescriptorSet(
-      Renderer()->GetDescriptorSet(),     // vk::DescriptorSet dstSet_ = {},
-      1,                                  // uint32_t dstBinding_ = {},
-      0,                                  // uint32_t dstArrayElement_ = {},
-      1,                                  // uint32_t descriptorCount_ = {},
-      vk::DescriptorType::eUniformBuffer, // vk::DescriptorType descriptorType_ = vk::DescriptorType::eSampler,
-      nullptr,                            // const vk::DescriptorImageInfo* pImageInfo_ = {},
-      &uniformBufferInfo,                 // const vk::DescriptorBufferInfo* pBufferInfo_ = {},
-      nullptr                             // const vk::BufferView* pTexelBufferView_ = {}
-    );
-    Renderer()->GetDevice().updateDescriptorSets(uniformBufferDescriptorWrite, nullptr);
+  void PreRender(Core::FrameResource const& frameResources) override
+  {
+    Core::Mat4 uniformData = GetUniformData();
+    Renderer()->WriteUniformDescriptor(frameResources, uniformData.GetData(), Core::Mat4::GetSize());
   }
 
   void Render(Core::FrameResource const& frameResources, vk::CommandBuffer const& commandBuffer) override
   {
+    // Everything is recorded through the render graph, which also takes care of the swapchain image barriers
+    (void)commandBuffer;
+
+    // Applied before anything of the frame is built, so the whole frame sees the same setting
+    bool isDynamicResolutionEnabled = m_IsDynamicResolutionRequested && m_IsDynamicResolutionSupported;
+    if (isDynamicResolutionEnabled != m_DynamicResolution.IsEnabled()) {
+      m_DynamicResolution.SetEnabled(isDynamicResolutionEnabled);
+    }
+
     LARGE_INTEGER currentTime, elapsedTimeInMilliSeconds;
     QueryPerformanceCounter(&currentTime);
     elapsedTimeInMilliSeconds.QuadPart = currentTime.QuadPart - m_StartTime.QuadPart;
@@ -244,82 +359,387 @@ public:
     elapsedTimeInMilliSeconds.QuadPart /= m_Frequency.QuadPart;
 
     vk::ClearValue clearValue = m_Transition.GetValue(static_cast<float>(elapsedTimeInMilliSeconds.QuadPart));
-    auto renderPassBeginInfo = vk::RenderPassBeginInfo(
-      Renderer()->GetRenderPass(),  // vk::RenderPass renderPass_ = {},
-      frameResources.m_Framebuffer, // vk::Framebuffer framebuffer_ = {},
-      vk::Rect2D(vk::Offset2D(0, 0),
-                 vk::Extent2D(frameResources.m_SwapchainImage.m_ImageWidth,
-                              frameResources.m_SwapchainImage.m_ImageHeight)), // vk::Rect2D renderArea_ = {},
-      1,                                                                       // uint32_t clearValueCount_ = {},
-      &clearValue // const vk::ClearValue* pClearValues_ = {}
-    );
+    vk::Extent2D swapchainExtent =
+      vk::Extent2D(frameResources.m_SwapchainImage.m_ImageWidth, frameResources.m_SwapchainImage.m_ImageHeight);
+
+    // Draws go through the render queue, which orders them by state and binds only what changes
+    m_RenderQueue.Reset();
+    m_RenderQueue.Submit(0,
+                         Core::DrawRequest{ Renderer()->GetPipeline(),
+                                            Renderer()->GetPipelineLayout(),
+                                            Renderer()->GetDescriptorSet(frameResources),
+                                            m_VertexRange.m_Buffer,
+                                            static_cast<uint32_t>(m_Vertices.size()),
+                                            1,
+                                            m_VertexRange.GetFirstElement(sizeof(Core::VertexData)),
+                                            0 },
+                         0.0f);
+    m_RenderQueue.Sort();
+
+    if (m_IsSpriteDemoEnabled) {
+      FillSpriteDemo(frameResources, swapchainExtent, static_cast<float>(elapsedTimeInMilliSeconds.QuadPart) / 1000.0f);
+    } else {
+      m_SpriteBatcher->Begin(frameResources, 0);
+    }
+
+    Core::RenderGraph& renderGraph = *frameResources.m_RenderGraph;
+    Core::RenderGraphResourceId vertexBuffer =
+      renderGraph.ImportBuffer("Vertex range", m_VertexRange.m_Buffer, m_VertexRange.m_Offset, m_VertexRange.m_Size);
+
+    // The field is culled against the same projection it is drawn with. The flag is loaded once, so the culling and
+    // the draws of the frame agree even if F7 is pressed while the frame is being built.
+    bool drawSpriteField = m_IsCullingDemoEnabled;
+    Core::GpuCullOutput cullOutput = Core::GpuCullOutput();
+    if (drawSpriteField) {
+      cullOutput = m_GpuCuller->AddCullPasses(
+        renderGraph, frameResources, GetUniformData(), m_GpuCuller->GetMaxObjectCount());
+    }
+    auto readMainPassInputs = [&renderGraph, vertexBuffer, drawSpriteField, cullOutput](uint32_t mainPass) {
+      renderGraph.Read(mainPass, vertexBuffer, Core::RenderGraphAccess::VertexBufferRead);
+      if (!drawSpriteField) { return; }
+      renderGraph.Read(mainPass, cullOutput.m_DrawCommands, Core::RenderGraphAccess::IndirectBufferRead);
+      renderGraph.Read(mainPass, cullOutput.m_DrawCount, Core::RenderGraphAccess::IndirectBufferRead);
+    };
+    // Lives until the graph has been executed at the end of the frame
+    Core::FrameResource const* frame = &frameResources;
+
+    // At full scale the scene goes straight into the swapchain image, there is nothing to upscale
+    vk::Extent2D sceneExtent = m_DynamicResolution.GetRenderExtent(swapchainExtent);
+    if (sceneExtent == swapchainExtent) {
+      vk::Framebuffer framebuffer = frameResources.m_Framebuffer;
+      uint32_t mainPass = renderGraph.AddPass(
+        "Main pass",
+        [this, frame, framebuffer, swapchainExtent, clearValue, drawSpriteField](vk::CommandBuffer passCommandBuffer) {
+          RecordMainPass(passCommandBuffer, *frame, framebuffer, swapchainExtent, clearValue, drawSpriteField);
+        });
+      renderGraph.Write(
+        mainPass, frameResources.m_SwapchainImage.m_GraphResourceId, Core::RenderGraphAccess::ColorAttachmentWrite);
+      readMainPassInputs(mainPass);
+      return;
+    }
+
+    // The scene is drawn at the current render scale, then stretched over the swapchain image
+    Core::RenderGraphResourceId sceneTarget =
+      m_DynamicResolution.CreateSceneTarget(renderGraph, swapchainExtent, Renderer()->GetSwapchainImageFormat());
+    Core::RenderGraph* graph = &renderGraph;
+    uint32_t mainPass = renderGraph.AddPass(
+      "Main pass",
+      [this, frame, graph, sceneTarget, sceneExtent, clearValue, drawSpriteField](vk::CommandBuffer passCommandBuffer) {
+        RecordMainPass(passCommandBuffer,
+                       *frame,
+                       graph->GetFramebuffer(sceneTarget, Renderer()->GetRenderPass()),
+                       sceneExtent,
+                       clearValue,
+                       drawSpriteField);
+      });
+    renderGraph.Write(mainPass, sceneTarget, Core::RenderGraphAccess::ColorAttachmentWrite);
+    readMainPassInputs(mainPass);
+    m_DynamicResolution.AddUpscalePass(renderGraph,
+                                       sceneTarget,
+                                       frameResources.m_SwapchainImage.m_GraphResourceId,
+                                       frameResources.m_SwapchainImage.m_Image,
+                                       swapchainExtent);
+  }
 
-    commandBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
-    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, Renderer()->GetPipeline());
-    commandBuffer.bindDescriptorSets(
-      vk::PipelineBindPoint::eGraphics, Renderer()->GetPipelineLayout(), 0, Renderer()->GetDescriptorSet(), nullptr);
-
-    auto viewport =
-      vk::Viewport(0.0f,                                                              // float x_ = {},
-                   0.0f,                                                              // float y_ = {},
-                   static_cast<float>(frameResources.m_SwapchainImage.m_ImageWidth),  // float width_ = {},
-                   static_cast<float>(frameResources.m_SwapchainImage.m_ImageHeight), // float height_ = {},
-                   0.0f,                                                              // float minDepth_ = {},
-                   1.0f                                                               // float maxDepth_ = {}
+  void RecordMainPass(vk::CommandBuffer passCommandBuffer,
+                      Core::FrameResource const& frameResources,
+                      vk::Framebuffer framebuffer,
+                      vk::Extent2D extent,
+                      vk::ClearValue clearValue,
+                      bool drawSpriteField)
+  {
+    // Goes into the capture as well when one is running, redundant binds are dropped on the way
+    Core::RecordingCommandBuffer commandBuffer(passCommandBuffer, Renderer()->GetCommandStreamRecorder());
+    auto renderPassBeginInfo =
+      vk::RenderPassBeginInfo(Renderer()->GetRenderPass(),            // vk::RenderPass renderPass_ = {},
+                              framebuffer,                            // vk::Framebuffer framebuffer_ = {},
+                              vk::Rect2D(vk::Offset2D(0, 0), extent), // vk::Rect2D renderArea_ = {},
+                              1,                                      // uint32_t clearValueCount_ = {},
+                              &clearValue                             // const vk::ClearValue* pClearValues_ = {}
       );
 
-    commandBuffer.setViewport(0, viewport);
+    commandBuffer.BeginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+
+    auto viewport = vk::Viewport(0.0f,                              // float x_ = {},
+                                 0.0f,                              // float y_ = {},
+                                 static_cast<float>(extent.width),  // float width_ = {},
+                                 static_cast<float>(extent.height), // float height_ = {},
+                                 0.0f,                              // float minDepth_ = {},
+                                 1.0f                               // float maxDepth_ = {}
+    );
+
+    commandBuffer.SetViewport(viewport);
+
+    auto scissor = vk::Rect2D(vk::Offset2D(0, 0), extent);
+    commandBuffer.SetScissor(scissor);
+    // Every mesh in the vertex chunk shares the chunk's bind, the range only selects the first vertex
+    m_RenderQueue.Execute(commandBuffer, 0);
+    // Neither is part of a running capture
+    if (drawSpriteField) {
+      m_SpriteBatcher->BindInstances(
+        commandBuffer.Get(), Renderer()->GetDescriptorSet(frameResources), m_SpriteField.m_Handle, 0);
+      vk::Buffer spriteField = m_SpriteField.m_Handle;
+      m_GpuCuller->Draw(
+        frameResources, commandBuffer.Get(), [spriteField](vk::CommandBuffer drawCommandBuffer, uint32_t chunkIdx) {
+          // The chunks are stored one after the other, the commands draw from instance 0 of the bound chunk
+          vk::DeviceSize chunkSize = FieldChunkSide * FieldChunkSide * sizeof(Core::Sprite);
+          drawCommandBuffer.bindVertexBuffers(0, spriteField, chunkIdx * chunkSize);
+        });
+    }
+    m_SpriteBatcher->Record(commandBuffer.Get());
+    commandBuffer.InvalidateState();
+    commandBuffer.EndRenderPass();
+    Renderer()->AddElidedCommandCount(frameResources, commandBuffer.GetElidedCommandCount());
+  }
 
-    auto scissor = vk::Rect2D(
-      vk::Offset2D(0, 0),
-      vk::Extent2D(frameResources.m_SwapchainImage.m_ImageWidth, frameResources.m_SwapchainImage.m_ImageHeight));
-    commandBuffer.setScissor(0, scissor);
-    commandBuffer.bindVertexBuffers(0, m_VertexBuffer.m_Handle, vk::DeviceSize(0));
-    commandBuffer.draw(static_cast<uint32_t>(m_Vertices.size()), 1, 0, 0);
-    commandBuffer.endRenderPass();
+  // A spinning spiral of avatars, written straight into the frame's instance stream by the job system
+  void FillSpriteDemo(Core::FrameResource const& frameResources, vk::Extent2D extent, float timeInSeconds)
+  {
+    m_SpriteBatcher->Begin(frameResources, SpriteDemoCount);
+    Core::Sprite* sprites = m_SpriteBatcher->Allocate(Renderer()->GetDescriptorSet(frameResources), SpriteDemoCount);
+    float radius = static_cast<float>(std::min(extent.width, extent.height)) / 2.0f;
+
+    Jobs()->ParallelFor(SpriteDemoCount, 4096, [sprites, radius, timeInSeconds](uint32_t begin, uint32_t end) {
+      float const goldenAngle = 2.39996323f;
+      for (uint32_t spriteIdx = begin; spriteIdx != end; ++spriteIdx) {
+        float t = static_cast<float>(spriteIdx) / static_cast<float>(SpriteDemoCount);
+        float angle = static_cast<float>(spriteIdx) * goldenAngle + timeInSeconds * 0.25f;
+        float distance = std::sqrt(t) * radius;
+        sprites[spriteIdx] = Core::Sprite{ { std::cos(angle) * distance, std::sin(angle) * distance },
+                                           { 12.0f, 12.0f },
+                                           { 0.0f, 0.0f, 1.0f, 1.0f },
+                                           angle + timeInSeconds,
+                                           Core::Sprite::PackColor(1.0f, t, 1.0f - t, 0.75f) };
+      }
+    });
   }
 
   void PostRender(Core::FrameStat const& frameStats) override
   {
+    if (!frameStats.m_IsValid) { return; }
+
     double frameTimeInMs = Renderer()->GetFrameTimeInMs(frameStats);
+    m_DynamicResolution.Update(frameTimeInMs);
     double fps = 1.0 / (frameTimeInMs / 1'000);
     std::ostringstream fpsMessage;
-    fpsMessage << "GPU time: " << frameTimeInMs << " ms (" << fps << " fps)";
+    fpsMessage << "Frame #" << frameStats.m_FrameNumber << " GPU time: " << frameTimeInMs << " ms (" << fps << " fps)";
+    if (m_DynamicResolution.IsEnabled()) { fpsMessage << ", render scale: " << m_DynamicResolution.GetScale(); }
+
+    Core::CpuFrameTimings const& cpuTimings = frameStats.m_CpuTimings;
+    fpsMessage << ", CPU fence wait: " << cpuTimings.m_FenceWaitInMs << " ms, acquire: " << cpuTimings.m_AcquireInMs
+               << " ms, pre-render: " << cpuTimings.m_PreRenderInMs << " ms, record: " << cpuTimings.m_RecordInMs
+               << " ms, submit: " << cpuTimings.m_SubmitInMs << " ms, present: " << cpuTimings.m_PresentInMs << " ms";
+    fpsMessage << ", elided commands: " << frameStats.m_ElidedCommandCount;
+
+    for (uint32_t passIdx = 0; passIdx != frameStats.m_PassCount; ++passIdx) {
+      fpsMessage << ", " << frameStats.m_Passes[passIdx].m_Name << ": "
+                 << Renderer()->GetPassTimeInMs(frameStats.m_Passes[passIdx]) << " ms";
+    }
+
+    if (frameStats.m_HasPipelineStatistics) {
+      Core::PipelineStatistics const& statistics = frameStats.m_PipelineStatistics;
+      fpsMessage << ", vertices: " << statistics.m_InputAssemblyVertices
+                 << ", vertex invocations: " << statistics.m_VertexShaderInvocations
+                 << ", clipping primitives: " << statistics.m_ClippingPrimitives
+                 << ", fragment invocations: " << statistics.m_FragmentShaderInvocations;
+    }
     Utils::Logger::Get().LogDebug(fpsMessage.str(), "FrameStat");
   }
 
   void OnDestroyRenderer()
   {
+    m_SpriteBatcher.reset();
+    m_GpuCuller.reset();
+    Renderer()->FreeBuffer(m_SpriteField);
     Renderer()->GetDevice().destroySampler(m_Sampler);
-    {
-      Renderer()->GetDevice().destroyImageView(m_Texture.m_View);
-      m_Texture.m_View = nullptr;
-      Renderer()->GetDevice().freeMemory(m_Texture.m_Memory);
-      m_Texture.m_Memory = nullptr;
-      Renderer()->GetDevice().destroyImage(m_Texture.m_Handle);
-      m_Texture.m_Handle = nullptr;
-      m_Texture.m_Width = 0;
-      m_Texture.m_Height = 0;
-    }
-    Renderer()->FreeBuffer(m_VertexBuffer);
+    Renderer()->ReleaseImage(m_TextureHandle);
+    Renderer()->GetSharedBufferPool()->Free(m_VertexRange);
+    Renderer()->StopCapture();
   }
 
 private:
+  static constexpr uint32_t SpriteDemoCount = 100'000;
+  static constexpr uint32_t FieldSpritesPerSide = 512;
+  static constexpr uint32_t FieldChunkSide = 8;
+  static constexpr float FieldSpacing = 16.0f;
+
   Core::Transition m_Transition;
+  Core::DynamicResolution m_DynamicResolution; // render thread only
+  std::atomic<bool> m_IsDynamicResolutionRequested;
+  bool m_IsDynamicResolutionSupported; // by the swapchain format
+  Core::RenderQueue m_RenderQueue;
+  std::unique_ptr<Core::SpriteBatcher> m_SpriteBatcher;
+  std::atomic<bool> m_IsSpriteDemoEnabled; // flipped by the window thread
+  std::unique_ptr<Core::GpuCuller> m_GpuCuller;
+  Core::BufferData m_SpriteField;
+  std::atomic<bool> m_IsCullingDemoEnabled; // flipped by the window thread
   LARGE_INTEGER m_StartTime;
   LARGE_INTEGER m_Frequency;
 
   std::vector<Core::VertexData> m_Vertices;
-  Core::BufferData m_VertexBuffer;
+  Core::SharedBufferRange m_VertexRange;
   vk::Sampler m_Sampler;
-  Core::ImageData m_Texture;
+  Core::ImageHandle m_TextureHandle;
 };
 
-int main()
+// Plays a capture of SampleApp back without a window and as fast as the GPU allows, the throughput is logged at the end
+class ReplayApp : public Core::Application
 {
+public:
+  ReplayApp() : Core::Application()
+  {
+    std::filesystem::path replayLog = Os::GetExecutableDirectory() / "logs/replay.log";
+
+    Utils::Logger::Get().Register<Utils::ConsoleLogger>("ConsoleLogger");
+    Utils::Logger::Get().Register<Utils::FileLogger>("ReplayLogger", replayLog, Utils::FileLogger::OpenMode::Truncate);
+    Utils::Logger::Get().MuteCategory("ConsoleLogger", "FrameStat");
+  }
+
+  virtual ~ReplayApp() {}
+
+  bool Initialize(std::filesystem::path const& capturePath)
+  {
+    if (!m_Player.Load(capturePath)) { return false; }
+    vk::Extent2D extent = m_Player.GetExtent();
+    if (!Application::InitializeHeadless(extent.width, extent.height, m_Player.GetFrameCount())) { return false; }
+
+    Core::FramePacing framePacing = Core::FramePacing::Throughput();
+    framePacing.m_PresentMode = vk::PresentModeKHR::eImmediate;
+    Renderer()->SetFramePacing(framePacing);
+    return true;
+  }
+
+  void InitializeRenderer() override
+  {
+    m_Player.Initialize(Renderer(),
+                        [this](std::shared_ptr<Core::CopyToLocalJob> const& job) { AddToTransferQueue(job); });
+  }
+
+  void PreRender(Core::FrameResource const& frameResources) override { m_Player.PlayFrame(frameResources); }
+
+  void Render(Core::FrameResource const& frameResources, vk::CommandBuffer const& commandBuffer) override
+  {
+    // The player has already added the frame's commands to the render graph
+    (void)frameResources;
+    (void)commandBuffer;
+  }
+
+  void PostRender(Core::FrameStat const& frameStats) override
+  {
+    if (!frameStats.m_IsValid) { return; }
+
+    std::ostringstream frameMessage;
+    frameMessage << "Frame #" << frameStats.m_FrameNumber << " GPU time: " << Renderer()->GetFrameTimeInMs(frameStats)
+                 << " ms, CPU record: " << frameStats.m_CpuTimings.m_RecordInMs << " ms";
+    Utils::Logger::Get().LogDebug(frameMessage.str(), "FrameStat");
+  }
+
+  void OnDestroyRenderer() override { m_Player.Free(); }
+
+private:
+  Core::CommandStreamPlayer m_Player;
+};
+
+// Culls objectCount random boxes and circles against a 1280x720 view inside a world 8 times as wide and as high, with
+// every instruction set the CPU supports. The best of a number of runs is printed, the data stays warm in the caches
+// as far as it fits.
+void RunCullingBenchmark(uint32_t objectCount)
+{
+  uint32_t const runCount = 50;
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> positionX(-5120.0f, 5120.0f);
+  std::uniform_real_distribution<float> positionY(-2880.0f, 2880.0f);
+  std::uniform_real_distribution<float> extent(1.0f, 64.0f);
+
+  Core::AabbBounds boxes;
+  Core::CircleBounds circles;
+  for (uint32_t objectIdx = 0; objectIdx != objectCount; ++objectIdx) {
+    float x = positionX(generator);
+    float y = positionY(generator);
+    float halfExtent = extent(generator);
+    boxes.Add(x - halfExtent, y - halfExtent, x + halfExtent, y + halfExtent);
+    circles.Add(x, y, halfExtent);
+  }
+
+  Core::CullRect view =
+    Core::CpuCuller::GetViewRect(Core::Mat4::GetOrthographic(-640.0f, 640.0f, -360.0f, 360.0f, -1.0f, 1.0f));
+  Core::CpuCuller culler;
+  uint32_t supportedInstructionSet = static_cast<uint32_t>(Core::CpuCuller::GetSupportedInstructionSet());
+  for (uint32_t instructionSet = 0; instructionSet <= supportedInstructionSet; ++instructionSet) {
+    culler.SetInstructionSet(static_cast<Core::CpuCuller::InstructionSet>(instructionSet));
+
+    auto measure = [&culler, runCount](auto const& bounds, char const* boundsName, Core::CullRect const& cullView) {
+      double bestInMs = std::numeric_limits<double>::max();
+      for (uint32_t runIdx = 0; runIdx != runCount; ++runIdx) {
+        auto start = std::chrono::steady_clock::now();
+        culler.Cull(bounds, cullView);
+        bestInMs = std::min(
+          bestInMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+      }
+      std::cout << Core::CpuCuller::GetInstructionSetName(culler.GetInstructionSet()) << " " << boundsName << ": "
+                << culler.GetVisibleCount() << " of " << bounds.GetCount() << " visible in " << bestInMs << " ms"
+                << std::endl;
+    };
+    measure(boxes, "boxes", view);
+    measure(circles, "circles", view);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  // --headless <frame count>: benchmark run without a window
+  // --capture <file>: records the session
+  // --replay <file>: plays a recorded session back headlessly
+  // --cull-benchmark <object count>: times the CPU culling and exits
+  uint64_t headlessFrameCount = 0;
+  uint32_t cullBenchmarkObjectCount = 0;
+  std::filesystem::path capturePath;
+  std::filesystem::path replayPath;
+  bool validArguments = true;
+  for (int argIdx = 1; argIdx < argc && validArguments; ++argIdx) {
+    std::string argument = argv[argIdx];
+    char const* value = argIdx + 1 < argc ? argv[argIdx + 1] : nullptr;
+    if (argument == "--headless") {
+      headlessFrameCount = value ? std::strtoull(value, nullptr, 10) : 0;
+      validArguments = headlessFrameCount > 0;
+      ++argIdx;
+    } else if (argument == "--capture") {
+      validArguments = value != nullptr;
+      if (value) { capturePath = value; }
+      ++argIdx;
+    } else if (argument == "--replay") {
+      validArguments = value != nullptr;
+      if (value) { replayPath = value; }
+      ++argIdx;
+    } else if (argument == "--cull-benchmark") {
+      cullBenchmarkObjectCount = value ? static_cast<uint32_t>(std::strtoul(value, nullptr, 10)) : 0;
+      validArguments = cullBenchmarkObjectCount > 0;
+      ++argIdx;
+    }
+  }
+
+  if (!validArguments) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--headless <frame count>] [--capture <file>] | --replay <file> | --cull-benchmark <object count>"
+              << std::endl;
+    return 1;
+  }
+
+  if (cullBenchmarkObjectCount > 0) {
+    RunCullingBenchmark(cullBenchmarkObjectCount);
+    return 0;
+  }
+
+  if (!replayPath.empty()) {
+    ReplayApp replay;
+    if (!replay.Initialize(replayPath)) { return 1; }
+    if (!replay.Start()) { return 1; }
+    return 0;
+  }
+
   SampleApp app;
 
-  if (!app.Initialize()) { return 1; }
+  if (!app.Initialize(headlessFrameCount, capturePath)) { return 1; }
 
   if (!app.Start()) { return 1; }
 
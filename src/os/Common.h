@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <filesystem>
 #include <vector>
 
@@ -7,4 +8,7 @@ namespace Os {
 std::filesystem::path GetExecutableDirectory();
 std::vector<char> ReadContentFromBinaryFile(char const* filename);
 std::vector<char> LoadTextureData(char const* filename, uint32_t& width, uint32_t& height);
+
+// Sleeps until the deadline with sub-millisecond accuracy, the last stretch is spent spinning
+void SleepUntil(std::chrono::steady_clock::time_point deadline);
 } // namespace Os
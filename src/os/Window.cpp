@@ -27,11 +27,19 @@ Window::Window() :
   m_OnWindowClose(nullptr),
   m_OnCharacterReceived(nullptr),
   m_OnKeyEvent(nullptr),
+  m_OnWindowResize(nullptr),
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+  m_WakeEvent(nullptr),
+#endif
   m_LastHighSurrogate(0)
 {}
 
 Window::~Window()
 {
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+  if (m_WakeEvent) { CloseHandle(m_WakeEvent); }
+  m_WakeEvent = nullptr;
+#endif
   m_WindowParameters.m_Handle = nullptr;
 }
 
@@ -55,6 +63,10 @@ bool Window::Create(wchar_t const windowTitle[], uint32_t width, uint32_t height
 
   if (!RegisterClassExW(&wc)) { return false; }
 
+  // Auto-reset, a single Wake() releases a single WaitEvents()
+  m_WakeEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+  if (!m_WakeEvent) { return false; }
+
   RECT windowRect{ 0, 0, static_cast<LONG>(width), static_cast<LONG>(height) };
   AdjustWindowRect(&windowRect, WS_OVERLAPPEDWINDOW, false);
   m_WindowParameters.m_Handle = CreateWindowExW(0L,
@@ -93,6 +105,22 @@ void Window::PollEvents()
   }
 }
 
+void Window::WaitEvents()
+{
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+  // QS_ALLINPUT also returns for messages that arrived before the call but have not been looked at yet
+  MsgWaitForMultipleObjectsEx(1, &m_WakeEvent, INFINITE, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+#endif
+  PollEvents();
+}
+
+void Window::Wake()
+{
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+  if (m_WakeEvent) { SetEvent(m_WakeEvent); }
+#endif
+}
+
 void Window::SetOnWindowClose(std::function<OnWindowCloseCallback> callback)
 {
   m_OnWindowClose = callback;
@@ -108,6 +136,11 @@ void Window::SetOnKeyEvent(std::function<OnKeyEventCallback> callback)
   m_OnKeyEvent = callback;
 }
 
+void Window::SetOnWindowResize(std::function<OnWindowResizeCallback> callback)
+{
+  m_OnWindowResize = callback;
+}
+
 WindowParameters Window::GetWindowParameters() const
 {
   return m_WindowParameters;
@@ -184,6 +217,16 @@ LRESULT Window::HandleMessage(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam
     if (wParam == SC_KEYMENU) { return 0; }
     return DefWindowProcW(hwnd, uMsg, wParam, lParam);
   } break;
+  case WM_SIZE: {
+    if (m_OnWindowResize) {
+      if (wParam == SIZE_MINIMIZED) {
+        m_OnWindowResize(this, 0, 0);
+      } else {
+        m_OnWindowResize(this, static_cast<uint32_t>(LOWORD(lParam)), static_cast<uint32_t>(HIWORD(lParam)));
+      }
+    }
+    return DefWindowProcW(hwnd, uMsg, wParam, lParam);
+  } break;
   case WM_DESTROY: {
     PostQuitMessage(0);
     return 0;
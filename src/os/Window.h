@@ -23,13 +23,19 @@ public:
   typedef void(OnWindowCloseCallback)(Window* window);
   typedef void(OnCharacterReceivedCallback)(Window* window, uint32_t codePoint, Core::ModifierKeys modifiers);
   typedef void(OnKeyEventCallback)(Window* window, uint8_t keyCode, Core::KeypressAction action, Core::ModifierKeys modifiers, uint16_t repeatCount);
+  // Width and height are zero while the window is minimized
+  typedef void(OnWindowResizeCallback)(Window* window, uint32_t width, uint32_t height);
   explicit Window();
   ~Window();
   bool Create(wchar_t const windowTitle[], uint32_t width, uint32_t height);
   void PollEvents();
+  // Blocks until a window message arrives or Wake() is called from another thread, then processes the pending messages
+  void WaitEvents();
+  void Wake();
   void SetOnWindowClose(std::function<OnWindowCloseCallback> callback);
   void SetOnCharacterReceived(std::function<OnCharacterReceivedCallback> callback);
   void SetOnKeyEvent(std::function<OnKeyEventCallback> callback);
+  void SetOnWindowResize(std::function<OnWindowResizeCallback> callback);
 
   [[nodiscard]] WindowParameters GetWindowParameters() const;
   LRESULT HandleMessage(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
@@ -42,6 +48,11 @@ private:
   std::function<OnWindowCloseCallback> m_OnWindowClose;
   std::function<OnCharacterReceivedCallback> m_OnCharacterReceived;
   std::function<OnKeyEventCallback> m_OnKeyEvent;
+  std::function<OnWindowResizeCallback> m_OnWindowResize;
+
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+  HANDLE m_WakeEvent;
+#endif
 
   uint32_t m_LastHighSurrogate;
 };
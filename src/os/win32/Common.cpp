@@ -2,8 +2,13 @@
 #include "utils/Logger.h"
 #include <Windows.h>
 #include <filesystem>
+#include <immintrin.h>
 #include <stdio.h>
 
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
 namespace Os {
 std::filesystem::path GetExecutableDirectory()
 {
@@ -20,4 +25,32 @@ std::filesystem::path GetExecutableDirectory()
   path.remove_filename();
   return path;
 }
+
+void SleepUntil(std::chrono::steady_clock::time_point deadline)
+{
+  // The high resolution timer (Windows 10 1803+) wakes up within a fraction of a millisecond, the regular one only on
+  // the next scheduler tick, so the spin margin has to cover a whole tick when falling back to it
+  thread_local HANDLE timer =
+    CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+  auto const spinMargin = timer ? std::chrono::microseconds(500) : std::chrono::microseconds(2000);
+
+  while (true) {
+    auto remaining = deadline - std::chrono::steady_clock::now();
+    if (remaining <= spinMargin) { break; }
+
+    auto sleepTime = std::chrono::duration_cast<std::chrono::microseconds>(remaining - spinMargin);
+    if (timer) {
+      LARGE_INTEGER dueTime;
+      dueTime.QuadPart = -static_cast<LONGLONG>(sleepTime.count() * 10); // relative, in 100 ns units
+      SetWaitableTimerEx(timer, &dueTime, 0, NULL, NULL, NULL, 0);
+      WaitForSingleObject(timer, INFINITE);
+    } else {
+      Sleep(static_cast<DWORD>(sleepTime.count() / 1000));
+    }
+  }
+
+  while (std::chrono::steady_clock::now() < deadline) {
+    _mm_pause();
+  }
+}
 } // namespace Os
@@ -0,0 +1,33 @@
+#version 460
+
+layout(set = 0, binding = 1) uniform u_UniformBuffer {
+  mat4 u_ProjectionMatrix;
+};
+
+// Per instance, the quad itself has no vertex data
+layout(location = 0) in vec2 i_Position;
+layout(location = 1) in vec2 i_Size;
+layout(location = 2) in vec4 i_UvRect;
+layout(location = 3) in float i_Rotation;
+layout(location = 4) in vec4 i_Color;
+
+out gl_PerVertex {
+  vec4 gl_Position;
+};
+
+layout(location = 0) out vec2 v_TexCoord;
+layout(location = 1) out vec4 v_Color;
+
+void main()
+{
+  // Triangle strip corners (0, 0), (1, 0), (0, 1), (1, 1)
+  vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+  vec2 offset = (corner - 0.5) * i_Size;
+  float s = sin(i_Rotation);
+  float c = cos(i_Rotation);
+  vec2 position = i_Position + vec2(c * offset.x - s * offset.y, s * offset.x + c * offset.y);
+
+  gl_Position = u_ProjectionMatrix * vec4(position, 0.0, 1.0);
+  v_TexCoord = mix(i_UvRect.xy, i_UvRect.zw, corner);
+  v_Color = i_Color;
+}
\ No newline at end of file